@@ -3,23 +3,131 @@
 //
 
 #include "Env.h"
+#include "Val.h"
+#include <stdexcept>
 
 PTR(Env) Env::empty = NEW (EmptyEnv)();
 
-PTR(Val) EmptyEnv::lookup(std::string find_name) {
+PTR(Val) EmptyEnv::lookup(const std::string &find_name) {
+    stats_lookup_done();
     throw std::runtime_error("free variable: " + find_name);
 };
 
+PTR(Val) EmptyEnv::lookup_at(const std::string &, int) {
+    stats_lookup_abandon();
+    return nullptr;
+}
+
 ExtendedEnv::ExtendedEnv(std::string name_, PTR(Val) val_, PTR(Env) rest_) {
-    name = name_;
-    val = val_;
-    rest = rest_;
+    name = std::move(name_);
+    val = std::move(val_);
+    rest = std::move(rest_);
 }
 
-PTR(Val) ExtendedEnv::lookup(std::string findName) {
+PTR(Val) ExtendedEnv::lookup(const std::string &findName) {
+    stats_lookup_step();
     if(findName == name){
+        stats_lookup_done();
+        if (val == nullptr) {
+            throw std::runtime_error("variable used before its _letrec value is ready: " + name);
+        }
         return val;
     } else {
         return rest->lookup(findName);
     }
 };
+
+void ExtendedEnv::set_value(PTR(Val) val_) {
+    val = std::move(val_);
+}
+
+//Skips depth frames without comparing names, then checks the one it lands on
+PTR(Val) ExtendedEnv::lookup_at(const std::string &find_name, int depth) {
+    stats_lookup_step();
+    if (depth > 0) {
+        return rest->lookup_at(find_name, depth - 1);
+    }
+    if (find_name != name) {
+        stats_lookup_abandon();
+        return nullptr;
+    }
+    stats_lookup_done();
+    return val;
+}
+
+std::shared_ptr<void> ExtendedEnv::gc_self() {
+    return shared_from_this();
+}
+
+void ExtendedEnv::gc_edges(std::vector<GcNode *> &out) {
+    GcNode *n = dynamic_cast<GcNode *>(val.get());
+    if (n != nullptr) {
+        out.push_back(n);
+    }
+    n = dynamic_cast<GcNode *>(rest.get());
+    if (n != nullptr) {
+        out.push_back(n);
+    }
+}
+
+void ExtendedEnv::gc_clear() {
+    val = nullptr;
+    rest = nullptr;
+}
+
+FrameEnv::FrameEnv(std::shared_ptr<const std::vector<std::string> > names, std::vector<PTR(Val)> vals,
+                   PTR(Env) rest) {
+    this->names = std::move(names);
+    this->vals = std::move(vals);
+    this->rest = std::move(rest);
+}
+
+//The last binding of a name wins, as it would with nested _funs
+PTR(Val) FrameEnv::lookup(const std::string &find_name) {
+    stats_lookup_step();
+    for (size_t i = names->size(); i > 0; i--) {
+        if ((*names)[i - 1] == find_name) {
+            stats_lookup_done();
+            return vals[i - 1];
+        }
+    }
+    return rest->lookup(find_name);
+}
+
+PTR(Val) FrameEnv::lookup_at(const std::string &find_name, int depth) {
+    stats_lookup_step();
+    if (depth > 0) {
+        return rest->lookup_at(find_name, depth - 1);
+    }
+    for (size_t i = names->size(); i > 0; i--) {
+        if ((*names)[i - 1] == find_name) {
+            stats_lookup_done();
+            return vals[i - 1];
+        }
+    }
+    stats_lookup_abandon();
+    return nullptr;
+}
+
+std::shared_ptr<void> FrameEnv::gc_self() {
+    return shared_from_this();
+}
+
+void FrameEnv::gc_edges(std::vector<GcNode *> &out) {
+    GcNode *n;
+    for (size_t i = 0; i < vals.size(); i++) {
+        n = dynamic_cast<GcNode *>(vals[i].get());
+        if (n != nullptr) {
+            out.push_back(n);
+        }
+    }
+    n = dynamic_cast<GcNode *>(rest.get());
+    if (n != nullptr) {
+        out.push_back(n);
+    }
+}
+
+void FrameEnv::gc_clear() {
+    vals.clear();
+    rest = nullptr;
+}
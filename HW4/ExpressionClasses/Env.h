@@ -7,6 +7,9 @@
 
 #include "pointer.h"
 #include <string>
+#include <vector>
+#include "stats.h"
+#include "gc.h"
 
 class Val;
 class Expr;
@@ -14,16 +17,18 @@ class Expr;
 CLASS(Env) {
 public:
     static PTR(Env) empty;
-    virtual PTR(Val) lookup(std::string find_name) = 0;
-
+    virtual PTR(Val) lookup(const std::string &find_name) = 0;
+    //The value depth frames in if it is bound to find_name, otherwise nullptr
+    virtual PTR(Val) lookup_at(const std::string &find_name, int depth) = 0;
 };
 
-class EmptyEnv : public Env {
+class EmptyEnv : public Env, private Counted<stats_empty_env, EmptyEnv> {
 public:
-    PTR(Val) lookup(std::string find_name);
+    PTR(Val) lookup(const std::string &find_name);
+    PTR(Val) lookup_at(const std::string &find_name, int depth);
 };
 
-class ExtendedEnv : public Env {
+class ExtendedEnv : public Env, public GcNode, private Counted<stats_extended_env, ExtendedEnv> {
 private:
     std::string name;
     PTR(Val) val;
@@ -31,8 +36,32 @@ private:
 
 public:
     ExtendedEnv(std::string name_, PTR(Val) val_, PTR(Env) rest_);
-    PTR(Val) lookup(std::string findName);
+    PTR(Val) lookup(const std::string &findName);
+    //Fills in the binding made with a nullptr value for _letrec
+    void set_value(PTR(Val) val_);
+    PTR(Val) lookup_at(const std::string &find_name, int depth);
+    std::shared_ptr<void> gc_self();
+    void gc_edges(std::vector<GcNode *> &out);
+    void gc_clear();
 };
 
+/**
+ * \brief One frame binding all the arguments of a multi-argument call.
+ * The names are the called function's own list, shared rather than copied.
+ */
+class FrameEnv : public Env, public GcNode, private Counted<stats_frame_env, FrameEnv> {
+private:
+    std::shared_ptr<const std::vector<std::string> > names;
+    std::vector<PTR(Val)> vals;
+    PTR(Env) rest;
+
+public:
+    FrameEnv(std::shared_ptr<const std::vector<std::string> > names, std::vector<PTR(Val)> vals, PTR(Env) rest);
+    PTR(Val) lookup(const std::string &find_name);
+    PTR(Val) lookup_at(const std::string &find_name, int depth);
+    std::shared_ptr<void> gc_self();
+    void gc_edges(std::vector<GcNode *> &out);
+    void gc_clear();
+};
 
 #endif //EXPRESSIONCLASSES_ENV_H
@@ -9,23 +9,101 @@
 #include "Expr.h"
 #include "Val.h"
 #include "Env.h"
+#include "serialize.h"
+#include "profile.h"
+#include "budget.h"
+#include "trace.h"
+#include "typecheck.h"
+#include <typeinfo>
 
 using namespace std;
 
+/***********PRETTY STREAM****************/
+/**
+ * \brief Constructor for PrettyStream.
+ * \param out The stream that receives the pretty printed text.
+ */
+PrettyStream::PrettyStream(ostream &out) : ostream(nullptr), buf(out.rdbuf()) {
+    this->init(&buf);
+}
+
+/**
+ * \brief The number of characters written so far.
+ * \return The position of the next character, counted from the first one written.
+ */
+std::streampos PrettyStream::position() {
+    return buf.count;
+}
+
+PrettyStream::CountingBuf::CountingBuf(streambuf *target) {
+    this->target = target;
+    this->count = 0;
+}
+
+PrettyStream::CountingBuf::int_type PrettyStream::CountingBuf::overflow(int_type c) {
+    if (traits_type::eq_int_type(c, traits_type::eof())) {
+        return traits_type::not_eof(c);
+    }
+    if (traits_type::eq_int_type(target->sputc(traits_type::to_char_type(c)), traits_type::eof())) {
+        return traits_type::eof();
+    }
+    count++;
+    return c;
+}
+
+streamsize PrettyStream::CountingBuf::xsputn(const char *s, streamsize n) {
+    streamsize written = target->sputn(s, n);
+    count += written;
+    return written;
+}
+
+int PrettyStream::CountingBuf::sync() {
+    return target->pubsync();
+}
+
 /***********EXPR CLASS****************/
+void append_int(string &out, int n) {
+    char digits[12];
+    int i = sizeof(digits);
+    unsigned int u = n < 0 ? 0u - (unsigned int) n : (unsigned int) n;
+    do {
+        digits[--i] = (char) ('0' + u % 10);
+        u /= 10;
+    } while (u != 0);
+    if (n < 0) {
+        digits[--i] = '-';
+    }
+    out.append(digits + i, sizeof(digits) - i);
+}
+
+/**
+ * \brief Prints the expression to an output stream.
+ * \param os The output stream to print to.
+ * The whole tree is printed into one buffer, which is written to os in a single call.
+ */
+void Expr::print(ostream &os) {
+    string out;
+    this->print_to(out);
+    os.write(out.data(), out.size());
+}
+
 string Expr::to_string() {
-    stringstream st("");
-    this->print(st);
-    return st.str();
+    string out;
+    this->print_to(out);
+    return out;
 }
 
-void Expr::pretty_print_at(ostream &os, precedence_t node, bool let_parent, streampos &strmpos) {
+void Expr::pretty_print_at(PrettyStream &os, precedence_t node, bool let_parent, streampos &strmpos) {
     print(os);
 }
 
 void Expr::pretty_print(ostream &ostream) {
+    PrettyStream pretty(ostream);
     streampos strmpos = 0;
-    pretty_print_at(ostream, prec_none, false, strmpos );
+    pretty_print_at(pretty, prec_none, false, strmpos );
+    if (pretty.fail()) {
+        ostream.setstate(ios::badbit);
+    }
 }
 
 string Expr::to_pretty_string() {
@@ -50,7 +128,7 @@ Num::Num(int val) {
  * \return false if num is a null pointer, true otherwise.
  * Verifies the current Num object is equal to a different expression.
  */
-bool Num::equals(PTR(Expr) e) {
+bool Num::equals(const PTR(Expr) &e) {
     //check that other is not null
     if (e != nullptr) {
         PTR(Num) otherNum = CAST(Num)(e);
@@ -68,11 +146,14 @@ bool Num::equals(PTR(Expr) e) {
  * \brief the interp() function for Num class.
  * \return the integer val of Num object.
  */
-PTR(Val) Num::interp(PTR(Env) env) {
-    if (env == nullptr){
-        env = Env::empty;
-    }
-    return NEW(NumVal)(val);
+PTR(Val) Num::interp(const PTR(Env) &) {
+    ProfileScope scope(prof_num);
+    EvalStep step;
+    TraceScope trace(prof_num, span.start);
+    return trace.result(NEW(NumVal)(val));
+}
+
+void Num::resolve(frames_t &) {
 }
 
 /**
@@ -98,11 +179,29 @@ PTR(Val) Num::interp(PTR(Env) env) {
 
 /**
  * \brief the print function for Num.
- * \param os The output stream to print to.
- * Prints the value of the Num object as a string to the specified output stream.
+ * \param out The buffer to print to.
+ * Appends the value of the Num object to the buffer.
+ */
+void Num::print_to(string &out) {
+    append_int(out, val);
+}
+
+/**
+ * \brief Writes the Num node to a binary AST.
+ * \param out The writer collecting the nodes.
+ */
+void Num::emit_ast(AstWriter &out) {
+    out.tag(ast_num, span);
+    out.num(val);
+}
+
+/**
+ * \brief Infers the type of a Num.
+ * \param tc The inference in progress.
+ * \return Always int.
  */
-void Num::print(ostream &os) {
-    os << ::to_string(val);
+PTR(Type) Num::infer(TypeChecker &tc) {
+    return tc.num();
 }
 
 /****************VAR CLASS****************/
@@ -112,7 +211,7 @@ void Num::print(ostream &os) {
  * Creates a Num object out of val.
  */
 Var::Var(string name) {
-    this->name = name;
+    this->name = std::move(name);
 }
 
 /**
@@ -121,7 +220,7 @@ Var::Var(string name) {
  * \return true if name is equal, false otherwise.
  * Verifies the current Var object is equal to a different name.
  */
-bool Var::equals(PTR(Expr) e) {
+bool Var::equals(const PTR(Expr) &e) {
     PTR(Var) var = CAST(Var)(e);
     if (var) {
         return this->name == var->name;
@@ -131,15 +230,42 @@ bool Var::equals(PTR(Expr) e) {
 
 /**
  * \brief the interp() function for Var class.
- * \return runtime error.
+ * \return the value bound to name in env. Throws runtime_error if name is free.
+ * Lexical scope puts a variable bound inside the tree at the same depth on every
+ * run, so once the binder's resolve() has found it, it goes straight to that
+ * frame and only checks the name there. Any other variable is looked up by name.
  */
-PTR(Val) Var::interp(PTR(Env) env) {
-    if (env == nullptr){
-        env = Env::empty;
+PTR(Val) Var::interp(const PTR(Env) &env_) {
+    ProfileScope scope(prof_var);
+    EvalStep step;
+    TraceScope trace(prof_var, span.start);
+    const PTR(Env) &env = env_ != nullptr ? env_ : Env::empty;
+    if (spec == spec_depth) {
+        PTR(Val) v = env->lookup_at(name, depth);
+        if (v != nullptr) {
+            return trace.result(forced(std::move(v)));
+        }
+        spec = spec_generic;
     }
-    throw std::runtime_error("Variable has no value");
+    return trace.result(forced(env->lookup(name)));
+}
 
-    return NEW(NumVal)(-1);
+/**
+ * \brief Fixes the depth of this variable if one of the frames in scope binds it.
+ * A variable bound outside the tree keeps looking itself up by name, since the
+ * environments it is run in need not have the same frames.
+ */
+void Var::resolve(frames_t &scope) {
+    for (size_t i = scope.size(); i > 0; i--) {
+        const vector<string> &frame = scope[i - 1];
+        for (size_t j = 0; j < frame.size(); j++) {
+            if (frame[j] == name) {
+                depth = (int) (scope.size() - i);
+                spec = spec_depth;
+                return;
+            }
+        }
+    }
 }
 
 /**
@@ -170,11 +296,114 @@ PTR(Val) Var::interp(PTR(Env) env) {
 
 /**
  * \brief the print function for Var.
- * \param ostream The output stream to print to.
- * Prints the value of the Var object to the specified output stream.
+ * \param out The buffer to print to.
+ * Appends the name of the Var object to the buffer.
+ */
+void Var::print_to(string &out) {
+    out += name;
+}
+
+/**
+ * \brief Writes the Var node to a binary AST.
+ * \param out The writer collecting the nodes.
+ */
+void Var::emit_ast(AstWriter &out) {
+    out.tag(ast_var, span);
+    out.name(name);
+}
+
+/**
+ * \brief Infers the type of a Var from its binding.
+ * \param tc The inference in progress.
+ * \return A fresh instance of the type the variable was bound with.
  */
-void Var::print(ostream &ostream) {
-    ostream << name;
+PTR(Type) Var::infer(TypeChecker &tc) {
+    return tc.lookup(name);
+}
+
+/****************OPERATOR CHAINS****************/
+//The parser turns a + b + c into a Sum, and a + b into an Add; either way it stands for the
+//right-leaning chain a + (b + c). These walk a chain in either form one operand at a time, so
+//comparing long chains does not recurse once per operand.
+
+/**
+ * \brief Takes the next operand off a chain of Binary and Nary nodes.
+ * \param node The rest of the chain; moved past the operand taken.
+ * \param index How many operands of an Nary node have been taken already.
+ * \param operand Set to the operand taken.
+ * \return False, taking nothing, once node is the chain's last operand.
+ */
+template <class Binary, class Nary>
+static bool chain_next(PTR(Expr) &node, size_t &index, PTR(Expr) &operand) {
+    if (PTR(Binary) b = CAST(Binary)(node)) {
+        operand = b->lhs;
+        node = b->rhs;
+        return true;
+    }
+    if (PTR(Nary) n = CAST(Nary)(node)) {
+        operand = n->operands[index++];
+        if (index + 1 == n->operands.size()) {
+            node = n->operands.back();
+            index = 0;
+        }
+        return true;
+    }
+    return false;
+}
+
+/**
+ * \brief Compares two chains operand by operand, whichever mix of nodes they are made of.
+ * \param a The first chain.
+ * \param b The second.
+ * \return True if they have the same operands in the same order.
+ */
+template <class Binary, class Nary>
+static bool chains_equal(PTR(Expr) a, PTR(Expr) b) {
+    size_t i = 0;
+    size_t j = 0;
+    PTR(Expr) x;
+    PTR(Expr) y;
+    while (true) {
+        bool more_a = chain_next<Binary, Nary>(a, i, x);
+        bool more_b = chain_next<Binary, Nary>(b, j, y);
+        if (more_a != more_b) {
+            return false;
+        }
+        if (!more_a) {
+            return a->equals(b);
+        }
+        if (!x->equals(y)) {
+            return false;
+        }
+    }
+}
+
+/**
+ * \brief Finishes a Sum or Product whose operand first gave something other than a NumVal.
+ * Evaluates the remaining operands, then combines from the right as the nested binary
+ * nodes would, so the same error comes out for the same operands.
+ * \param operands All of the node's operands.
+ * \param first The operand that was not a NumVal.
+ * \param value Its value.
+ * \param done The sum or product of the operands before it.
+ * \param env The environment the operands are evaluated in.
+ * \param add True for a Sum, false for a Product.
+ */
+static PTR(Val) finish_chain(const vector<PTR(Expr)> &operands, size_t first, const PTR(Val) &value, int done,
+                             const PTR(Env) &env, bool add) {
+    vector<PTR(Val)> vals(1, value);
+    for (size_t i = first + 1; i < operands.size(); i++) {
+        vals.push_back(operands[i]->interp(env));
+    }
+    PTR(Val) result = vals.back();
+    for (size_t i = vals.size() - 1; i > 0; i--) {
+        result = add ? vals[i - 1]->add_to(result) : vals[i - 1]->mult_with(result);
+    }
+    if (first > 0) {
+        PTR(Val) before = NEW(NumVal)(done);
+        result = add ? before->add_to(result) : before->mult_with(result);
+    }
+    return result;
 }
 
 /****************ADD CLASS****************/
@@ -185,8 +414,8 @@ void Var::print(ostream &ostream) {
  * \param rhs The right expression.
  */
 Add::Add(PTR(Expr) lhs, PTR(Expr) rhs) {
-    this->lhs = lhs;
-    this->rhs = rhs;
+    this->lhs = std::move(lhs);
+    this->rhs = std::move(rhs);
 }
 
 /**
@@ -194,24 +423,43 @@ Add::Add(PTR(Expr) lhs, PTR(Expr) rhs) {
  * \param e the expression you compare.
  * \return false if add is a null pointer, true otherwise.
  * Verifies the current Var object is equal to a different expression.
+ * A Sum of the same operands is equal too.
  */
-bool Add::equals(PTR(Expr) e) {
-        PTR(Add) otherAdd = CAST(Add)(e);
-        if (otherAdd != nullptr && lhs->equals(otherAdd->lhs) && rhs->equals(otherAdd->rhs)){
-            return true;
-        }
-        return false;
+bool Add::equals(const PTR(Expr) &e) {
+    return chains_equal<Add, Sum>(THIS, e);
 }
 
 /**
  * \brief the interp() function for Add class.
  * \return lefthand side and righthand side with the Interp() method.
  */
-PTR(Val) Add::interp(PTR(Env) env) {
-    if (env == nullptr){
-        env = Env::empty;
+PTR(Val) Add::interp(const PTR(Env) &env_) {
+    ProfileScope scope(prof_add);
+    EvalStep step;
+    TraceScope trace(prof_add, span.start);
+    const PTR(Env) &env = env_ != nullptr ? env_ : Env::empty;
+    if (statically_typed) {
+        //Both sides are known to be numbers, so skip add_to()'s CAST
+        PTR(Val) l = this->lhs->interp(env);
+        PTR(Val) r = this->rhs->interp(env);
+        return trace.result(NEW(NumVal)(static_cast<NumVal *>(l.get())->val + static_cast<NumVal *>(r.get())->val));
+    }
+    if (spec != spec_generic) {
+        PTR(Val) l = this->lhs->interp(env);
+        PTR(Val) r = this->rhs->interp(env);
+        if (typeid(*l) == typeid(NumVal) && typeid(*r) == typeid(NumVal)) {
+            spec = spec_num;
+            return trace.result(NEW(NumVal)(static_cast<NumVal *>(l.get())->val + static_cast<NumVal *>(r.get())->val));
+        }
+        spec = spec_generic;
+        return trace.result(l->add_to(r));
     }
-    return this->lhs->interp(env)->add_to(this->rhs->interp(env));
+    return trace.result(this->lhs->interp(env)->add_to(this->rhs->interp(env)));
+}
+
+void Add::resolve(frames_t &scope) {
+    lhs->resolve(scope);
+    rhs->resolve(scope);
 }
 
 /**
@@ -233,15 +481,37 @@ PTR(Val) Add::interp(PTR(Env) env) {
 //}
 
 /**
- * \brief Prints the Add expression to an output stream.
- * \param ostream The output stream to print to.
+ * \brief Prints the Add expression to a buffer.
+ * \param out The buffer to print to.
+ */
+void Add::print_to(string &out) {
+    out += "(";
+    lhs->print_to(out);
+    out += " + ";
+    rhs->print_to(out);
+    out += ")";
+}
+
+/**
+ * \brief Writes the Add node to a binary AST.
+ * \param out The writer collecting the nodes.
+ */
+void Add::emit_ast(AstWriter &out) {
+    out.tag(ast_add, span);
+    lhs->emit_ast(out);
+    rhs->emit_ast(out);
+}
+
+/**
+ * \brief Infers the type of an Add; both operands must be numbers.
+ * \param tc The inference in progress.
+ * \return Always int.
  */
-void Add::print(ostream &ostream) {
-    ostream << "(";
-    lhs->print(ostream);
-    ostream << " + ";
-    rhs->print(ostream);
-    ostream << ")";
+PTR(Type) Add::infer(TypeChecker &tc) {
+    tc.unify(tc.num(), lhs->infer(tc), lhs.get());
+    tc.unify(tc.num(), rhs->infer(tc), rhs.get());
+    tc.mark(this, tc.num(), ty_num);
+    return tc.num();
 }
 
 /**
@@ -249,7 +519,7 @@ void Add::print(ostream &ostream) {
  * \param o The output stream to print to.
  * \param prec The precedence level of the expression's context.
  */
-void Add::pretty_print_at(ostream &os, precedence_t node, bool let_parent, streampos &strmpos) {
+void Add::pretty_print_at(PrettyStream &os, precedence_t node, bool let_parent, streampos &strmpos) {
     if (node >= prec_add) {
         os << "(";
     }
@@ -270,33 +540,50 @@ void Add::pretty_print_at(ostream &os, precedence_t node, bool let_parent, strea
  * Initializes a Mult object with two expressions to be multiplied.
  */
 Mult::Mult(PTR(Expr) lhs, PTR(Expr) rhs) {
-    this->lhs = lhs;
-    this->rhs = rhs;
+    this->lhs = std::move(lhs);
+    this->rhs = std::move(rhs);
 }
 
 /**
  * \brief Checks if this Mult expression is equal to another expression.
  * \param e The expression to compare with.
  * \return True if both lhs and rhs of Mult are equal to those of e, false otherwise.
+ * A Product of the same operands is equal too.
  */
-bool Mult::equals(PTR(Expr) e) {
-    PTR(Mult) mult = CAST(Mult)(e);
-    if (mult == nullptr) {
-        return false;
-    } else {
-        return lhs->equals(mult->lhs) && rhs->equals(mult->rhs);
-    }
+bool Mult::equals(const PTR(Expr) &e) {
+    return chains_equal<Mult, Product>(THIS, e);
 }
 
 /**
  * \brief Evaluates the multiplication expression.
  * \return The product of the interpretations of lhs and rhs.
  */
-PTR(Val) Mult::interp(PTR(Env) env) {
-    if (env == nullptr){
-        env = Env::empty;
+PTR(Val) Mult::interp(const PTR(Env) &env_) {
+    ProfileScope scope(prof_mult);
+    EvalStep step;
+    TraceScope trace(prof_mult, span.start);
+    const PTR(Env) &env = env_ != nullptr ? env_ : Env::empty;
+    if (statically_typed) {
+        PTR(Val) l = this->lhs->interp(env);
+        PTR(Val) r = this->rhs->interp(env);
+        return trace.result(NEW(NumVal)(static_cast<NumVal *>(l.get())->val * static_cast<NumVal *>(r.get())->val));
+    }
+    if (spec != spec_generic) {
+        PTR(Val) l = this->lhs->interp(env);
+        PTR(Val) r = this->rhs->interp(env);
+        if (typeid(*l) == typeid(NumVal) && typeid(*r) == typeid(NumVal)) {
+            spec = spec_num;
+            return trace.result(NEW(NumVal)(static_cast<NumVal *>(l.get())->val * static_cast<NumVal *>(r.get())->val));
+        }
+        spec = spec_generic;
+        return trace.result(l->mult_with(r));
     }
-    return this->lhs->interp(env)->mult_with(this->rhs->interp(env));
+    return trace.result(this->lhs->interp(env)->mult_with(this->rhs->interp(env)));
+}
+
+void Mult::resolve(frames_t &scope) {
+    lhs->resolve(scope);
+    rhs->resolve(scope);
 }
 
 /**
@@ -321,14 +608,36 @@ PTR(Val) Mult::interp(PTR(Env) env) {
 
 /**
  * \brief Prints the Mult expression in a human-readable form.
- * \param ostream The output stream to print to.
+ * \param out The buffer to print to.
+ */
+void Mult::print_to(string &out) {
+    out += "(";
+    this->lhs->print_to(out);
+    out += " * ";
+    this->rhs->print_to(out);
+    out += ")";
+}
+
+/**
+ * \brief Writes the Mult node to a binary AST.
+ * \param out The writer collecting the nodes.
+ */
+void Mult::emit_ast(AstWriter &out) {
+    out.tag(ast_mult, span);
+    lhs->emit_ast(out);
+    rhs->emit_ast(out);
+}
+
+/**
+ * \brief Infers the type of a Mult; both operands must be numbers.
+ * \param tc The inference in progress.
+ * \return Always int.
  */
-void Mult::print(ostream &ostream) {
-    ostream << "(";
-    this->lhs->print(ostream);
-    ostream << " * ";
-    this->rhs->print(ostream);
-    ostream << ")";
+PTR(Type) Mult::infer(TypeChecker &tc) {
+    tc.unify(tc.num(), lhs->infer(tc), lhs.get());
+    tc.unify(tc.num(), rhs->infer(tc), rhs.get());
+    tc.mark(this, tc.num(), ty_num);
+    return tc.num();
 }
 
 /**
@@ -336,7 +645,7 @@ void Mult::print(ostream &ostream) {
   * \param o The output stream to print to.
  * \param prec The current precedence level.
  */
-void Mult::pretty_print_at(ostream &os, precedence_t node, bool let_parent, streampos &strmpos) {
+void Mult::pretty_print_at(PrettyStream &os, precedence_t node, bool let_parent, streampos &strmpos) {
     bool pass_paren = let_parent;
     if (node >= prec_mult) {
         os << "(";
@@ -350,18 +659,230 @@ void Mult::pretty_print_at(ostream &os, precedence_t node, bool let_parent, stre
     }
 }
 
+/**************SUM CLASS**************/
+/**
+ * \brief Constructor for the Sum class.
+ * \param operands The terms, in source order; there must be at least two.
+ */
+Sum::Sum(vector<PTR(Expr)> operands) {
+    if (operands.size() < 2) {
+        throw runtime_error("A sum needs at least two operands!");
+    }
+    this->operands = std::move(operands);
+}
+
+/**
+ * \brief Checks if this Sum is equal to another expression.
+ * \param e The expression to compare with.
+ * \return True if e is a Sum or a chain of Adds with equal operands in the same order.
+ */
+bool Sum::equals(const PTR(Expr) &e) {
+    return chains_equal<Add, Sum>(THIS, e);
+}
+
+/**
+ * \brief Evaluates the terms left to right and adds them up.
+ * \return The total, or the first error the equivalent chain of Adds would give.
+ */
+PTR(Val) Sum::interp(const PTR(Env) &env_) {
+    ProfileScope scope(prof_sum);
+    EvalStep step;
+    TraceScope trace(prof_sum, span.start);
+    const PTR(Env) &env = env_ != nullptr ? env_ : Env::empty;
+    int total = 0;
+    for (size_t i = 0; i < operands.size(); i++) {
+        PTR(Val) v = operands[i]->interp(env);
+        if (!statically_typed && typeid(*v) != typeid(NumVal)) {
+            return trace.result(finish_chain(operands, i, v, total, env, true));
+        }
+        total += static_cast<NumVal *>(v.get())->val;
+    }
+    return trace.result(NEW(NumVal)(total));
+}
+
+void Sum::resolve(frames_t &scope) {
+    for (size_t i = 0; i < operands.size(); i++) {
+        operands[i]->resolve(scope);
+    }
+}
+
+/**
+ * \brief Prints the Sum the way the equivalent chain of Adds prints.
+ * \param out The buffer to print to.
+ */
+void Sum::print_to(string &out) {
+    for (size_t i = 0; i + 1 < operands.size(); i++) {
+        out += "(";
+        operands[i]->print_to(out);
+        out += " + ";
+    }
+    operands.back()->print_to(out);
+    out.append(operands.size() - 1, ')');
+}
+
+/**
+ * \brief Writes the Sum node to a binary AST.
+ * \param out The writer collecting the nodes.
+ */
+void Sum::emit_ast(AstWriter &out) {
+    out.tag(ast_sum, span);
+    out.num((int) operands.size());
+    for (size_t i = 0; i < operands.size(); i++) {
+        operands[i]->emit_ast(out);
+    }
+}
+
+/**
+ * \brief Infers the type of a Sum; every operand must be a number.
+ * \param tc The inference in progress.
+ * \return Always int.
+ */
+PTR(Type) Sum::infer(TypeChecker &tc) {
+    for (size_t i = 0; i < operands.size(); i++) {
+        tc.unify(tc.num(), operands[i]->infer(tc), operands[i].get());
+    }
+    tc.mark(this, tc.num(), ty_num);
+    return tc.num();
+}
+
+/**
+ * \brief Pretty prints the Sum the way the equivalent chain of Adds pretty prints.
+ * \param os The output stream to print to.
+ * \param node The precedence level of the expression's context.
+ */
+void Sum::pretty_print_at(PrettyStream &os, precedence_t node, bool let_parent, streampos &strmpos) {
+    if (node >= prec_add) {
+        os << "(";
+    }
+    for (size_t i = 0; i + 1 < operands.size(); i++) {
+        operands[i]->pretty_print_at(os, prec_add, true, strmpos);
+        os << " + ";
+    }
+    operands.back()->pretty_print_at(os, prec_none, let_parent, strmpos);
+    if (node >= prec_add) {
+        os << ")";
+    }
+}
+
+/**************PRODUCT CLASS**************/
+/**
+ * \brief Constructor for the Product class.
+ * \param operands The factors, in source order; there must be at least two.
+ */
+Product::Product(vector<PTR(Expr)> operands) {
+    if (operands.size() < 2) {
+        throw runtime_error("A product needs at least two operands!");
+    }
+    this->operands = std::move(operands);
+}
+
+/**
+ * \brief Checks if this Product is equal to another expression.
+ * \param e The expression to compare with.
+ * \return True if e is a Product or a chain of Mults with equal operands in the same order.
+ */
+bool Product::equals(const PTR(Expr) &e) {
+    return chains_equal<Mult, Product>(THIS, e);
+}
+
+/**
+ * \brief Evaluates the factors left to right and multiplies them together.
+ * \return The product, or the first error the equivalent chain of Mults would give.
+ */
+PTR(Val) Product::interp(const PTR(Env) &env_) {
+    ProfileScope scope(prof_product);
+    EvalStep step;
+    TraceScope trace(prof_product, span.start);
+    const PTR(Env) &env = env_ != nullptr ? env_ : Env::empty;
+    int total = 1;
+    for (size_t i = 0; i < operands.size(); i++) {
+        PTR(Val) v = operands[i]->interp(env);
+        if (!statically_typed && typeid(*v) != typeid(NumVal)) {
+            return trace.result(finish_chain(operands, i, v, total, env, false));
+        }
+        total *= static_cast<NumVal *>(v.get())->val;
+    }
+    return trace.result(NEW(NumVal)(total));
+}
+
+void Product::resolve(frames_t &scope) {
+    for (size_t i = 0; i < operands.size(); i++) {
+        operands[i]->resolve(scope);
+    }
+}
+
+/**
+ * \brief Prints the Product the way the equivalent chain of Mults prints.
+ * \param out The buffer to print to.
+ */
+void Product::print_to(string &out) {
+    for (size_t i = 0; i + 1 < operands.size(); i++) {
+        out += "(";
+        operands[i]->print_to(out);
+        out += " * ";
+    }
+    operands.back()->print_to(out);
+    out.append(operands.size() - 1, ')');
+}
+
+/**
+ * \brief Writes the Product node to a binary AST.
+ * \param out The writer collecting the nodes.
+ */
+void Product::emit_ast(AstWriter &out) {
+    out.tag(ast_product, span);
+    out.num((int) operands.size());
+    for (size_t i = 0; i < operands.size(); i++) {
+        operands[i]->emit_ast(out);
+    }
+}
+
+/**
+ * \brief Infers the type of a Product; every operand must be a number.
+ * \param tc The inference in progress.
+ * \return Always int.
+ */
+PTR(Type) Product::infer(TypeChecker &tc) {
+    for (size_t i = 0; i < operands.size(); i++) {
+        tc.unify(tc.num(), operands[i]->infer(tc), operands[i].get());
+    }
+    tc.mark(this, tc.num(), ty_num);
+    return tc.num();
+}
+
+/**
+ * \brief Pretty prints the Product the way the equivalent chain of Mults pretty prints.
+ * \param os The output stream to print to.
+ * \param node The precedence level of the expression's context.
+ */
+void Product::pretty_print_at(PrettyStream &os, precedence_t node, bool let_parent, streampos &strmpos) {
+    bool pass_paren = let_parent;
+    if (node >= prec_mult) {
+        os << "(";
+        pass_paren = false;
+    }
+    for (size_t i = 0; i + 1 < operands.size(); i++) {
+        operands[i]->pretty_print_at(os, prec_mult, true, strmpos);
+        os << " * ";
+    }
+    operands.back()->pretty_print_at(os, prec_add, pass_paren, strmpos);
+    if (node >= prec_mult) {
+        os << ")";
+    }
+}
+
 ///************LET********/
 Let::Let(string lhs, PTR(Expr) rhs, PTR(Expr) bodyExpr){
-    this->lhs = lhs;
-    this->rhs = rhs;
-    this->bodyExpr = bodyExpr;
+    this->lhs = std::move(lhs);
+    this->rhs = std::move(rhs);
+    this->bodyExpr = std::move(bodyExpr);
 }
 
 //bool Let::has_variable() {
 //return rhs->has_variable() || bodyExpr->has_variable();
 //}
 
-bool Let::equals(PTR(Expr) e){
+bool Let::equals(const PTR(Expr) &e){
     PTR(Let) let = CAST(Let)(e);
     if (let == nullptr) {
         return false;
@@ -370,18 +891,33 @@ bool Let::equals(PTR(Expr) e){
     }
 }
 
-PTR(Val) Let::interp(PTR(Env) env) {
-    if (env == nullptr){
-        env = Env::empty;
+PTR(Val) Let::interp(const PTR(Env) &env_) {
+    ProfileScope scope(prof_let);
+    EvalStep step;
+    TraceScope trace(prof_let, span.start);
+    StackFrame frame(this, "_let", lhs, span.start);
+    const PTR(Env) &env = env_ != nullptr ? env_ : Env::empty;
+    if (!resolved) {
+        frames_t scope;
+        resolve(scope);
     }
-    PTR(Val) rhsVal = rhs->interp(env); //Step 1: Evaluate rhs in the current environment.
-    PTR(Env) newEnv = NEW(ExtendedEnv)(lhs, rhsVal, env); //Step 2: Extend the environment.
-    return bodyExpr->interp(newEnv); //Step 3: Interpret bodyExpr with the new environment.
+    //Step 1: Evaluate rhs in the current environment, or with --lazy, when the body first uses it.
+    PTR(Val) rhsVal = lazy_let ? PTR(Val)(NEW(ThunkVal)(rhs, env)) : rhs->interp(env);
+    PTR(Env) newEnv = NEW(ExtendedEnv)(lhs, std::move(rhsVal), env); //Step 2: Extend the environment.
+    return trace.result(bodyExpr->interp(newEnv)); //Step 3: Interpret bodyExpr with the new environment.
 //}
 //    PTR(Val) rhsValue = rhs->interp(env);
 //    return bodyExpr->subst(lhs, rhsValue->to_expr())->interp(env);
 }
 
+void Let::resolve(frames_t &scope) {
+    resolved = true;
+    rhs->resolve(scope);
+    scope.push_back(vector<string>(1, lhs));
+    bodyExpr->resolve(scope);
+    scope.pop_back();
+}
+
 //PTR(Expr) Let::subst(string varName, PTR(Expr) replacement) {
 //    //If the variable to be substituted is the same as the current binding, avoid shadowing
 //    if (lhs == varName) {
@@ -392,19 +928,45 @@ PTR(Val) Let::interp(PTR(Env) env) {
 //    }
 //}
 
-void Let::print(ostream &os) {
-    os << "(_let " << lhs << " = ";
-    rhs->print(os);
-    os << " _in ";
-    bodyExpr->print(os);
-    os << ")";
+void Let::print_to(string &out) {
+    out += "(_let ";
+    out += lhs;
+    out += " = ";
+    rhs->print_to(out);
+    out += " _in ";
+    bodyExpr->print_to(out);
+    out += ")";
 }
 
-void Let::pretty_print_at(ostream &os, precedence_t node, bool let_parent, streampos &strmpos){
+void Let::emit_ast(AstWriter &out) {
+    out.tag(ast_let, span);
+    out.name(lhs);
+    rhs->emit_ast(out);
+    bodyExpr->emit_ast(out);
+}
+
+/**
+ * \brief Infers the type of a Let, generalizing the type of rhs in the body.
+ * \param tc The inference in progress.
+ * \return The type of the body.
+ */
+PTR(Type) Let::infer(TypeChecker &tc) {
+    tc.enter_let();
+    PTR(Type) rhsType = rhs->infer(tc);
+    tc.leave_let(rhsType);
+    tc.bind(lhs, rhsType);
+    PTR(Type) bodyType = bodyExpr->infer(tc);
+    tc.unbind();
+    return bodyType;
+}
+
+//Pretty prints "<keyword> lhs = rhs" and the body under it, for _let and _letrec
+static void pretty_print_binding(PrettyStream &os, const char *keyword, const string &lhs, PTR(Expr) rhs,
+                                 PTR(Expr) bodyExpr, bool let_parent, streampos &strmpos){
     //Calculate the indentation based on stream positions
 
     //Move these two lines underneath the if statement
-    streampos currentPos = os.tellp();
+    streampos currentPos = os.position();
     streampos indentSize = currentPos - strmpos;
     if (let_parent) {
         os << "(";
@@ -412,14 +974,14 @@ void Let::pretty_print_at(ostream &os, precedence_t node, bool let_parent, strea
 
     //Print the "let" part
     //All streampos should go where IndentSize is
-    os << "_let " << lhs << " = ";
+    os << keyword << " " << lhs << " = ";
     rhs->pretty_print_at(os, prec_none, false, indentSize);
 
     os << "\n ";
 
     string indentation(indentSize, ' ');
 
-    strmpos = os.tellp();
+    strmpos = os.position();
     //Move to the next line and apply indentation for the "in" part
     os << indentation << " _in  ";
 
@@ -431,12 +993,102 @@ void Let::pretty_print_at(ostream &os, precedence_t node, bool let_parent, strea
     }
 }
 
+void Let::pretty_print_at(PrettyStream &os, precedence_t node, bool let_parent, streampos &strmpos){
+    pretty_print_binding(os, "_let", lhs, rhs, bodyExpr, let_parent, strmpos);
+}
+
+//LetRec
+LetRec::LetRec(string lhs, PTR(Expr) rhs, PTR(Expr) bodyExpr){
+    this->lhs = std::move(lhs);
+    this->rhs = std::move(rhs);
+    this->bodyExpr = std::move(bodyExpr);
+}
+
+bool LetRec::equals(const PTR(Expr) &e){
+    PTR(LetRec) let = CAST(LetRec)(e);
+    if (let == nullptr) {
+        return false;
+    }
+    return this->lhs == let->lhs && this->rhs->equals(let->rhs) && this->bodyExpr->equals(let->bodyExpr);
+}
+
+/**
+ * \brief Binds lhs to the value of rhs, with rhs able to refer to lhs.
+ * \return The value of the body.
+ * The binding is made first with no value, rhs is evaluated in the environment
+ * that has it, and then the value is filled in. A _fun on the right-hand side
+ * therefore captures an environment that contains itself; the cycle collector
+ * frees it once nothing else refers to it. Using lhs while rhs is still being
+ * evaluated, outside a _fun, is an error.
+ */
+PTR(Val) LetRec::interp(const PTR(Env) &env_) {
+    ProfileScope scope(prof_letrec);
+    EvalStep step;
+    TraceScope trace(prof_letrec, span.start);
+    StackFrame frame(this, "_letrec", lhs, span.start);
+    const PTR(Env) &env = env_ != nullptr ? env_ : Env::empty;
+    if (!resolved) {
+        frames_t scope;
+        resolve(scope);
+    }
+    PTR(ExtendedEnv) newEnv = NEW(ExtendedEnv)(lhs, nullptr, env);
+    newEnv->set_value(rhs->interp(newEnv));
+    return trace.result(bodyExpr->interp(newEnv));
+}
+
+void LetRec::resolve(frames_t &scope) {
+    resolved = true;
+    scope.push_back(vector<string>(1, lhs));
+    rhs->resolve(scope);
+    bodyExpr->resolve(scope);
+    scope.pop_back();
+}
+
+void LetRec::print_to(string &out) {
+    out += "(_letrec ";
+    out += lhs;
+    out += " = ";
+    rhs->print_to(out);
+    out += " _in ";
+    bodyExpr->print_to(out);
+    out += ")";
+}
+
+void LetRec::emit_ast(AstWriter &out) {
+    out.tag(ast_letrec, span);
+    out.name(lhs);
+    rhs->emit_ast(out);
+    bodyExpr->emit_ast(out);
+}
+
+/**
+ * \brief Infers the type of a LetRec; lhs has one type inside rhs and is generalized in the body.
+ * \param tc The inference in progress.
+ * \return The type of the body.
+ */
+PTR(Type) LetRec::infer(TypeChecker &tc) {
+    tc.enter_let();
+    PTR(Type) lhsType = tc.fresh();
+    tc.bind(lhs, lhsType);
+    tc.unify(lhsType, rhs->infer(tc), rhs.get());
+    tc.unbind();
+    tc.leave_let(lhsType);
+    tc.bind(lhs, lhsType);
+    PTR(Type) bodyType = bodyExpr->infer(tc);
+    tc.unbind();
+    return bodyType;
+}
+
+void LetRec::pretty_print_at(PrettyStream &os, precedence_t node, bool let_parent, streampos &strmpos){
+    pretty_print_binding(os, "_letrec", lhs, rhs, bodyExpr, let_parent, strmpos);
+}
+
 //BoolExpr
 BoolExpr::BoolExpr(bool b) {
     this-> val = b;
 }
 
-bool BoolExpr::equals(PTR(Expr) e){
+bool BoolExpr::equals(const PTR(Expr) &e){
     PTR(BoolExpr) boolPointer = CAST(BoolExpr)(e);
     if (boolPointer == nullptr){
         return false;
@@ -444,11 +1096,14 @@ bool BoolExpr::equals(PTR(Expr) e){
     return this-> val == boolPointer->val;
 }
 
-PTR(Val) BoolExpr::interp(PTR(Env) env) {
-    if (env == nullptr){
-        env = Env::empty;
-    }
-    return NEW(BoolVal)(val);
+PTR(Val) BoolExpr::interp(const PTR(Env) &) {
+    ProfileScope scope(prof_bool);
+    EvalStep step;
+    TraceScope trace(prof_bool, span.start);
+    return trace.result(NEW(BoolVal)(val));
+}
+
+void BoolExpr::resolve(frames_t &) {
 }
 
 //bool BoolExpr::has_variable() {
@@ -459,16 +1114,24 @@ PTR(Val) BoolExpr::interp(PTR(Env) env) {
 //    return THIS;
 //}
 
-void BoolExpr::print(ostream &ostream){
+void BoolExpr::print_to(string &out){
     if(val){
-        ostream << "_true";
+        out += "_true";
     }
     else if (!val){
-        ostream << "_false";
+        out += "_false";
     }
 }
 
-void BoolExpr::pretty_print_at(ostream &ostream, precedence_t prec, bool let_parent, streampos &strmpos){
+void BoolExpr::emit_ast(AstWriter &out) {
+    out.tag(val ? ast_true : ast_false, span);
+}
+
+PTR(Type) BoolExpr::infer(TypeChecker &tc) {
+    return tc.boolean();
+}
+
+void BoolExpr::pretty_print_at(PrettyStream &ostream, precedence_t prec, bool let_parent, streampos &strmpos){
     if(val){
         ostream << "_true";
     }
@@ -479,12 +1142,12 @@ void BoolExpr::pretty_print_at(ostream &ostream, precedence_t prec, bool let_par
 
 //IfExpr
 IfExpr::IfExpr(PTR(Expr) if_, PTR(Expr) then_, PTR(Expr) else_){
-    this->if_ = if_;
-    this->then_ = then_;
-    this->else_ = else_;
+    this->if_ = std::move(if_);
+    this->then_ = std::move(then_);
+    this->else_ = std::move(else_);
 }
 
-bool IfExpr::equals (PTR(Expr) e) {
+bool IfExpr::equals(const PTR(Expr) &e) {
     PTR(IfExpr) ifPtr = CAST(IfExpr)(e);
 
     if (ifPtr == nullptr) {
@@ -497,19 +1160,36 @@ bool IfExpr::equals (PTR(Expr) e) {
            this->else_->equals(ifPtr->else_);
 }
 
-PTR(Val) IfExpr::interp(PTR(Env) env){
-    if (env == nullptr){
-        env = Env::empty;
-    }
+PTR(Val) IfExpr::interp(const PTR(Env) &env_){
+    ProfileScope scope(prof_if);
+    EvalStep step;
+    TraceScope trace(prof_if, span.start);
+    const PTR(Env) &env = env_ != nullptr ? env_ : Env::empty;
     PTR(Val) conditionValue = if_->interp(env);
+    if (statically_typed) {
+        return trace.result((static_cast<BoolVal *>(conditionValue.get())->val ? then_ : else_)->interp(env));
+    }
+    if (spec != spec_generic) {
+        if (typeid(*conditionValue) == typeid(BoolVal)) {
+            spec = spec_bool;
+            return trace.result((static_cast<BoolVal *>(conditionValue.get())->val ? then_ : else_)->interp(env));
+        }
+        spec = spec_generic;
+    }
     PTR(BoolVal) boolCondition = CAST(BoolVal)(conditionValue);
     if (boolCondition != nullptr && boolCondition->is_true()) {
-        return then_->interp(env);
+        return trace.result(then_->interp(env));
     } else {
-        return else_->interp(env);
+        return trace.result(else_->interp(env));
     }
 }
 
+void IfExpr::resolve(frames_t &scope) {
+    if_->resolve(scope);
+    then_->resolve(scope);
+    else_->resolve(scope);
+}
+
 //bool IfExpr::has_variable(){
 //    return this->if_->has_variable()||this->then_->has_variable()||else_->has_variable();
 //}
@@ -519,18 +1199,38 @@ PTR(Val) IfExpr::interp(PTR(Env) env){
 //    return NEW(IfExpr)(this->if_->subst(str, e),this->then_->subst(str, e), this->else_->subst(str, e));
 //}
 
-void IfExpr::print(ostream &ostream){
-    ostream << "_if ";
-    this->if_->print(ostream);
-    ostream << "_then ";
-    this->then_->print(ostream);
-    ostream << "_else ";
-    this->else_->print(ostream);
+void IfExpr::print_to(string &out){
+    out += "_if ";
+    this->if_->print_to(out);
+    out += "_then ";
+    this->then_->print_to(out);
+    out += "_else ";
+    this->else_->print_to(out);
+}
+
+void IfExpr::emit_ast(AstWriter &out) {
+    out.tag(ast_if, span);
+    if_->emit_ast(out);
+    then_->emit_ast(out);
+    else_->emit_ast(out);
+}
+
+/**
+ * \brief Infers the type of an IfExpr: a boolean condition and two branches of one type.
+ * \param tc The inference in progress.
+ * \return The type of the branches.
+ */
+PTR(Type) IfExpr::infer(TypeChecker &tc) {
+    tc.unify(tc.boolean(), if_->infer(tc), if_.get());
+    PTR(Type) type = then_->infer(tc);
+    tc.unify(type, else_->infer(tc), else_.get());
+    tc.mark(this, tc.boolean(), ty_bool);
+    return type;
 }
 
-void IfExpr::pretty_print_at(ostream &ostream, precedence_t prec, bool let_parent, streampos &strmpos) {
+void IfExpr::pretty_print_at(PrettyStream &ostream, precedence_t prec, bool let_parent, streampos &strmpos) {
 
-    streampos startPosition = ostream.tellp();
+    streampos startPosition = ostream.position();
 
     ostream << "_if ";
 
@@ -538,7 +1238,7 @@ void IfExpr::pretty_print_at(ostream &ostream, precedence_t prec, bool let_paren
 
     ostream << "\n";
 
-    strmpos = ostream.tellp();
+    strmpos = ostream.position();
 
     ostream << "_then ";
 
@@ -548,7 +1248,7 @@ void IfExpr::pretty_print_at(ostream &ostream, precedence_t prec, bool let_paren
 
     ostream << "_else ";
 
-    strmpos = ostream.tellp();
+    strmpos = ostream.position();
 
     else_->pretty_print_at(ostream, prec_none, false, strmpos);
 
@@ -559,11 +1259,11 @@ void IfExpr::pretty_print_at(ostream &ostream, precedence_t prec, bool let_paren
 //EqExpr
 
 EqExpr::EqExpr(PTR(Expr) lhs, PTR(Expr) rhs){
-    this->lhs = lhs;
-    this->rhs = rhs;
+    this->lhs = std::move(lhs);
+    this->rhs = std::move(rhs);
 }
 
-bool EqExpr::equals (PTR(Expr) e){
+bool EqExpr::equals(const PTR(Expr) &e){
     PTR(EqExpr) eqPtr = CAST(EqExpr)(e);
 
     if (eqPtr == nullptr) {
@@ -572,11 +1272,32 @@ bool EqExpr::equals (PTR(Expr) e){
     return this->rhs->equals(eqPtr->rhs) && this->lhs->equals(eqPtr->lhs);
 }
 
-PTR(Val) EqExpr::interp(PTR(Env) env){
-    if (env == nullptr){
-        env = Env::empty;
+PTR(Val) EqExpr::interp(const PTR(Env) &env_){
+    ProfileScope scope(prof_eq);
+    EvalStep step;
+    TraceScope trace(prof_eq, span.start);
+    const PTR(Env) &env = env_ != nullptr ? env_ : Env::empty;
+    if (statically_typed) {
+        PTR(Val) r = rhs->interp(env);
+        PTR(Val) l = lhs->interp(env);
+        return trace.result(NEW(BoolVal)(static_cast<NumVal *>(r.get())->val == static_cast<NumVal *>(l.get())->val));
+    }
+    if (spec != spec_generic) {
+        PTR(Val) r = rhs->interp(env);
+        PTR(Val) l = lhs->interp(env);
+        if (typeid(*r) == typeid(NumVal) && typeid(*l) == typeid(NumVal)) {
+            spec = spec_num;
+            return trace.result(NEW(BoolVal)(static_cast<NumVal *>(r.get())->val == static_cast<NumVal *>(l.get())->val));
+        }
+        spec = spec_generic;
+        return trace.result(NEW(BoolVal)(r->equals(l)));
     }
-    return NEW(BoolVal)(rhs->interp(env)->equals(lhs->interp(env)));
+    return trace.result(NEW(BoolVal)(rhs->interp(env)->equals(lhs->interp(env))));
+}
+
+void EqExpr::resolve(frames_t &scope) {
+    lhs->resolve(scope);
+    rhs->resolve(scope);
 }
 
 //bool EqExpr::has_variable(){
@@ -587,14 +1308,33 @@ PTR(Val) EqExpr::interp(PTR(Env) env){
 //    return NEW(EqExpr)(this->rhs->subst(str, e), this->lhs->subst(str, e));
 //}
 
-void EqExpr::print(ostream &ostream){
-    this->lhs->print(ostream);
-    ostream << "==";
-    this->rhs->print(ostream);
+void EqExpr::print_to(string &out){
+    this->lhs->print_to(out);
+    out += "==";
+    this->rhs->print_to(out);
+}
+
+void EqExpr::emit_ast(AstWriter &out) {
+    out.tag(ast_eq, span);
+    lhs->emit_ast(out);
+    rhs->emit_ast(out);
+}
+
+/**
+ * \brief Infers the type of an EqExpr; both sides must have the same type.
+ * \param tc The inference in progress.
+ * \return Always bool.
+ */
+PTR(Type) EqExpr::infer(TypeChecker &tc) {
+    PTR(Type) type = lhs->infer(tc);
+    tc.unify(type, rhs->infer(tc), rhs.get());
+    //Comparing numbers is the common case; anything else keeps the virtual equals()
+    tc.mark(this, type, ty_num);
+    return tc.boolean();
 }
 
-void EqExpr::pretty_print_at(ostream &ostream, precedence_t prec, bool let_parent, streampos &strmpos){
-    streampos startPosition = ostream.tellp();
+void EqExpr::pretty_print_at(PrettyStream &ostream, precedence_t prec, bool let_parent, streampos &strmpos){
+    streampos startPosition = ostream.position();
 
     lhs->pretty_print_at(ostream, prec_none, false, strmpos);
     ostream << "==";
@@ -603,23 +1343,43 @@ void EqExpr::pretty_print_at(ostream &ostream, precedence_t prec, bool let_paren
 
 //FUNEXPR SECTION
 FunExpr::FunExpr(string formalarg, PTR(Expr) body){
-    this->formalarg = formalarg;
-    this->body = body;
+    this->formalargs_ = std::make_shared<const vector<string> >(1, std::move(formalarg));
+    this->body = std::move(body);
 }
 
-bool FunExpr::equals(PTR(Expr) e) {
+FunExpr::FunExpr(vector<string> formalargs, PTR(Expr) body){
+    this->formalargs_ = std::make_shared<const vector<string> >(std::move(formalargs));
+    this->body = std::move(body);
+}
+
+bool FunExpr::equals(const PTR(Expr) &e) {
     PTR(FunExpr) funPtr = CAST(FunExpr)(e);
     if (funPtr == nullptr){
         return false;
     }
-    return this->formalarg == funPtr->formalarg && this->body->equals(funPtr->body);
+    return formalargs() == funPtr->formalargs() && this->body->equals(funPtr->body);
 }
 
-PTR(Val) FunExpr::interp(PTR(Env) env) {
-    if (env == nullptr){
-        env = Env::empty;
+PTR(Val) FunExpr::interp(const PTR(Env) &env_) {
+    ProfileScope scope(prof_fun);
+    EvalStep step;
+    TraceScope trace(prof_fun, span.start);
+    const PTR(Env) &env = env_ != nullptr ? env_ : Env::empty;
+    if (!resolved) {
+        frames_t scope;
+        resolve(scope);
     }
-    return NEW(FunVal)(formalarg, body);
+    PTR(FunVal) fun = NEW(FunVal)(formalargs_, body, env);
+    fun->span = span;
+    return trace.result(fun);
+}
+
+//A call binds all the arguments in one frame, ExtendedEnv or FrameEnv
+void FunExpr::resolve(frames_t &scope) {
+    resolved = true;
+    scope.push_back(formalargs());
+    body->resolve(scope);
+    scope.pop_back();
 }
 
 //PTR(Expr) FunExpr::subst(string str, PTR(Expr) e){
@@ -631,34 +1391,153 @@ PTR(Val) FunExpr::interp(PTR(Env) env) {
 //    }
 //}
 
-void FunExpr::print(ostream& o){
-    o << "(_fun (" << this->formalarg << ") " << this->body->to_string() << ")";
+void FunExpr::print_to(string &out){
+    out += "(_fun (";
+    for (size_t i = 0; i < formalargs().size(); i++) {
+        if (i > 0) {
+            out += ", ";
+        }
+        out += formalargs()[i];
+    }
+    out += ") ";
+    this->body->print_to(out);
+    out += ")";
+}
+
+void FunExpr::emit_ast(AstWriter &out) {
+    out.tag(ast_fun, span);
+    out.num((int) formalargs().size());
+    for (size_t i = 0; i < formalargs().size(); i++) {
+        out.name(formalargs()[i]);
+    }
+    body->emit_ast(out);
+}
+
+/**
+ * \brief Infers the type of a FunExpr from how its body uses the arguments.
+ * \param tc The inference in progress.
+ * \return A function type.
+ */
+PTR(Type) FunExpr::infer(TypeChecker &tc) {
+    vector<PTR(Type)> argTypes;
+    for (size_t i = 0; i < formalargs().size(); i++) {
+        argTypes.push_back(tc.fresh());
+        tc.bind(formalargs()[i], argTypes.back());
+    }
+    PTR(Type) bodyType = body->infer(tc);
+    for (size_t i = 0; i < formalargs().size(); i++) {
+        tc.unbind();
+    }
+    return tc.fun(argTypes, bodyType);
 }
 
 //CALLEXPR SECTION
 CallExpr::CallExpr(PTR(Expr) toBeCalled, PTR(Expr) actualArg){
-    this->toBeCalled = toBeCalled;
-    this->actualArg = actualArg;
+    this->toBeCalled = std::move(toBeCalled);
+    this->actualArgs.push_back(std::move(actualArg));
 };
 
-bool CallExpr::equals(PTR(Expr) e){
+CallExpr::CallExpr(PTR(Expr) toBeCalled, vector<PTR(Expr)> actualArgs){
+    this->toBeCalled = std::move(toBeCalled);
+    this->actualArgs = std::move(actualArgs);
+};
+
+bool CallExpr::equals(const PTR(Expr) &e){
     PTR(CallExpr) callPtr = CAST(CallExpr)(e);
-    if (callPtr == nullptr){
+    if (callPtr == nullptr || this->actualArgs.size() != callPtr->actualArgs.size()){
         return false;
     }
-    return this->toBeCalled->equals(callPtr->toBeCalled) && this->actualArg->equals(callPtr->actualArg);
+    for (size_t i = 0; i < actualArgs.size(); i++) {
+        if (!this->actualArgs[i]->equals(callPtr->actualArgs[i])) {
+            return false;
+        }
+    }
+    return this->toBeCalled->equals(callPtr->toBeCalled);
 }
-PTR(Val) CallExpr::interp(PTR(Env) env){
-    if (env == nullptr){
-        env = Env::empty;
+
+/**
+ * \brief Calls the function with all of its arguments at once.
+ * \return The value of the call.
+ * A single argument goes through call(), anything more through call_with(),
+ * which binds them all in one FrameEnv.
+ */
+PTR(Val) CallExpr::interp(const PTR(Env) &env_){
+    ProfileScope scope(prof_call);
+    EvalStep step;
+    TraceScope trace(prof_call, span.start);
+    const PTR(Env) &env = env_ != nullptr ? env_ : Env::empty;
+    PTR(Val) callee = this->toBeCalled->interp(env);
+    if (actualArgs.size() == 1) {
+        PTR(Val) arg = actualArgs[0]->interp(env);
+        if (spec != spec_generic) {
+            if (typeid(*callee) == typeid(FunVal)) {
+                spec = spec_fun;
+                //Calls FunVal::call directly instead of through the vtable
+                return trace.result(static_cast<FunVal *>(callee.get())->FunVal::call(arg));
+            }
+            spec = spec_generic;
+        }
+        return trace.result(callee->call(arg));
+    }
+    vector<PTR(Val)> args;
+    args.reserve(actualArgs.size());
+    for (size_t i = 0; i < actualArgs.size(); i++) {
+        args.push_back(actualArgs[i]->interp(env));
+    }
+    if (spec != spec_generic) {
+        if (typeid(*callee) == typeid(FunVal)) {
+            spec = spec_fun;
+            return trace.result(static_cast<FunVal *>(callee.get())->FunVal::call_with(std::move(args)));
+        }
+        spec = spec_generic;
+    }
+    return trace.result(callee->call_with(std::move(args)));
+}
+
+void CallExpr::resolve(frames_t &scope) {
+    toBeCalled->resolve(scope);
+    for (size_t i = 0; i < actualArgs.size(); i++) {
+        actualArgs[i]->resolve(scope);
     }
-    return this->toBeCalled->interp(env)->call(actualArg->interp(env));
 }
 //PTR(Expr) CallExpr::subst(string str,  PTR(Expr) e){
 //    return NEW(CallExpr)(this->toBeCalled->subst(str, e), this->actualArg->subst(str, e));
 //}
-void CallExpr::print(ostream &ostream){
-    ostream << "(" << this->toBeCalled->to_string() << ") (" << this->actualArg->to_string() << ")";
+void CallExpr::print_to(string &out){
+    out += "(";
+    this->toBeCalled->print_to(out);
+    out += ") (";
+    for (size_t i = 0; i < actualArgs.size(); i++) {
+        if (i > 0) {
+            out += ", ";
+        }
+        this->actualArgs[i]->print_to(out);
+    }
+    out += ")";
+}
+
+void CallExpr::emit_ast(AstWriter &out) {
+    out.tag(ast_call, span);
+    out.num((int) actualArgs.size());
+    toBeCalled->emit_ast(out);
+    for (size_t i = 0; i < actualArgs.size(); i++) {
+        actualArgs[i]->emit_ast(out);
+    }
 }
 
+/**
+ * \brief Infers the type of a CallExpr; the callee must be a function taking exactly these arguments.
+ * \param tc The inference in progress.
+ * \return The function's result type.
+ */
+PTR(Type) CallExpr::infer(TypeChecker &tc) {
+    PTR(Type) funType = toBeCalled->infer(tc);
+    vector<PTR(Type)> argTypes;
+    for (size_t i = 0; i < actualArgs.size(); i++) {
+        argTypes.push_back(actualArgs[i]->infer(tc));
+    }
+    PTR(Type) result = tc.fresh();
+    tc.unify(funType, tc.fun(argTypes, result), this);
+    return result;
+}
 
@@ -12,13 +12,18 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string>
+#include <vector>
 #include <stdexcept>
 #include <sstream>
 #include "pointer.h"
 #include "Env.h"
+#include "stats.h"
 
 using namespace std;
 class Val;
+class AstWriter;
+class TypeChecker;
+class Type;
 
 typedef enum {
     prec_none,      // = 0
@@ -26,154 +31,318 @@ typedef enum {
     prec_mult       // = 2
 } precedence_t;
 
+/**
+ * \brief Where a node came from in the program text.
+ * Offsets are in bytes from the start of the source; end is one past the last
+ * character. Both are -1 for nodes that were not built by the parser.
+ */
+typedef struct {
+    int start;
+    int end;
+} source_span_t;
+
+/**
+ * \brief What a node's interp() has seen so far, so it can specialize itself.
+ * A node starts uninitialized, specializes on the first operands it sees and
+ * then only checks that they still fit, which is much cheaper than the generic
+ * path. The first time they don't, it goes generic for good.
+ *
+ * The state, like the depths resolve() fills in, is written by interp(), so a
+ * tree must not be interpreted on two threads at once; give each its own parse.
+ */
+typedef enum {
+    spec_uninitialized,
+    spec_num,           //Add, Mult, EqExpr: both operands were NumVals
+    spec_bool,          //IfExpr: the condition was a BoolVal
+    spec_fun,           //CallExpr: the callee was a FunVal
+    spec_depth,         //Var: bound inside the tree, a fixed number of frames out
+    spec_generic
+} spec_state_t;
+
+//The names bound by each enclosing frame, innermost last
+typedef vector<vector<string> > frames_t;
+
+/**
+ * \brief Appends the decimal digits of n to out without a temporary string.
+ * \param out The buffer to append to.
+ * \param n The number to format.
+ */
+void append_int(string &out, int n);
+
+/**
+ * \brief Output stream used by pretty_print_at().
+ *
+ * Forwards every character straight to another stream's buffer and counts how
+ * many have been written, so indentation is computed from position() instead of
+ * tellp(). This works on stdout, pipes and sockets, and nothing is buffered here.
+ */
+class PrettyStream : public ostream {
+public:
+    explicit PrettyStream(ostream &out);
+    std::streampos position();
+
+private:
+    class CountingBuf : public streambuf {
+    public:
+        explicit CountingBuf(streambuf *target);
+        streamsize count;
+    protected:
+        int_type overflow(int_type c);
+        streamsize xsputn(const char *s, streamsize n);
+        int sync();
+    private:
+        streambuf *target;
+    };
+    CountingBuf buf;
+};
+
 CLASS(Expr) {
 public:
-    virtual bool equals(PTR(Expr) e) = 0;
-    virtual PTR(Val) interp(PTR(Env) env = nullptr) = 0;
+    source_span_t span = { -1, -1 };
+    //Set by mark_typed() when the operand types interp() checks are known statically
+    bool statically_typed = false;
+    spec_state_t spec = spec_uninitialized;
+    //Set once resolve() has reached this node; a binder resolves its subtree on its first interp()
+    bool resolved = false;
+
+    virtual bool equals(const PTR(Expr) &e) = 0;
+    //env is passed down by reference, so it must outlive the call; nullptr means Env::empty
+    virtual PTR(Val) interp(const PTR(Env) &env = nullptr) = 0;
 //    virtual bool has_variable()= 0;
 //    virtual PTR(Expr) subst(string varName, PTR(Expr) replacement)  = 0;
-    virtual void print (ostream& os) = 0;
+    virtual void print_to(string &out) = 0;
+    virtual void emit_ast(AstWriter &out) = 0;
+    virtual PTR(Type) infer(TypeChecker &tc) = 0;
+    //Gives every Var bound within scope, or by a binder below this node, its depth
+    virtual void resolve(frames_t &scope) = 0;
+    void print(ostream &os);
     string to_string();
     void pretty_print(ostream &ostream);
-    virtual void pretty_print_at(ostream &os, precedence_t node, bool let_parent, streampos &strmpos);
+    virtual void pretty_print_at(PrettyStream &os, precedence_t node, bool let_parent, streampos &strmpos);
     string to_pretty_string();
 };
 
-class Num : public Expr{
+class Num : public Expr, private Counted<stats_num, Num> {
 public:
     int val;
     explicit Num(int val);
-    bool equals(PTR(Expr) e);
+    bool equals(const PTR(Expr) &e);
     //Return the value
-    virtual PTR(Val) interp(PTR(Env) env);
+    virtual PTR(Val) interp(const PTR(Env) &env);
     //Num will never have a variable.
 //    bool has_variable();
 //    PTR(Expr) subst(string varName, PTR(Expr) replacement);
-    virtual void print(ostream& os);
+    virtual void print_to(string &out);
+    virtual void emit_ast(AstWriter &out);
+    virtual PTR(Type) infer(TypeChecker &tc);
+    virtual void resolve(frames_t &scope);
 //    string to_string();
 };
 
-class Var : public Expr{
+class Var : public Expr, private Counted<stats_var, Var> {
 public:
     string name;
+    int depth = 0;  //frames to skip when spec is spec_depth, as set by resolve()
     Var(string name);
-    virtual bool equals(PTR(Expr) e);
-    virtual PTR(Val) interp(PTR(Env) env = nullptr);
+    virtual bool equals(const PTR(Expr) &e);
+    virtual PTR(Val) interp(const PTR(Env) &env = nullptr);
     //Will have a variable.
 //    virtual bool has_variable();
 //    virtual PTR(Expr) subst(string varName, PTR(Expr) replacement);
-    virtual void print (ostream& os);
+    virtual void print_to(string &out);
+    virtual void emit_ast(AstWriter &out);
+    virtual PTR(Type) infer(TypeChecker &tc);
+    virtual void resolve(frames_t &scope);
 };
 
-class Add :  public Expr{
+class Add : public Expr, private Counted<stats_add, Add> {
 public:
     PTR(Expr) lhs;
     PTR(Expr) rhs;
 
     Add(PTR(Expr) lhs, PTR(Expr) rhs);
-    bool equals(PTR(Expr) e);
+    bool equals(const PTR(Expr) &e);
     //Sum of the subexpression values
-    PTR(Val) interp(PTR(Env) env = nullptr);
+    PTR(Val) interp(const PTR(Env) &env = nullptr);
     //Check if either have a variable
 //    bool has_variable();
 //    PTR(Expr) subst( string varName, PTR(Expr) replacement);
-    virtual void print (ostream &os);
-    void pretty_print_at(ostream &os, precedence_t node, bool let_parent, streampos &strmpos);
+    virtual void print_to(string &out);
+    virtual void emit_ast(AstWriter &out);
+    virtual PTR(Type) infer(TypeChecker &tc);
+    virtual void resolve(frames_t &scope);
+    void pretty_print_at(PrettyStream &os, precedence_t node, bool let_parent, streampos &strmpos);
 };
 
-class Mult : public Expr{
+class Mult : public Expr, private Counted<stats_mult, Mult> {
 public:
     PTR(Expr) lhs;
     PTR(Expr) rhs;
     Mult(PTR(Expr) lhs, PTR(Expr) rhs);
-    bool equals(PTR(Expr) e);
+    bool equals(const PTR(Expr) &e);
     //The product of the subexpression values
-    PTR(Val) interp(PTR(Env) env = nullptr);
+    PTR(Val) interp(const PTR(Env) &env = nullptr);
     //Check if either have a variable
 //    bool has_variable();
 //    PTR(Expr) subst(string varName, PTR(Expr) replacement);
-    virtual void print (ostream &os);
-    void pretty_print_at(ostream &os, precedence_t node, bool let_parent, streampos &strmpos);
+    virtual void print_to(string &out);
+    virtual void emit_ast(AstWriter &out);
+    virtual PTR(Type) infer(TypeChecker &tc);
+    virtual void resolve(frames_t &scope);
+    void pretty_print_at(PrettyStream &os, precedence_t node, bool let_parent, streampos &strmpos);
 };
 
-class Let : public Expr {
+/**
+ * \brief A chain of three or more additions, a + b + ... + z, held as one node.
+ * It means, prints and compares equal the same as the right-leaning chain of
+ * Adds it replaces, but interp() sums the operands in a loop with one
+ * accumulator, so a long sum needs no deep recursion and no NumVal per partial
+ * sum.
+ */
+class Sum : public Expr, private Counted<stats_sum, Sum> {
+public:
+    vector<PTR(Expr)> operands;
+    explicit Sum(vector<PTR(Expr)> operands);
+    bool equals(const PTR(Expr) &e);
+    PTR(Val) interp(const PTR(Env) &env = nullptr);
+    virtual void print_to(string &out);
+    virtual void emit_ast(AstWriter &out);
+    virtual PTR(Type) infer(TypeChecker &tc);
+    virtual void resolve(frames_t &scope);
+    void pretty_print_at(PrettyStream &os, precedence_t node, bool let_parent, streampos &strmpos);
+};
+
+/**
+ * \brief A chain of three or more multiplications, held as one node like Sum.
+ */
+class Product : public Expr, private Counted<stats_product, Product> {
+public:
+    vector<PTR(Expr)> operands;
+    explicit Product(vector<PTR(Expr)> operands);
+    bool equals(const PTR(Expr) &e);
+    PTR(Val) interp(const PTR(Env) &env = nullptr);
+    virtual void print_to(string &out);
+    virtual void emit_ast(AstWriter &out);
+    virtual PTR(Type) infer(TypeChecker &tc);
+    virtual void resolve(frames_t &scope);
+    void pretty_print_at(PrettyStream &os, precedence_t node, bool let_parent, streampos &strmpos);
+};
+
+class Let : public Expr, private Counted<stats_let, Let> {
 public:
     string lhs; //String
     PTR(Expr) rhs; //Bound expression
     PTR(Expr) bodyExpr;
     Let(string lhs, PTR(Expr) rhs, PTR(Expr) bodyExpr);
-    virtual bool equals(PTR(Expr) e);
+    virtual bool equals(const PTR(Expr) &e);
     //The product of the subexpression values
-    virtual PTR(Val) interp(PTR(Env) env = nullptr);
+    virtual PTR(Val) interp(const PTR(Env) &env = nullptr);
     //Check if either have a variable
 //    virtual bool has_variable();
 //    virtual PTR(Expr) subst(string varName, PTR(Expr) replacement);
-    virtual void print (ostream& os);
-    void pretty_print_at(ostream &os, precedence_t node, bool let_parent, streampos &strmpos);
+    virtual void print_to(string &out);
+    virtual void emit_ast(AstWriter &out);
+    virtual PTR(Type) infer(TypeChecker &tc);
+    virtual void resolve(frames_t &scope);
+    void pretty_print_at(PrettyStream &os, precedence_t node, bool let_parent, streampos &strmpos);
+};
+
+class LetRec : public Expr, private Counted<stats_letrec, LetRec> {
+public:
+    string lhs;
+    PTR(Expr) rhs;  //Evaluated in an environment that already binds lhs
+    PTR(Expr) bodyExpr;
+    LetRec(string lhs, PTR(Expr) rhs, PTR(Expr) bodyExpr);
+    virtual bool equals(const PTR(Expr) &e);
+    virtual PTR(Val) interp(const PTR(Env) &env = nullptr);
+    virtual void print_to(string &out);
+    virtual void emit_ast(AstWriter &out);
+    virtual PTR(Type) infer(TypeChecker &tc);
+    virtual void resolve(frames_t &scope);
+    void pretty_print_at(PrettyStream &os, precedence_t node, bool let_parent, streampos &strmpos);
 };
 
-class BoolExpr : public Expr {
+class BoolExpr : public Expr, private Counted<stats_bool_expr, BoolExpr> {
 public:
     bool val;
     BoolExpr(bool b);
-    virtual bool equals (PTR(Expr) e);
-    virtual PTR(Val) interp(PTR(Env) env = nullptr);
+    virtual bool equals(const PTR(Expr) &e);
+    virtual PTR(Val) interp(const PTR(Env) &env = nullptr);
 //    virtual bool has_variable();
 //    virtual PTR(Expr) subst(string varName, PTR(Expr) replacement);
-    virtual void print (ostream& os);
-    void pretty_print_at(ostream &os, precedence_t node, bool let_parent, streampos &strmpos);
+    virtual void print_to(string &out);
+    virtual void emit_ast(AstWriter &out);
+    virtual PTR(Type) infer(TypeChecker &tc);
+    virtual void resolve(frames_t &scope);
+    void pretty_print_at(PrettyStream &os, precedence_t node, bool let_parent, streampos &strmpos);
 };
 
-class IfExpr : public Expr {
+class IfExpr : public Expr, private Counted<stats_if, IfExpr> {
 public:
     PTR(Expr) if_;
     PTR(Expr) then_;
     PTR(Expr) else_;
     IfExpr(PTR(Expr) if_, PTR(Expr) then_, PTR(Expr) else_);
 
-    virtual bool equals (PTR(Expr) e);
-    virtual PTR(Val) interp(PTR(Env) env = nullptr);
+    virtual bool equals(const PTR(Expr) &e);
+    virtual PTR(Val) interp(const PTR(Env) &env = nullptr);
 //    virtual bool has_variable();
 //    virtual PTR(Expr) subst(string varName, PTR(Expr) replacement);
-    virtual void print (ostream& os);
-    void pretty_print_at(ostream &os, precedence_t node, bool let_parent, streampos &strmpos);
+    virtual void print_to(string &out);
+    virtual void emit_ast(AstWriter &out);
+    virtual PTR(Type) infer(TypeChecker &tc);
+    virtual void resolve(frames_t &scope);
+    void pretty_print_at(PrettyStream &os, precedence_t node, bool let_parent, streampos &strmpos);
 };
 
-class EqExpr : public Expr {
+class EqExpr : public Expr, private Counted<stats_eq, EqExpr> {
 public:
     PTR(Expr) rhs;
     PTR(Expr) lhs;
     EqExpr(PTR(Expr) rhs, PTR(Expr) lhs);
-    virtual bool equals (PTR(Expr) e);
-    virtual PTR(Val) interp(PTR(Env) env = nullptr);
+    virtual bool equals(const PTR(Expr) &e);
+    virtual PTR(Val) interp(const PTR(Env) &env = nullptr);
 //    virtual bool has_variable();
 //    virtual PTR(Expr) subst(string varName, PTR(Expr) replacement);
-    virtual void print (ostream& os);
-    void pretty_print_at(ostream &os, precedence_t node, bool let_parent, streampos &strmpos);
+    virtual void print_to(string &out);
+    virtual void emit_ast(AstWriter &out);
+    virtual PTR(Type) infer(TypeChecker &tc);
+    virtual void resolve(frames_t &scope);
+    void pretty_print_at(PrettyStream &os, precedence_t node, bool let_parent, streampos &strmpos);
 };
 
-class FunExpr : public Expr{
+class FunExpr : public Expr, private Counted<stats_fun, FunExpr> {
 public:
-   string formalarg;
     PTR(Expr) body;
     FunExpr(string formalArg, PTR(Expr) body);
-    virtual bool equals(PTR(Expr) e);
-    virtual PTR(Val) interp(PTR(Env) env = nullptr);
+    FunExpr(vector<string> formalArgs, PTR(Expr) body);
+    const vector<string> &formalargs() const { return *formalargs_; }
+    virtual bool equals(const PTR(Expr) &e);
+    virtual PTR(Val) interp(const PTR(Env) &env = nullptr);
 //    virtual PTR(Expr) subst(string str, PTR(Expr) e);
-    virtual void print(ostream& o);
+    virtual void print_to(string &out);
+    virtual void emit_ast(AstWriter &out);
+    virtual PTR(Type) infer(TypeChecker &tc);
+    virtual void resolve(frames_t &scope);
+private:
+    std::shared_ptr<const vector<string> > formalargs_;  //given to every closure, so making one copies no names
 };
 
 
 
-class CallExpr : public Expr {
+class CallExpr : public Expr, private Counted<stats_call, CallExpr> {
 public:
     PTR(Expr) toBeCalled;
-    PTR(Expr) actualArg;
+    vector<PTR(Expr)> actualArgs;
     CallExpr(PTR(Expr) toBeCalled, PTR(Expr) actualArg);
-    bool equals(PTR(Expr) other);
-    PTR(Val) interp(PTR(Env) env = nullptr);
+    CallExpr(PTR(Expr) toBeCalled, vector<PTR(Expr)> actualArgs);
+    bool equals(const PTR(Expr) &other);
+    PTR(Val) interp(const PTR(Env) &env = nullptr);
 //    PTR(Expr) subst(const std::string var, PTR(Expr) replacement);
-    void print(std::ostream& o);
+    virtual void print_to(string &out);
+    virtual void emit_ast(AstWriter &out);
+    virtual PTR(Type) infer(TypeChecker &tc);
+    virtual void resolve(frames_t &scope);
 };
 #endif //EXPRESSIONCLASSES_EXPR_H
 
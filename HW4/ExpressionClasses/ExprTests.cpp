@@ -11,6 +11,23 @@
 #include "Val.h"
 #include "parse.hpp"
 #include "pointer.h"
+#include "serialize.h"
+#include "cache.h"
+#include "profile.h"
+#include "stats.h"
+#include "budget.h"
+#include "serve.h"
+#include "gc.h"
+#include "typecheck.h"
+#include "incremental.h"
+#include "batch.h"
+#include "csvmap.h"
+#include "constexpr_eval.h"
+#include "trace.h"
+#include "prepared.h"
+#include <fstream>
+#include <thread>
+#include <unistd.h>
 
 
 //**********VAR TESTS********//
@@ -22,12 +39,12 @@ TEST_CASE("Expr Var") {
     //Test comparing Var with a Num
     CHECK((NEW(Var)("z"))->equals(NEW(Num)(1)) == false);
     //Testing interp
-    CHECK_THROWS_WITH((NEW(Var)("x"))->interp(Env::empty), "Variable has no value");
+    CHECK_THROWS_WITH((NEW(Var)("x"))->interp(Env::empty), "free variable: x");
 }
 
 TEST_CASE("Var Interp Throws") {
     CHECK_THROWS_AS((NEW(Var)("x"))->interp(Env::empty), std::runtime_error);
-    CHECK_THROWS_WITH((NEW(Var)("x"))->interp(Env::empty), "Variable has no value");
+    CHECK_THROWS_WITH((NEW(Var)("x"))->interp(Env::empty), "free variable: x");
 }
 
 //TEST_CASE("Var Has Variable") {
@@ -327,7 +344,7 @@ TEST_CASE("Interp") {
     //Variable is unchanged.
     CHECK_THROWS_WITH (
             (NEW(Add)(NEW(Let)("x", NEW(Num)(3), NEW(Let)("y", NEW(Num)(3), NEW(Add)(NEW(Var)("y"), NEW(Num)(2)))),
-                     NEW(Var)("x")))->interp(Env::empty), "Variable has no value");
+                     NEW(Var)("x")))->interp(Env::empty), "free variable: x");
     //Lhs Add
     CHECK ((NEW(Add)(NEW(Let)("x", NEW(Num)(2), NEW(Add)(NEW(Var)("x"), NEW(Num)(9))), NEW(Num)(4)))->interp(Env::empty)->equals(NEW(NumVal)(15)));
 }
@@ -412,6 +429,23 @@ CHECK((NEW(Let)("x", NEW(Num)(5),
                                  "                  _in  a + 8) + x");
 }
 
+TEST_CASE("Pretty Print to a stream that already has output") {
+    PTR(Expr) expr = NEW(Add)(NEW(Let)("x", NEW(Num)(3), NEW(Let)("y", NEW(Num)(3), NEW(Add)(NEW(Var)("y"), NEW(Num)(2)))),
+                              NEW(Var)("x"));
+    //Indentation is counted from where pretty_print starts, not from the start of the stream
+    ostringstream output;
+    output << "result: ";
+    expr->pretty_print(output);
+    CHECK(output.str() == "result: " + expr->to_pretty_string());
+
+    //Writing through a PrettyStream keeps count of every character
+    ostringstream counted;
+    PrettyStream pretty(counted);
+    pretty << "_let x = " << 5;
+    CHECK(pretty.position() == streampos(10));
+    CHECK(counted.str() == "_let x = 5");
+}
+
 TEST_CASE("parse") {
     CHECK_THROWS_WITH( parse_str("()"), "Invalid Input!" );
 
@@ -643,8 +677,9 @@ TEST_CASE("IfExpr printing") {
 TEST_CASE("IfExpr pretty printing respects line breaks and indentation") {
     auto ifExpr = NEW(IfExpr)(NEW(Var)("x"), NEW(Num)(1), NEW(Num)(2));
     ostringstream output;
+    PrettyStream pretty(output);
     streampos strmpos = 0;
-    ifExpr->pretty_print_at(output,prec_none, false, strmpos);
+    ifExpr->pretty_print_at(pretty,prec_none, false, strmpos);
 
     SECTION("includes line breaks and indentation for readability") {
         CHECK(output.str() == "_if x\n_then 1\n_else 2\n");
@@ -725,7 +760,7 @@ TEST_CASE("Testing BoolVal ") {
         REQUIRE_THROWS_AS((NEW(BoolVal)(true))->mult_with(NEW(BoolVal)(false)), runtime_error);
     }
 }
-TEST_CASE("Testing BoolExpr") {
+TEST_CASE("Testing BoolExpr 2") {
     SECTION("constructor, print"){
         BoolExpr trueExpr(true);
         BoolExpr falseExpr(false);
@@ -875,4 +910,1159 @@ TEST_CASE("FunExpr") {
         CHECK((parse_str("(_fun (x) x+1 (10))"))->interp(Env::empty)->to_string() == "11");
         CHECK((parse_str("(_fun (x) x+x (1))"))->interp(Env::empty)->to_string() == "2");
     }
-}
\ No newline at end of file
+}
+TEST_CASE("Print into a buffer") {
+    SECTION("append_int") {
+        string out = "n=";
+        append_int(out, 0);
+        append_int(out, -7);
+        append_int(out, 2147483647);
+        append_int(out, -2147483647 - 1);
+        CHECK(out == "n=0-72147483647-2147483648");
+        CHECK((NEW(NumVal)(-2147483647 - 1))->to_string() == "-2147483648");
+    }
+
+    SECTION("nested functions and calls") {
+        PTR(Expr) nested = parse_str("_fun (f) _fun (x) f(f(x))");
+        CHECK(nested->to_string() == "(_fun (f) (_fun (x) (f) ((f) (x))))");
+        ostringstream output;
+        output << "expr: ";
+        nested->print(output);
+        CHECK(output.str() == "expr: (_fun (f) (_fun (x) (f) ((f) (x))))");
+    }
+}
+
+TEST_CASE("Binary AST") {
+    SECTION("round trip of every node type") {
+        PTR(Expr) exprs[] = {
+                NEW(Num)(0),
+                NEW(Num)(-2147483647 - 1),
+                NEW(Num)(2147483647),
+                NEW(Var)("x"),
+                NEW(Add)(NEW(Num)(1), NEW(Var)("y")),
+                NEW(Mult)(NEW(Num)(-3), NEW(Num)(300)),
+                NEW(Let)("x", NEW(Num)(5), NEW(Add)(NEW(Var)("x"), NEW(Var)("x"))),
+                NEW(BoolExpr)(true),
+                NEW(BoolExpr)(false),
+                NEW(IfExpr)(NEW(EqExpr)(NEW(Var)("x"), NEW(Num)(1)), NEW(Num)(1), NEW(Num)(2)),
+                NEW(EqExpr)(NEW(Num)(1), NEW(BoolExpr)(true)),
+                NEW(FunExpr)("x", NEW(Mult)(NEW(Var)("x"), NEW(Var)("x"))),
+                NEW(CallExpr)(NEW(FunExpr)("x", NEW(Var)("x")), NEW(Num)(10)),
+                parse_str("_let factrl = _fun (factrl) _fun (x) _if x == 1 _then 1 _else x * factrl(factrl)(x + -1)"
+                          " _in factrl(factrl)(10)")
+        };
+        for (size_t i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++) {
+            string bytes = emit_ast(exprs[i]);
+            PTR(Expr) loaded = load_ast(bytes.data(), bytes.size());
+            CHECK(loaded->equals(exprs[i]));
+            CHECK(loaded->to_string() == exprs[i]->to_string());
+        }
+    }
+
+    SECTION("names are stored once") {
+        string bytes = emit_ast(parse_str("xyz + xyz + xyz + xyz"));
+        CHECK(bytes.find("xyz") == bytes.rfind("xyz"));
+    }
+
+    SECTION("bad input") {
+        string bytes = emit_ast(NEW(Add)(NEW(Num)(1), NEW(Num)(2)));
+        CHECK_THROWS_WITH(load_ast("MSDB", 4), "Not an AST file!");
+        string old_version = bytes;
+        old_version[4] = (char) (AST_VERSION + 1);
+        CHECK_THROWS_WITH(load_ast(old_version.data(), old_version.size()), "Unsupported AST file version!");
+        CHECK_THROWS_WITH(load_ast(bytes.data(), bytes.size() - 1), "Truncated AST file!");
+        string extra = bytes + "x";
+        CHECK_THROWS_WITH(load_ast(extra.data(), extra.size()), "Trailing bytes in AST file!");
+    }
+}
+
+TEST_CASE("Program cache") {
+    char dir_template[] = "/tmp/msdscript_cache_XXXXXX";
+    string dir = mkdtemp(dir_template);
+    string source = "_let x = 5 _in _if x == 5 _then x * 2 _else 0";
+    string path = cache_path(source, dir);
+
+    SECTION("miss then hit") {
+        PTR(Expr) parsed = parse_cached(source, dir);
+        CHECK(parsed->equals(parse_str(source)));
+        CHECK(access(path.c_str(), R_OK) == 0);
+        CHECK(parse_cached(source, dir)->equals(parsed));
+        //Different source gets a different entry
+        CHECK(cache_path(source + " ", dir) != path);
+    }
+
+    SECTION("corrupt entries are replaced") {
+        parse_cached(source, dir);
+        {
+            fstream file(path.c_str(), ios::in | ios::out | ios::binary);
+            file.seekp(-1, ios::end);
+            file.put('\x7f');
+        }
+        CHECK(parse_cached(source, dir)->equals(parse_str(source)));
+        {
+            ofstream file(path.c_str(), ios::trunc);
+            file << "junk";
+        }
+        CHECK(parse_cached(source, dir)->equals(parse_str(source)));
+        //The entry was rewritten, so it loads cleanly again
+        ifstream file(path.c_str(), ios::binary);
+        string bytes((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+        CHECK(bytes.substr(0, 4) == "MSDC");
+    }
+
+    SECTION("an entry for other source is not used") {
+        //Same length, and the header made to claim this source's key, as a colliding or planted entry would
+        string other = "_let x = 6 _in _if x == 5 _then x * 2 _else 0";
+        parse_cached(source, dir);
+        parse_cached(other, dir);
+        string other_path = cache_path(other, dir);
+        string bytes;
+        {
+            ifstream file(path.c_str(), ios::binary);
+            string mine((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+            ifstream other_file(other_path.c_str(), ios::binary);
+            bytes.assign((istreambuf_iterator<char>(other_file)), istreambuf_iterator<char>());
+            bytes.replace(4, 8, mine.substr(4, 8));
+        }
+        {
+            ofstream file(path.c_str(), ios::binary | ios::trunc);
+            file << bytes;
+        }
+        CHECK(parse_cached(source, dir)->equals(parse_str(source)));
+        CHECK(parse_cached(other, dir)->equals(parse_str(other)));
+        unlink(other_path.c_str());
+    }
+
+    SECTION("parse errors are not cached") {
+        CHECK_THROWS_WITH(parse_cached("(1", dir), "Missing close parenthesis!");
+        CHECK(access(cache_path("(1", dir).c_str(), R_OK) != 0);
+    }
+
+    unlink(path.c_str());
+    rmdir(dir.c_str());
+}
+
+TEST_CASE("Profiler") {
+    profile_reset();
+    PTR(Expr) e = parse_str("_if 1 == 1 _then (1 + 2) * 3 _else 4");
+
+    SECTION("disabled") {
+        e->interp(Env::empty);
+        CHECK(profile_counts[prof_num].calls == 0);
+    }
+
+    SECTION("counts per node type") {
+        profile_enabled = true;
+        e->interp(Env::empty);
+        //A node that throws is still counted
+        CHECK_THROWS(parse_str("1 + _true")->interp(Env::empty));
+        profile_enabled = false;
+        CHECK(profile_counts[prof_if].calls == 1);
+        CHECK(profile_counts[prof_eq].calls == 1);
+        CHECK(profile_counts[prof_num].calls == 6);
+        CHECK(profile_counts[prof_add].calls == 2);
+        CHECK(profile_counts[prof_mult].calls == 1);
+        CHECK(profile_counts[prof_bool].calls == 1);
+        CHECK(profile_counts[prof_let].calls == 0);
+        CHECK(profile_counts[prof_if].self_ns <= profile_counts[prof_if].total_ns);
+
+        ostringstream report;
+        profile_report(report);
+        CHECK(report.str().find("IfExpr") != string::npos);
+        CHECK(report.str().find("Let") == string::npos);
+    }
+    profile_reset();
+}
+
+TEST_CASE("Allocation stats") {
+    PTR(Expr) e = parse_str("_let x = 1 _in _let y = 2 _in x + y");
+    stats_reset();
+    unsigned long live_vals = stats_counts[stats_num_val].live;
+    unsigned long live_envs = stats_counts[stats_extended_env].live;
+
+    PTR(Val) v = e->interp(Env::empty);
+    CHECK(v->to_string() == "3");
+    //Both environments are gone once interp returns; only the result is still live
+    CHECK(stats_counts[stats_extended_env].live == live_envs);
+    CHECK(stats_counts[stats_extended_env].total == live_envs + 2);
+    CHECK(stats_counts[stats_num_val].live == live_vals + 1);
+    CHECK(stats_counts[stats_num_val].total == live_vals + 3);
+    CHECK(stats_peak_bytes >= stats_live_bytes);
+
+    //x is two frames out and y is one
+    CHECK(stats_lookup_depths[1] == 1);
+    CHECK(stats_lookup_depths[2] == 1);
+    CHECK_THROWS_WITH(parse_str("z")->interp(Env::empty), "free variable: z");
+    CHECK(stats_lookup_depths[0] == 1);
+
+    ostringstream report;
+    stats_report(report);
+    CHECK(report.str().find("\"ExtendedEnv\": {") != string::npos);
+    CHECK(report.str().find("\"lookup_depths\": {\"0\": 1, \"1\": 1, \"2\": 1}") != string::npos);
+
+    //A Var whose remembered depth now lands on another name only counts the full lookup that follows
+    PTR(Var) x = NEW(Var)("x");
+    x->spec = spec_depth;
+    x->depth = 0;
+    stats_reset();
+    CHECK(x->interp(NEW(ExtendedEnv)("y", NEW(NumVal)(2), NEW(ExtendedEnv)("x", NEW(NumVal)(3), Env::empty)))
+                  ->to_string() == "3");
+    CHECK(stats_lookup_depths[2] == 1);
+    CHECK(stats_lookup_depths[3] == 0);
+}
+
+TEST_CASE("Source spans") {
+    string source = "_let f = _fun (x) x * 2\n_in f(3) + 1";
+    PTR(Expr) e = parse_str(source);
+    CHECK(e->span.start == 0);
+    CHECK(e->span.end == (int) source.size());
+    PTR(Let) let = CAST(Let)(e);
+    CHECK(source.substr(let->rhs->span.start, let->rhs->span.end - let->rhs->span.start) == "_fun (x) x * 2");
+    PTR(Add) body = CAST(Add)(let->bodyExpr);
+    CHECK(source.substr(body->lhs->span.start, body->lhs->span.end - body->lhs->span.start) == "f(3)");
+    CHECK(body->rhs->span.start == (int) source.size() - 1);
+
+    //Nodes built directly have no span, and spans survive the binary format
+    CHECK(NEW(Num)(1)->span.start == -1);
+    string bytes = emit_ast(e);
+    PTR(Expr) loaded = load_ast(bytes.data(), bytes.size());
+    CHECK(CAST(Let)(loaded)->rhs->span.start == let->rhs->span.start);
+}
+
+TEST_CASE("Call stack profile") {
+    string source = "_let f = _fun (x) x * 2\n_in f(3) + f(4)";
+    PTR(Expr) e = parse_str(source);
+    profile_stacks_reset();
+
+    profile_stacks_enabled = true;
+    {
+        StackFrame frame(e.get(), "program", "", -1);
+        CHECK(e->interp(Env::empty)->to_string() == "14");
+    }
+    profile_stacks_enabled = false;
+
+    ostringstream report;
+    profile_stacks_report(report, source);
+    string folded = report.str();
+    //Both calls of f share one stack, and every line ends with a count
+    CHECK(folded.find("program;_let f @1:1;_fun x @1:10 ") != string::npos);
+    CHECK(folded.find("_fun x @1:10", folded.find("_fun x @1:10") + 1) == string::npos);
+    istringstream lines(folded);
+    string line;
+    while (getline(lines, line)) {
+        CHECK(line.find_last_of(' ') != string::npos);
+        CHECK(atoll(line.c_str() + line.find_last_of(' ') + 1) > 0);
+    }
+
+    ostringstream no_source;
+    profile_stacks_report(no_source, "");
+    CHECK(no_source.str().find("_fun x @+9") != string::npos);
+    profile_stacks_reset();
+}
+
+TEST_CASE("Evaluation budget") {
+    PTR(Expr) forever = parse_str("_let f = _fun (f) f(f) _in f(f)");
+    PTR(Expr) fib = parse_str("_let fib = _fun (fib) _fun (n) _if n == 0 _then 0 _else _if n == 1 _then 1"
+                              " _else fib(fib)(n + -1) + fib(fib)(n + -2) _in fib(fib)(10)");
+
+    SECTION("fuel") {
+        eval_limits_t limits = { 1000, 0, 0 };
+        EvalBudget budget(limits);
+        CHECK_THROWS_AS(forever->interp(Env::empty), BudgetExceeded);
+        CHECK(budget_usage.steps == 1001);
+        CHECK(budget_usage.depth < 1000);
+    }
+
+    SECTION("bytes") {
+        eval_limits_t limits = { 0, 4096, 0 };
+        EvalBudget budget(limits);
+        try {
+            fib->interp(Env::empty);
+            FAIL("no limit hit");
+        } catch (BudgetExceeded &e) {
+            CHECK(e.kind == budget_bytes);
+            CHECK(string(e.what()) == "memory limit of 4096 bytes exceeded!");
+        }
+    }
+
+    SECTION("depth") {
+        eval_limits_t limits = { 0, 0, 50 };
+        EvalBudget budget(limits);
+        CHECK_THROWS_WITH(forever->interp(Env::empty), "recursion deeper than 50 levels!");
+        //Every level that was entered was left again while unwinding
+        CHECK(budget_usage.depth == 0);
+    }
+
+    SECTION("within limits") {
+        eval_limits_t limits = { 100000, 1000000, 1000 };
+        {
+            EvalBudget budget(limits);
+            CHECK(fib->interp(Env::empty)->to_string() == "55");
+            CHECK(budget_usage.steps > 0);
+        }
+        //Nothing is limited once the budget is gone
+        CHECK_FALSE(budget_active);
+        CHECK(parse_str("1 + 2")->interp(Env::empty)->to_string() == "3");
+    }
+}
+
+TEST_CASE("Serve mode") {
+    eval_limits_t no_limits = { 0, 0, 0 };
+    string out, err;
+
+    SECTION("single requests match separate runs") {
+        CHECK(run_request("--interp", "_let x = 2 _in x * 3", no_limits, out, err) == 0);
+        CHECK(out == "6\n");
+        CHECK(run_request("--print", "1+2", no_limits, out, err) == 0);
+        CHECK(out == "(1 + 2)\n");
+        CHECK(run_request("--prettyprint", "(1+2)*3", no_limits, out, err) == 0);
+        CHECK(out == "(1 + 2) * 3\n");
+        CHECK(run_request("--interp", "x", no_limits, out, err) == 1);
+        CHECK(out == "");
+        CHECK(err == "Error: free variable: x\n");
+        eval_limits_t fuel = { 10, 0, 0 };
+        CHECK(run_request("--interp", "_let f = _fun (f) f(f) _in f(f)", fuel, out, err) == 2);
+    }
+
+    SECTION("framed stream") {
+        string request1 = "1 + 2";
+        string request2 = "_true +";
+        istringstream in("--interp " + std::to_string(request1.size()) + "\n" + request1
+                         + "--print " + std::to_string(request2.size()) + "\n" + request2);
+        ostringstream response;
+        CHECK(serve(in, response, no_limits) == 0);
+        CHECK(response.str() == string(SERVE_GREETING) + "\n"
+                                + "0 2 0\n3\n"
+                                + "1 0 22\nError: Invalid Input!\n");
+    }
+
+    SECTION("malformed header") {
+        const char *requests[] = {
+                "--interp many\n1",
+                "--interp -1\n1\n",
+                "--interp 18446744073709551615\n1\n",
+                "--interp 67108865\n1\n",
+                "--interp +1\n1",
+                "--interp 5\n1",
+        };
+        for (size_t i = 0; i < sizeof(requests) / sizeof(requests[0]); i++) {
+            istringstream in(requests[i]);
+            ostringstream response;
+            CHECK(serve(in, response, no_limits) == 1);
+        }
+    }
+}
+
+TEST_CASE("Cycle collector") {
+    gc_collect();
+    size_t tracked = gc_stats.tracked;
+
+    SECTION("a dead closure/environment cycle is freed") {
+        PTR(FunVal) fun = NEW(FunVal)("x", NEW(Add)(NEW(Var)("x"), NEW(Num)(1)), Env::empty);
+        PTR(Env) env = NEW(ExtendedEnv)("f", fun, Env::empty);
+        fun->env = env;
+        weak_ptr<Env> watch = env;
+        env = nullptr;
+        fun = nullptr;
+        CHECK_FALSE(watch.expired());
+        CHECK(gc_collect() == 2);
+        CHECK(watch.expired());
+        CHECK(gc_stats.tracked == tracked);
+    }
+
+    SECTION("a cycle still referenced from outside is kept") {
+        PTR(FunVal) fun = NEW(FunVal)("x", NEW(Add)(NEW(Var)("x"), NEW(Num)(1)), Env::empty);
+        PTR(Env) env = NEW(ExtendedEnv)("f", fun, Env::empty);
+        fun->env = env;
+        env = nullptr;
+        CHECK(gc_collect() == 0);
+        CHECK(fun->call(NEW(NumVal)(4))->to_string() == "5");
+        CHECK(fun->env->lookup("f") == fun);
+        fun->env = nullptr;
+    }
+
+    SECTION("interp leaves nothing behind") {
+        PTR(Expr) fib = parse_str("_let fib = _fun (fib) _fun (n) _if n == 0 _then 0 _else _if n == 1 _then 1"
+                                  " _else fib(fib)(n + -1) + fib(fib)(n + -2) _in fib(fib)(15)");
+        CHECK(fib->interp(Env::empty)->to_string() == "610");
+        CHECK(gc_collect() == 0);
+        CHECK(gc_stats.tracked == tracked);
+    }
+}
+
+TEST_CASE("Type inference") {
+    SECTION("infers num, bool and function types") {
+        CHECK(type_to_string(infer_type(parse_str("1 + 2 * 3"))) == "int");
+        CHECK(type_to_string(infer_type(parse_str("_if 1 == 2 _then _true _else _false"))) == "bool");
+        CHECK(type_to_string(infer_type(parse_str("_fun (x) x + 1"))) == "int -> int");
+        CHECK(type_to_string(infer_type(parse_str("_fun (f) f(1) == 2"))) == "(int -> int) -> bool");
+    }
+
+    SECTION("_let generalizes") {
+        CHECK(type_to_string(infer_type(parse_str("_let id = _fun (x) x _in _if id(_true) _then id(1) _else 2")))
+              == "int");
+        CHECK_THROWS_AS(infer_type(parse_str("(_fun (id) _if id(_true) _then id(1) _else 2)(_fun (x) x)")),
+                        TypeError);
+    }
+
+    SECTION("ill-typed programs are rejected") {
+        CHECK_THROWS_WITH(infer_type(parse_str("1 + _true")), "type error: _true has type bool but int was expected");
+        CHECK_THROWS_AS(infer_type(parse_str("_if 1 _then 2 _else 3")), TypeError);
+        CHECK_THROWS_AS(infer_type(parse_str("_fun (f) f(f)")), TypeError);
+        CHECK_THROWS_WITH(infer_type(parse_str("x + 1")), "type error: free variable: x");
+    }
+
+    SECTION("well-typed programs take the fast paths") {
+        PTR(Expr) e = parse_str("_let f = _fun (n) _if n == 0 _then 1 _else n * 2 _in f(3) + f(0)");
+        CHECK(mark_typed(e));
+        PTR(Let) let = CAST(Let)(e);
+        PTR(Add) body = CAST(Add)(let->bodyExpr);
+        PTR(IfExpr) test = CAST(IfExpr)(CAST(FunExpr)(let->rhs)->body);
+        CHECK(body->statically_typed);
+        CHECK(test->statically_typed);
+        CHECK(test->if_->statically_typed);
+        CHECK(test->else_->statically_typed);
+        CHECK(e->interp(Env::empty)->to_string() == "7");
+    }
+
+    SECTION("comparing booleans and ill-typed programs stay checked") {
+        PTR(Expr) eq = parse_str("_true == _false");
+        CHECK(mark_typed(eq));
+        CHECK_FALSE(eq->statically_typed);
+        CHECK(eq->interp(Env::empty)->to_string() == "0");
+
+        PTR(Expr) fib = parse_str("_let fib = _fun (fib) _fun (n) _if n == 0 _then 0 _else _if n == 1 _then 1"
+                                  " _else fib(fib)(n + -1) + fib(fib)(n + -2) _in fib(fib)(10)");
+        CHECK_FALSE(mark_typed(fib));
+        CHECK(fib->interp(Env::empty)->to_string() == "55");
+    }
+}
+
+TEST_CASE("Self-specializing nodes") {
+    SECTION("nodes specialize on the operands they see") {
+        PTR(Expr) e = parse_str("_let f = _fun (x) _if x == 0 _then 1 _else x * 2 _in f(3) + f(0)");
+        CHECK(e->interp(Env::empty)->to_string() == "7");
+        PTR(Let) let = CAST(Let)(e);
+        PTR(IfExpr) test = CAST(IfExpr)(CAST(FunExpr)(let->rhs)->body);
+        CHECK(let->bodyExpr->spec == spec_num);
+        CHECK(CAST(Add)(let->bodyExpr)->lhs->spec == spec_fun);
+        CHECK(test->spec == spec_bool);
+        CHECK(test->if_->spec == spec_num);
+        CHECK(CAST(Mult)(test->else_)->lhs->spec == spec_depth);
+        CHECK(e->interp(Env::empty)->to_string() == "7");
+    }
+
+    SECTION("a failed assumption falls back to the generic path") {
+        PTR(Expr) e = parse_str("_let f = _fun (x) x == 1 _in _if f(1) _then f(_true) _else _false");
+        CHECK(e->interp(Env::empty)->to_string() == "0");
+        PTR(Expr) eq = CAST(FunExpr)(CAST(Let)(e)->rhs)->body;
+        CHECK(eq->spec == spec_generic);
+
+        PTR(Expr) add = parse_str("x + 1");
+        CHECK(add->interp(NEW(ExtendedEnv)("x", NEW(NumVal)(1), Env::empty))->to_string() == "2");
+        CHECK(add->spec == spec_num);
+        CHECK_THROWS_WITH(add->interp(NEW(ExtendedEnv)("x", NEW(BoolVal)(true), Env::empty)), "Cannot add bool");
+        CHECK(add->spec == spec_generic);
+    }
+
+    SECTION("a variable found at a different depth is looked up again") {
+        //x is free in the tree, so every run looks it up by name, even where a shallower frame binds it again
+        PTR(Var) x = NEW(Var)("x");
+        PTR(Env) shallow = NEW(ExtendedEnv)("x", NEW(NumVal)(1), Env::empty);
+        PTR(Env) deep = NEW(ExtendedEnv)("y", NEW(NumVal)(2), NEW(ExtendedEnv)("x", NEW(NumVal)(3), Env::empty));
+        PTR(Env) shadowed = NEW(ExtendedEnv)("x", NEW(NumVal)(5), NEW(ExtendedEnv)("x", NEW(NumVal)(3), Env::empty));
+        CHECK(x->interp(shallow)->to_string() == "1");
+        CHECK(x->interp(deep)->to_string() == "3");
+        CHECK(x->interp(shadowed)->to_string() == "5");
+        CHECK(x->spec == spec_uninitialized);
+        CHECK_THROWS_WITH(x->interp(Env::empty), "free variable: x");
+
+        //Bound inside the tree, the depth is fixed by the binders in between, whatever the caller's frames
+        PTR(Expr) e = parse_str("_let y = 1 _in _let z = 2 _in x + y");
+        PTR(Var) y = CAST(Var)(CAST(Add)(CAST(Let)(CAST(Let)(e)->bodyExpr)->bodyExpr)->rhs);
+        CHECK(e->interp(deep)->to_string() == "4");
+        CHECK(y->spec == spec_depth);
+        CHECK(y->depth == 1);
+        CHECK(e->interp(shadowed)->to_string() == "6");
+        CHECK(e->interp(shallow)->to_string() == "2");
+
+        //A depth that no longer fits still falls back to the lookup by name
+        x->spec = spec_depth;
+        x->depth = 0;
+        CHECK(x->interp(deep)->to_string() == "3");
+        CHECK(x->spec == spec_generic);
+    }
+}
+
+TEST_CASE("Lazy let") {
+    lazy_let = true;
+
+    SECTION("an unused binding is never evaluated") {
+        CHECK(parse_str("_let x = 1 + _true _in 5")->interp(Env::empty)->to_string() == "5");
+        CHECK(parse_str("_let x = 1 _in _let y = x + _true _in _if x == 1 _then x _else y")
+                      ->interp(Env::empty)->to_string() == "1");
+        CHECK_THROWS_WITH(parse_str("_let x = 1 + _true _in x")->interp(Env::empty), "You can't add a non-number!");
+    }
+
+    SECTION("a binding used twice is evaluated once") {
+        unsigned long before = stats_counts[stats_num_val].total;
+        CHECK(parse_str("_let x = 2 + 3 _in x + x")->interp(Env::empty)->to_string() == "10");
+        //2, 3, 5 and 10
+        CHECK(stats_counts[stats_num_val].total - before == 4);
+    }
+
+    SECTION("results match eager evaluation") {
+        const char *programs[] = {
+                "_let f = _fun (x) x * 2 _in _let y = f(4) _in y + y",
+                "_let x = 3 _in _let x = x + 1 _in x",
+                "_let fib = _fun (fib) _fun (n) _if n == 0 _then 0 _else _if n == 1 _then 1"
+                " _else fib(fib)(n + -1) + fib(fib)(n + -2) _in fib(fib)(10)",
+                "_let t = _true _in _let n = 5 _in _if t _then n == 5 _else _false",
+        };
+        for (size_t i = 0; i < sizeof(programs) / sizeof(programs[0]); i++) {
+            lazy_let = false;
+            string eager = parse_str(programs[i])->interp(Env::empty)->to_string();
+            lazy_let = true;
+            CHECK(parse_str(programs[i])->interp(Env::empty)->to_string() == eager);
+        }
+    }
+
+    lazy_let = false;
+}
+
+TEST_CASE("Incremental re-evaluation") {
+    const string fib = "_let fib = _fun (fib) _fun (n) _if n == 0 _then 0 _else _if n == 1 _then 1"
+                       " _else fib(fib)(n + -1) + fib(fib)(n + -2) _in fib(fib)(12)";
+    Incremental incremental;
+
+    SECTION("an edit outside a closed subtree reuses its value") {
+        CHECK(incremental.run("_let a = " + fib + " _in a + 1")->to_string() == "145");
+        unsigned long envs = stats_counts[stats_extended_env].total;
+        incremental_stats_t before = incremental_stats;
+        CHECK(incremental.run("_let a = " + fib + " _in a * 2")->to_string() == "288");
+        CHECK(incremental_stats.reused - before.reused == 1);
+        //Only the binding of a; none of fib's calls run again
+        CHECK(stats_counts[stats_extended_env].total - envs == 1);
+        CHECK(incremental_stats.compared - before.compared == 1);
+    }
+
+    SECTION("a reused subtree is compared with the old one only once") {
+        incremental.run("_let a = " + fib + " _in a + 1");
+        PTR(Expr) e = incremental.prepare(parse_str("_fun (x) (" + fib + ") + x"));
+        PTR(Val) f = e->interp(Env::empty);
+        incremental_stats_t before = incremental_stats;
+        for (int i = 0; i < 5; i++) {
+            CHECK(f->call(NEW(NumVal)(i))->to_string() == std::to_string(144 + i));
+        }
+        CHECK(incremental_stats.reused - before.reused == 5);
+        CHECK(incremental_stats.compared - before.compared == 1);
+    }
+
+    SECTION("a changed subtree is evaluated again") {
+        CHECK(incremental.run("_let a = " + fib + " _in a + 1")->to_string() == "145");
+        string edited = fib;
+        edited.replace(edited.find("(12)"), 4, "(10)");
+        CHECK(incremental.run("_let a = " + edited + " _in a + 1")->to_string() == "56");
+        CHECK(incremental.run("_let a = " + edited + " _in a + 1")->to_string() == "56");
+    }
+
+    SECTION("printing and equality see through the wrappers") {
+        string source = "_let a = (1 + 2) * (3 + 4) + 5 _in a + (2 * 3 + 4 * 5 + 6)";
+        PTR(Expr) prepared = incremental.prepare(parse_str(source));
+        PTR(MemoExpr) whole = CAST(MemoExpr)(prepared);
+        REQUIRE(whole != nullptr);
+        PTR(Expr) rhs = CAST(Let)(whole->expr)->rhs;
+        CHECK(CAST(MemoExpr)(rhs) != nullptr);
+        CHECK(rhs->equals(CAST(Let)(parse_str(source))->rhs));
+        CHECK(prepared->to_string() == parse_str(source)->to_string());
+        CHECK(prepared->to_pretty_string() == parse_str(source)->to_pretty_string());
+        CHECK(prepared->interp(Env::empty)->to_string() == "58");
+    }
+
+    SECTION("--incremental requests share one Incremental") {
+        eval_limits_t no_limits = { 0, 0, 0 };
+        string out;
+        string err;
+        CHECK(run_request("--incremental", "_let a = " + fib + " _in a", no_limits, out, err, &incremental) == 0);
+        incremental_stats_t before = incremental_stats;
+        CHECK(run_request("--incremental", "_let a = " + fib + " _in a + a", no_limits, out, err, &incremental) == 0);
+        CHECK(out == "288\n");
+        CHECK(incremental_stats.reused - before.reused == 1);
+    }
+}
+
+TEST_CASE("Letrec") {
+    const string fib = "_letrec fib = _fun (n) _if n == 0 _then 0 _else _if n == 1 _then 1"
+                       " _else fib(n + -1) + fib(n + -2) _in fib(15)";
+
+    SECTION("parses, prints and round trips") {
+        PTR(Expr) e = parse_str("_letrec f = _fun (n) f(n) _in f");
+        CHECK(e->equals(NEW(LetRec)("f", NEW(FunExpr)("n", NEW(CallExpr)(NEW(Var)("f"), NEW(Var)("n"))),
+                                    NEW(Var)("f"))));
+        CHECK_FALSE(e->equals(parse_str("_let f = _fun (n) f(n) _in f")));
+        CHECK(e->to_string() == "(_letrec f = (_fun (n) (f) (n)) _in f)");
+        CHECK(parse_str("_letrec x = 1 _in x + 2")->to_pretty_string() == "_letrec x = 1\n  _in  x + 2");
+        CHECK(load_ast(emit_ast(e).data(), emit_ast(e).size())->equals(e));
+    }
+
+    SECTION("a function can call itself directly") {
+        CHECK(parse_str(fib)->interp(Env::empty)->to_string() == "610");
+        CHECK(parse_str("_letrec fact = _fun (n) _if n == 0 _then 1 _else n * fact(n + -1) _in fact(10)")
+                      ->interp(Env::empty)->to_string() == "3628800");
+        CHECK(type_to_string(infer_type(parse_str(fib))) == "int");
+    }
+
+    SECTION("makes half the closures and environments of self-application") {
+        unsigned long funs = stats_counts[stats_fun_val].total;
+        unsigned long envs = stats_counts[stats_extended_env].total;
+        parse_str(fib)->interp(Env::empty);
+        unsigned long letrec_funs = stats_counts[stats_fun_val].total - funs;
+        unsigned long letrec_envs = stats_counts[stats_extended_env].total - envs;
+        funs = stats_counts[stats_fun_val].total;
+        envs = stats_counts[stats_extended_env].total;
+        parse_str("_let fib = _fun (fib) _fun (n) _if n == 0 _then 0 _else _if n == 1 _then 1"
+                  " _else fib(fib)(n + -1) + fib(fib)(n + -2) _in fib(fib)(15)")->interp(Env::empty);
+        CHECK(letrec_funs == 1);
+        CHECK(letrec_envs <= (stats_counts[stats_extended_env].total - envs + 1) / 2);
+        CHECK(letrec_funs * 100 < stats_counts[stats_fun_val].total - funs);
+    }
+
+    SECTION("using the variable before it has a value is an error") {
+        CHECK_THROWS_WITH(parse_str("_letrec x = x + 1 _in x")->interp(Env::empty),
+                          "variable used before its _letrec value is ready: x");
+    }
+
+    SECTION("the closure's cycle is collected") {
+        gc_collect();
+        size_t tracked = gc_stats.tracked;
+        parse_str(fib)->interp(Env::empty);
+        CHECK(gc_stats.tracked > tracked);
+        CHECK(gc_collect() == 2);
+        CHECK(gc_stats.tracked == tracked);
+    }
+}
+
+TEST_CASE("Multi-argument functions") {
+    const string sum3 = "_let f = _fun (x, y, z) x * y + z _in f(2, 3, 4)";
+
+    SECTION("parses, prints and round trips") {
+        PTR(Expr) e = parse_str("_fun (x, y) x + y");
+        vector<string> params;
+        params.push_back("x");
+        params.push_back("y");
+        CHECK(e->equals(NEW(FunExpr)(params, NEW(Add)(NEW(Var)("x"), NEW(Var)("y")))));
+        CHECK_FALSE(e->equals(parse_str("_fun (x) _fun (y) x + y")));
+        CHECK(e->to_string() == "(_fun (x, y) (x + y))");
+        CHECK(parse_str("f(1, 2)")->to_string() == "(f) (1, 2)");
+        CHECK(parse_str("f(1)")->equals(NEW(CallExpr)(NEW(Var)("f"), NEW(Num)(1))));
+        CHECK_THROWS_WITH(parse_str("_fun (x, ) x"), "Invalid Input!");
+        PTR(Expr) program = parse_str(sum3);
+        CHECK(load_ast(emit_ast(program).data(), emit_ast(program).size())->equals(program));
+    }
+
+    SECTION("binds every argument in one frame") {
+        unsigned long frames = stats_counts[stats_frame_env].total;
+        unsigned long envs = stats_counts[stats_extended_env].total;
+        CHECK(parse_str(sum3)->interp(Env::empty)->to_string() == "10");
+        CHECK(stats_counts[stats_frame_env].total - frames == 1);
+        CHECK(stats_counts[stats_extended_env].total - envs == 1);
+        CHECK(parse_str("_let f = _fun (x, x) x _in f(1, 2)")->interp(Env::empty)->to_string() == "2");
+        CHECK(parse_str("_letrec f = _fun (n, acc) _if n == 0 _then acc _else f(n + -1, acc * n) _in f(5, 1)")
+                      ->interp(Env::empty)->to_string() == "120");
+    }
+
+    SECTION("the argument count must match") {
+        CHECK_THROWS_WITH(parse_str("(_fun (x, y) x)(1)")->interp(Env::empty), "Function takes 2 arguments, not 1!");
+        CHECK_THROWS_WITH(parse_str("(_fun (x) x)(1, 2)")->interp(Env::empty), "Function takes 1 argument, not 2!");
+        CHECK_THROWS_WITH(infer_type(parse_str("(_fun (x, y) x)(1)")),
+                          "type error: ((_fun (x, y) x)) (1) passes 1 argument to a function of 2");
+        //Found by the fuzzer: a parameter nothing constrains still takes only one argument
+        CHECK_THROWS_WITH(infer_type(parse_str("(_fun (f) 0)(0, 0)")),
+                          "type error: ((_fun (f) 0)) (0, 0) passes 2 arguments to a function of 1");
+        CHECK_THROWS(infer_type(parse_str("_let apply = _fun (g) g(1, 2) _in apply(_fun (x) x)")));
+        CHECK(!mark_typed(parse_str("(_fun (b) 0)(0, 0, _true)")));
+    }
+
+    SECTION("infers a type for each argument") {
+        CHECK(type_to_string(infer_type(parse_str("_fun (x, y) _if y _then x _else x + 1"))) == "(int, bool) -> int");
+        CHECK(type_to_string(infer_type(parse_str(sum3))) == "int");
+        CHECK(type_to_string(infer_type(parse_str("_let k = _fun (x, y) x _in k(k(1, _true), 2)"))) == "int");
+    }
+}
+
+TEST_CASE("Batch evaluation") {
+    vector<string> names;
+    names.push_back("x");
+    names.push_back("y");
+    int xs[] = { 0, 1, 2, -3, 7, 100000, 5 };
+    int ys[] = { 4, 1, -2, 3, 7, 100000, 0 };
+    const size_t rows = sizeof(xs) / sizeof(xs[0]);
+    vector<const int *> columns;
+    columns.push_back(xs);
+    columns.push_back(ys);
+
+    //Whatever path BatchEval takes, every row must match interp() with the same bindings
+    struct Rows {
+        static void match(const string &source, const vector<string> &names, const vector<const int *> &columns,
+                          size_t rows, bool vectorized) {
+            BatchEval batch(parse_str(source), names);
+            CHECK(batch.vectorized() == vectorized);
+            vector<int> out(rows);
+            batch_kind_t kind = batch.run(columns, rows, out.data());
+            for (size_t row = 0; row < rows; row++) {
+                PTR(Env) env = NEW(ExtendedEnv)("y", NEW(NumVal)(columns[1][row]),
+                                                NEW(ExtendedEnv)("x", NEW(NumVal)(columns[0][row]), Env::empty));
+                PTR(Val) expected = parse_str(source)->interp(env);
+                CHECK(std::to_string(out[row]) == expected->to_string());
+                CHECK((kind == batch_bool) == (CAST(BoolVal)(expected) != nullptr));
+            }
+        }
+    };
+
+    SECTION("arithmetic, comparison, _if and _let run as column operations") {
+        Rows::match("x * 3 + y * y", names, columns, rows, true);
+        Rows::match("x == y", names, columns, rows, true);
+        Rows::match("_if x == y _then x * 2 _else y + -1", names, columns, rows, true);
+        Rows::match("_let z = x + y _in _if z == 4 _then _true _else z == 0", names, columns, rows, true);
+        Rows::match("_let x = 10 _in x + y", names, columns, rows, true);
+        Rows::match("_if x _then 1 _else 2", names, columns, rows, true);
+        Rows::match("_true == x == y", names, columns, rows, true);
+        Rows::match("x == y == _true", names, columns, rows, true);
+    }
+
+    SECTION("covers blocks of rows and the partial block at the end") {
+        vector<int> big_x(2500), big_y(2500), out(2500);
+        for (int i = 0; i < 2500; i++) {
+            big_x[i] = i;
+            big_y[i] = i % 7;
+        }
+        vector<const int *> big;
+        big.push_back(big_x.data());
+        big.push_back(big_y.data());
+        BatchEval batch(parse_str("_if y == 3 _then x * x _else x + 1"), names);
+        CHECK(batch.run(big, 2500, out.data()) == batch_num);
+        CHECK(out[3] == 9);
+        CHECK(out[4] == 5);
+        CHECK(out[2495] == 2495 * 2495);
+        CHECK(out[2499] == 2500);
+    }
+
+    SECTION("anything else runs row by row with the same results and errors") {
+        Rows::match("(_fun (a) a * x)(y)", names, columns, rows, false);
+        Rows::match("_if x == 7 _then _true _else 1 == 1", names, columns, rows, true);
+        Rows::match("_if _false _then x + _true _else y", names, columns, rows, false);
+        vector<int> out(rows);
+        CHECK_THROWS_WITH(BatchEval(parse_str("x + z"), names).run(columns, rows, out.data()), "free variable: z");
+        CHECK_THROWS_WITH(BatchEval(parse_str("_if x == 7 _then _true + 1 _else x"), names)
+                                  .run(columns, rows, out.data()), "Cannot add bool");
+        CHECK_THROWS_WITH(BatchEval(parse_str("_if x == 7 _then _true _else x"), names).run(columns, rows, out.data()),
+                          "Batch rows must all give numbers or all give booleans!");
+        CHECK_THROWS_WITH(BatchEval(parse_str("x"), names).run(vector<const int *>(1, xs), rows, out.data()),
+                          "Expected 2 columns, not 1!");
+    }
+}
+
+TEST_CASE("CSV map") {
+    struct Map {
+        static string run(const string &program, const string &csv) {
+            ostringstream out;
+            map_csv(parse_str(program), csv.data(), csv.size(), out);
+            return out.str();
+        }
+    };
+
+    SECTION("binds each column to its name, one result per row") {
+        CHECK(Map::run("x * 3 + y", "x,y\n1,2\n-4,0\n10,-10\n") == "5\n-12\n20\n");
+        CHECK(Map::run("x == y", "x,y\n1,2\n3,3\n") == "0\n1\n");
+        CHECK(Map::run("b", " a , b \r\n 1 , 2 \r\n\r\n3,\t4") == "2\n4\n");
+        CHECK(Map::run("(_fun (n) n * n)(x)", "x\n3\n-2147483648\n2147483647\n") == "9\n0\n1\n");
+        CHECK(Map::run("x", "x\n") == "");
+        CHECK(Map::run("x", "") == "");
+    }
+
+    SECTION("runs past a block of rows and a buffer of output") {
+        string csv = "x\n";
+        string expected;
+        for (int i = 0; i < 20000; i++) {
+            csv += std::to_string(i) + "\n";
+            expected += std::to_string(i * 2) + "\n";
+        }
+        CHECK(Map::run("x + x", csv) == expected);
+    }
+
+    SECTION("reports the line of a bad row") {
+        CHECK_THROWS_WITH(Map::run("x", "x,y\n1,2\n3\n"), "line 3: expected 2 fields");
+        CHECK_THROWS_WITH(Map::run("x", "x,y\n1,2,3\n"), "line 2: expected 2 fields");
+        CHECK_THROWS_WITH(Map::run("x", "x,y\n1,two\n"), "line 2: not an integer");
+        CHECK_THROWS_WITH(Map::run("x", "x\n1.5\n"), "line 2: not an integer");
+        CHECK_THROWS_WITH(Map::run("x", "x\n2147483648\n"), "line 2: number out of range");
+        CHECK_THROWS_WITH(Map::run("x + z", "x\n1\n"), "free variable: z");
+    }
+
+    SECTION("writes booleans as 1 and 0, and only if every row gives one") {
+        CHECK(Map::run("x == 2", "x\n2\n3\n") == "1\n0\n");
+        CHECK_THROWS_WITH(Map::run("_if x == 0 _then _true _else x", "x\n1\n0\n"),
+                          "Batch rows must all give numbers or all give booleans!");
+        string csv = "x\n";
+        for (int i = 0; i < 5000; i++) {
+            csv += i < 4096 ? "1\n" : "0\n";
+        }
+        CHECK_THROWS_WITH(Map::run("_if x == 0 _then _true _else x", csv),
+                          "line 4098: rows must all give numbers or all give booleans");
+    }
+
+    SECTION("writes the blocks finished before a bad row") {
+        string csv = "x\n";
+        string expected;
+        for (int i = 0; i < 5000; i++) {
+            csv += i == 4500 ? "oops\n" : std::to_string(i) + "\n";
+            if (i < 4096) {
+                expected += std::to_string(i + 1) + "\n";
+            }
+        }
+        ostringstream out;
+        CHECK_THROWS_WITH(map_csv(parse_str("x + 1"), csv.data(), csv.size(), out), "line 4502: not an integer");
+        CHECK(out.str() == expected);
+    }
+
+    SECTION("maps a file") {
+        char path_template[] = "/tmp/msdscript_map_XXXXXX";
+        int fd = mkstemp(path_template);
+        string csv = "a,b\n2,3\n4,5\n";
+        CHECK(write(fd, csv.data(), csv.size()) == (ssize_t) csv.size());
+        close(fd);
+        ostringstream out;
+        map_csv_file(parse_str("_if a == 2 _then b _else a * b"), path_template, out);
+        CHECK(out.str() == "3\n20\n");
+        unlink(path_template);
+        CHECK_THROWS_WITH(map_csv_file(parse_str("a"), path_template, out),
+                          string("Could not open ") + path_template);
+    }
+}
+
+TEST_CASE("Constexpr evaluation") {
+    SECTION("constant formulas fold at compile time") {
+        constexpr msd::value square = msd::eval("_let x = 5 _in x * x");
+        static_assert(square.as_int() == 25, "_let should fold");
+        static_assert(msd::eval("_if 2 == 1 + 1 _then _true _else _false").as_bool(), "_if should fold");
+        static_assert(msd::eval("_let x = 1 _in _let x = x + 1 _in x * -3").as_int() == -6, "inner _let hides outer");
+        static_assert(msd::eval("x * 3 + 1", msd::var("x", 4)).as_int() == 13, "constant variables fold");
+        CHECK(square.is_num());
+    }
+
+    SECTION("gives what interp gives") {
+        const char *formulas[] = {
+            "1 + 2 * 3",
+            "(1 + 2) * 3",
+            "  -7 * -1  ",
+            "_true == _true",
+            "1 == _true",
+            "3 == 2 == _false",
+            "_if 1 _then 2 _else 3",
+            "_let a = 2 _in _let b = a * a _in _if b == 4 _then b + a _else 0",
+            "_if _false _then _true + 1 _else 5",
+            "_let x = 2147483647 _in x + 1",
+        };
+        for (size_t i = 0; i < sizeof(formulas) / sizeof(formulas[0]); i++) {
+            string source = formulas[i];
+            msd::value v = msd::eval(source.data(), source.size());
+            PTR(Val) expected = parse_str(source)->interp(Env::empty);
+            CHECK(std::to_string(v.num) == expected->to_string());
+            CHECK(v.is_bool() == (CAST(BoolVal)(expected) != nullptr));
+        }
+    }
+
+    SECTION("takes run-time variables, later ones hiding earlier ones") {
+        volatile int n = 6;
+        CHECK(msd::eval("x * 3 + y", msd::var("x", n), msd::var("y", 10)).as_int() == 28);
+        CHECK(msd::eval("x", msd::var("x", 1), msd::var("x", n)).as_int() == 6);
+    }
+
+    SECTION("raises the errors interp raises") {
+        CHECK_THROWS_WITH(msd::eval("_true + 1"), "Cannot add bool");
+        CHECK_THROWS_WITH(msd::eval("1 * _false"), "You can't mult a non-number!");
+        CHECK_THROWS_WITH(msd::eval("(_true + 1) == (1 + _true)"), "You can't add a non-number!");
+        CHECK_THROWS_WITH(msd::eval("_let y = z _in 1"), "free variable: z");
+        CHECK_THROWS_WITH(msd::eval("(1 + 2"), "Missing close parenthesis!");
+        CHECK_THROWS_WITH(msd::eval("1 = 2"), "need '=='!");
+        CHECK_THROWS_WITH(msd::eval("1 2"), "Invalid Input!");
+        CHECK_THROWS_WITH(msd::eval("_fun (x) x"), "_fun and _letrec are not supported in constant formulas!");
+        CHECK_THROWS_WITH(msd::eval("1 == 1").as_int(), "Not a number!");
+    }
+}
+
+TEST_CASE("N-ary sums and products") {
+    //The right-leaning chain of binary nodes the parser used to build
+    PTR(Expr) chain = NEW(Add)(NEW(Num)(1), NEW(Add)(NEW(Mult)(NEW(Num)(2), NEW(Mult)(NEW(Var)("x"), NEW(Num)(4))),
+                                                     NEW(Num)(5)));
+
+    SECTION("chains of three or more operands parse to one node") {
+        PTR(Expr) e = parse_str("1 + 2 * x * 4 + 5");
+        PTR(Sum) sum = CAST(Sum)(e);
+        REQUIRE(sum != nullptr);
+        CHECK(sum->operands.size() == 3);
+        CHECK(CAST(Product)(sum->operands[1])->operands.size() == 3);
+        CHECK(CAST(Add)(parse_str("1 + 2")) != nullptr);
+        CHECK(CAST(Mult)(parse_str("1 * 2")) != nullptr);
+    }
+
+    SECTION("equal to the chain of binary nodes, printed and pretty printed the same") {
+        PTR(Expr) e = parse_str("1 + 2 * x * 4 + 5");
+        CHECK(e->equals(chain));
+        CHECK(chain->equals(e));
+        CHECK(e->to_string() == chain->to_string());
+        CHECK(e->to_pretty_string() == chain->to_pretty_string());
+        CHECK_FALSE(e->equals(parse_str("1 + 2 * x * 4 + 6")));
+        CHECK_FALSE(e->equals(parse_str("1 + 2 * x * 4")));
+        CHECK_FALSE(e->equals(parse_str("(1 + 2 * x * 4) + 5")));
+        CHECK(load_ast(emit_ast(e).data(), emit_ast(e).size())->equals(e));
+
+        PTR(Expr) let = parse_str("_let x = 1 _in x + x + _let y = 2 _in y * y * y");
+        CHECK(let->to_string() == "(_let x = 1 _in (x + (x + (_let y = 2 _in (y * (y * y))))))");
+        CHECK(let->to_pretty_string() == "_let x = 1\n  _in  x + x + _let y = 2\n                _in  y * y * y");
+        PTR(Expr) nested = parse_str("(_let a = 1 _in a * a * a) * 2 * 3 + 4");
+        CHECK(nested->to_string() == "(((_let a = 1 _in (a * (a * a))) * (2 * 3)) + 4)");
+        CHECK(nested->to_pretty_string() == "(_let a = 1\n  _in  a * a * a) * 2 * 3 + 4");
+        CHECK(parse_str("(1 + 2 + 3) * 4 * (5 + 6 + 7)")->to_pretty_string() == "(1 + 2 + 3) * 4 * (5 + 6 + 7)");
+    }
+
+    SECTION("evaluated in a loop, with the errors the binary nodes give") {
+        CHECK(parse_str("_let x = 3 _in 1 + 2 * x * 4 + 5")->interp(Env::empty)->to_string() == "30");
+        CHECK_THROWS_WITH(parse_str("1 + _true + 2")->interp(Env::empty), "Cannot add bool");
+        CHECK_THROWS_WITH(parse_str("1 + 2 + _true")->interp(Env::empty), "You can't add a non-number!");
+        CHECK_THROWS_WITH(parse_str("_true + 1 + y")->interp(Env::empty), "free variable: y");
+        CHECK_THROWS_WITH(parse_str("2 * 3 * _false * 4")->interp(Env::empty), "Cannot mult bool");
+        CHECK_THROWS_WITH(parse_str("2 * 3 * _false")->interp(Env::empty), "You can't mult a non-number!");
+        CHECK(parse_str("_let f = _fun (x) x _in 1 + f(2) + 3")->interp(Env::empty)->to_string() == "6");
+    }
+
+    SECTION("type checked and batch compiled") {
+        PTR(Expr) e = parse_str("_let a = 1 _in _let b = 3 _in a + b * b * 2 + 1");
+        CHECK(mark_typed(e));
+        CHECK(e->interp(Env::empty)->to_string() == "20");
+        e = CAST(Let)(CAST(Let)(e)->bodyExpr)->bodyExpr;
+        CHECK(e->statically_typed);
+        CHECK_THROWS_WITH(infer_type(parse_str("1 + 2 + _true")), Catch::Contains("type error"));
+        vector<string> names;
+        names.push_back("a");
+        names.push_back("b");
+        BatchEval batch(parse_str("a + b * b * 2 + 1"), names);
+        CHECK(batch.vectorized());
+        int a[] = { 1, 2 };
+        int b[] = { 3, -1 };
+        vector<const int *> columns;
+        columns.push_back(a);
+        columns.push_back(b);
+        int out[2];
+        CHECK(batch.run(columns, 2, out) == batch_num);
+        CHECK(out[0] == 20);
+        CHECK(out[1] == 5);
+    }
+
+    SECTION("long generated sums do not recurse per term") {
+        string source = "0";
+        string product = "1";
+        for (int i = 1; i <= 20000; i++) {
+            source += " + " + std::to_string(i % 7);
+            product += " * 1";
+        }
+        PTR(Expr) e = parse_str(source);
+        CHECK(CAST(Sum)(e)->operands.size() == 20001);
+        int expected = 0;
+        for (int i = 1; i <= 20000; i++) {
+            expected += i % 7;
+        }
+        CHECK(e->interp(Env::empty)->to_string() == std::to_string(expected));
+        CHECK(e->equals(parse_str(source)));
+        CHECK(e->to_string().size() == 4 * 20000 + 1 + 2 * 20000);
+        CHECK(parse_str(product)->interp(Env::empty)->to_string() == "1");
+    }
+}
+
+TEST_CASE("Execution trace") {
+    string source = "_let x = 2\n_in  x + 3";
+    PTR(Expr) e = parse_str(source);
+
+    SECTION("disabled") {
+        trace_start(16);
+        trace_stop();
+        e->interp(Env::empty);
+        CHECK(trace_total() == 0);
+    }
+
+    SECTION("one event at each start and end") {
+        trace_start(64);
+        e->interp(Env::empty);
+        trace_stop();
+        //Let, Num, Add, Var, Num, each entered and left
+        CHECK(trace_total() == 10);
+        ostringstream text;
+        trace_dump_text(text, source);
+        CHECK(text.str() ==
+              "# msdscript trace: last 10 of 10 events\n"
+              "0 0 > Let @1:1\n"
+              "1 1   > Num @1:10\n"
+              "2 1   < Num @1:10 num\n"
+              "3 1   > Add @2:6\n"
+              "4 2     > Var @2:6\n"
+              "5 2     < Var @2:6 num\n"
+              "6 2     > Num @2:10\n"
+              "7 2     < Num @2:10 num\n"
+              "8 1   < Add @2:6 num\n"
+              "9 0 < Let @1:1 num\n");
+        ostringstream offsets;
+        trace_dump_text(offsets);
+        CHECK(offsets.str().find("> Add @+16\n") != string::npos);
+    }
+
+    SECTION("the ring keeps the most recent events") {
+        trace_start(4);
+        e->interp(Env::empty);
+        trace_stop();
+        CHECK(trace_total() == 10);
+        ostringstream text;
+        trace_dump_text(text, source);
+        CHECK(text.str() ==
+              "# msdscript trace: last 4 of 10 events\n"
+              "6 2     > Num @2:10\n"
+              "7 2     < Num @2:10 num\n"
+              "8 1   < Add @2:6 num\n"
+              "9 0 < Let @1:1 num\n");
+    }
+
+    SECTION("values and exceptions") {
+        trace_start(64);
+        parse_str("_fun (x) x")->interp(Env::empty);
+        CHECK_THROWS(parse_str("_if 1 == 1 _then 1 + _true _else 0")->interp(Env::empty));
+        trace_stop();
+        ostringstream text;
+        trace_dump_text(text);
+        string dump = text.str();
+        CHECK(dump.find("< FunExpr @+0 fun\n") != string::npos);
+        CHECK(dump.find("< EqExpr @+4 bool\n") != string::npos);
+        CHECK(dump.find("< BoolExpr @+21 bool\n") != string::npos);
+        CHECK(dump.find("< Add @+17 threw\n") != string::npos);
+        CHECK(dump.find("< IfExpr @+0 threw\n") != string::npos);
+    }
+
+    SECTION("binary") {
+        trace_start(4);
+        e->interp(Env::empty);
+        trace_stop();
+        ostringstream out;
+        trace_dump_binary(out);
+        string bytes = out.str();
+        CHECK(bytes.size() == 4 + 1 + 4 + 8 + 4 * 8);
+        CHECK(bytes.substr(0, 4) == "MSDT");
+        CHECK(bytes[4] == 1);
+        CHECK(bytes[5] == 4);
+        CHECK(bytes[9] == 6);
+        //The first kept event: Num at offset 20, depth 2, entered
+        CHECK(bytes[17] == 20);
+        CHECK(bytes[21] == 2);
+        CHECK(bytes[23] == prof_num);
+        CHECK(bytes[24] == trace_enter);
+    }
+    trace_stop();
+}
+
+TEST_CASE("Prepared programs") {
+    vector<string> inputs;
+    inputs.push_back("x");
+    inputs.push_back("y");
+
+    SECTION("runs with new inputs each time") {
+        PreparedProgram p("_let z = x * x _in _if z == y _then z + 1 _else z * 2", inputs);
+        CHECK(p.typed());
+        CHECK(p.inputs() == inputs);
+        vector<int> args;
+        args.push_back(7);
+        args.push_back(49);
+        CHECK(p.run_int(args) == 50);
+        args[1] = 0;
+        CHECK(p.run_int(args) == 98);
+        args[0] = -3;
+        CHECK(p.run(args)->to_string() == "18");
+        CHECK_THROWS_WITH(p.run(vector<int>(1, 3)), "Expected 2 inputs, got 1");
+    }
+
+    SECTION("results that hold the inputs are left alone") {
+        PreparedProgram same("x", inputs);
+        vector<int> args(2, 1);
+        PTR(Val) first = same.run(args);
+        args[0] = 2;
+        PTR(Val) second = same.run(args);
+        CHECK(first->to_string() == "1");
+        CHECK(second->to_string() == "2");
+
+        PreparedProgram adder("_fun (n) n + x", inputs, false);
+        CHECK(!adder.typed());
+        args[0] = 10;
+        PTR(Val) add10 = adder.run(args);
+        args[0] = 20;
+        PTR(Val) add20 = adder.run(args);
+        CHECK(add10->call(NEW(NumVal)(1))->to_string() == "11");
+        CHECK(add20->call(NEW(NumVal)(1))->to_string() == "21");
+    }
+
+    SECTION("ill-typed and failing programs") {
+        PreparedProgram p("_if x == 1 _then y _else _true", inputs);
+        CHECK(!p.typed());
+        vector<int> args(2, 5);
+        CHECK(p.run(args)->to_string() == "1");
+        args[0] = 1;
+        CHECK(p.run_int(args) == 5);
+        CHECK_THROWS_WITH(PreparedProgram("x + ", inputs), "Invalid Input!");
+        PreparedProgram unbound("x + w", inputs);
+        CHECK_THROWS(unbound.run(args));
+        CHECK_THROWS_WITH(PreparedProgram("x == y", inputs).run_int(args), "The program did not return a number");
+    }
+
+    SECTION("no allocation for the frame once it exists") {
+        PreparedProgram p("x + y", inputs);
+        vector<int> args(2, 1);
+        p.run(args);
+        unsigned long frames = stats_counts[stats_frame_env].total;
+        unsigned long vals = stats_counts[stats_num_val].total;
+        for (int i = 0; i < 10; i++) {
+            args[0] = i;
+            CHECK(p.run_int(args) == i + 1);
+        }
+        //Only the sums are new
+        CHECK(stats_counts[stats_frame_env].total == frames);
+        CHECK(stats_counts[stats_num_val].total == vals + 10);
+    }
+
+    SECTION("threads running their own programs share no state") {
+        //Each run leaves a _letrec cycle behind, so both threads' collectors run while the other allocates
+        const char *source = "_letrec f = _fun (n) _if n == 0 _then x _else f(n + -1) _in (_fun (z) z * y)(f(5))";
+        PreparedProgram first(source, inputs);
+        PreparedProgram second(source, inputs);
+        int failures[2] = { 0, 0 };
+        size_t tracked = gc_stats.tracked;
+        //A budget here would stop both threads at once if it were shared
+        eval_limits_t limits = { 1, 0, 0 };
+        EvalBudget budget(limits);
+        auto work = [&failures](PreparedProgram *p, int y) {
+            vector<int> args(2, y);
+            for (int i = 0; i < 20000; i++) {
+                args[0] = i;
+                try {
+                    if (p->run_int(args) != i * y) {
+                        failures[y - 1]++;
+                    }
+                } catch (runtime_error &) {
+                    failures[y - 1]++;
+                }
+            }
+        };
+        std::thread a(work, &first, 1);
+        std::thread b(work, &second, 2);
+        a.join();
+        b.join();
+        CHECK(failures[0] == 0);
+        CHECK(failures[1] == 0);
+        //Nothing was made on this thread
+        CHECK(gc_stats.tracked == tracked);
+    }
+}
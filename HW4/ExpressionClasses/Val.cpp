@@ -5,12 +5,24 @@
 #include "Val.h"
 #include "Expr.h"
 #include "pointer.h"
+#include "profile.h"
+
+//Print Val to a stream through one buffer
+void Val::print(ostream &ostream){
+    string out;
+    this->print_to(out);
+    ostream.write(out.data(), out.size());
+}
 
 //String Val to String
 string Val::to_string(){
-    stringstream stream("");
-    this->print(stream);
-    return stream.str();
+    string out;
+    this->print_to(out);
+    return out;
+}
+
+PTR(Val) Val::call_with(vector<PTR(Val)> actual_args) {
+    return call(actual_args[0]);
 }
 
 NumVal::NumVal(int i) {
@@ -21,7 +33,7 @@ PTR(Expr) NumVal::to_expr() {
     return NEW(Num)(this->val);
 }
 
-bool NumVal::equals(PTR(Val) v) {
+bool NumVal::equals(const PTR(Val) &v) {
     //Insert implementation
     PTR(NumVal) numPointer = CAST(NumVal)(v);
     if (numPointer == nullptr){
@@ -30,22 +42,22 @@ bool NumVal::equals(PTR(Val) v) {
     return this->val == numPointer ->val;
 }
 
-PTR(Val) NumVal::add_to(PTR(Val) other_val) {
+PTR(Val) NumVal::add_to(const PTR(Val) &other_val) {
     //Insert implementation
     PTR(NumVal) other_num = CAST(NumVal)(other_val);
     if (other_num == NULL) throw runtime_error("You can't add a non-number!");
     return NEW(NumVal)(other_num->val + this->val);
 }
 
-PTR(Val) NumVal::mult_with(PTR(Val) other_val) {
+PTR(Val) NumVal::mult_with(const PTR(Val) &other_val) {
     //Insert implementation
     PTR(NumVal) other_num = CAST(NumVal)(other_val);
     if(other_num == NULL) throw runtime_error("You can't mult a non-number!");
     return NEW(NumVal)(this->val * other_num->val);
 }
 
-void NumVal::print(std::ostream &ostream) {
-    ostream <<::to_string(val);
+void NumVal::print_to(string &out) {
+    append_int(out, val);
 }
 
 //NumVal is_true throws error
@@ -53,7 +65,7 @@ void NumVal::is_true(){
     throw runtime_error("Error!");
 }
 
-PTR(Val) NumVal::call(PTR(Val) actualArg){
+PTR(Val) NumVal::call(const PTR(Val) &actualArg){
     throw runtime_error("Cannot call NumVal!");
 }
 
@@ -66,7 +78,7 @@ PTR(Expr) BoolVal::to_expr() {
     return NEW(BoolExpr)(this->val);
 }
 
-bool BoolVal::equals(PTR(Val) v){
+bool BoolVal::equals(const PTR(Val) &v){
     PTR(BoolVal) boolPointer = CAST(BoolVal)(v);
 
     if (boolPointer == nullptr){
@@ -75,23 +87,23 @@ bool BoolVal::equals(PTR(Val) v){
     return this-> val == boolPointer->val;
 }
 
-PTR(Val) BoolVal::add_to(PTR(Val) other_val) {
+PTR(Val) BoolVal::add_to(const PTR(Val) &other_val) {
     throw runtime_error("Cannot add bool");
 }
 
-PTR(Val) BoolVal::mult_with(PTR(Val) other_val) {
+PTR(Val) BoolVal::mult_with(const PTR(Val) &other_val) {
     throw runtime_error("Cannot mult bool");
 }
 
-void BoolVal::print(ostream &ostream){
-    ostream <<::to_string(val);
+void BoolVal::print_to(string &out){
+    out += val ? '1' : '0';
 }
 
 bool BoolVal::is_true(){
     return val;
 }
 
-PTR(Val) BoolVal::call(PTR(Val) actualArg){
+PTR(Val) BoolVal::call(const PTR(Val) &actualArg){
     throw runtime_error("Cannot call BoolVal");
 }
 
@@ -99,40 +111,173 @@ FunVal::FunVal(string formalarg, PTR(Expr) body, PTR(Env) env){
     if (env == nullptr){
         env = Env::empty;
     }
-    this->formalarg = formalarg;
-    this->body = body;
+    this->formalargs = std::make_shared<const vector<string> >(1, std::move(formalarg));
+    this->body = std::move(body);
+    this->env = std::move(env);
+}
+
+FunVal::FunVal(vector<string> formalargs, PTR(Expr) body, PTR(Env) env){
+    if (env == nullptr){
+        env = Env::empty;
+    }
+    this->formalargs = std::make_shared<const vector<string> >(std::move(formalargs));
+    this->body = std::move(body);
+    this->env = std::move(env);
+}
+
+FunVal::FunVal(std::shared_ptr<const vector<string> > formalargs, PTR(Expr) body, PTR(Env) env){
+    if (env == nullptr){
+        env = Env::empty;
+    }
+    this->formalargs = std::move(formalargs);
+    this->body = std::move(body);
+    this->env = std::move(env);
 }
 
 PTR(Expr) FunVal::to_expr(){
-    return NEW(FunExpr)(this->formalarg, this->body);
+    return NEW(FunExpr)(*this->formalargs, this->body);
 }
 
-bool FunVal::equals (PTR(Val) v){
+bool FunVal::equals(const PTR(Val) &v){
     PTR(FunVal) funPtr = CAST(FunVal)(v);
     if (funPtr == nullptr){
         return false;
     }
-    return this->formalarg == funPtr->formalarg && this->body->equals(funPtr->body);
+    return *this->formalargs == *funPtr->formalargs && this->body->equals(funPtr->body);
 }
 
-PTR(Val) FunVal::add_to(PTR(Val) other_val) {
+PTR(Val) FunVal::add_to(const PTR(Val) &other_val) {
     throw runtime_error("Cannot add function!");
 }
-PTR(Val) FunVal::mult_with(PTR(Val) other_val) {
+PTR(Val) FunVal::mult_with(const PTR(Val) &other_val) {
     throw runtime_error("Cannot multiply function!");
 }
-void FunVal::print(ostream &ostream){
+void FunVal::print_to(string &out){
 }
 
 bool FunVal::is_true(){
     return false;
 }
-PTR(Val) FunVal::call(PTR(Val) actualArg) {
+//Thrown when a function is called with the wrong number of arguments
+static void arity_error(size_t expected, size_t given) {
+    throw runtime_error("Function takes " + std::to_string(expected) + " argument" + (expected == 1 ? "" : "s")
+                        + ", not " + std::to_string(given) + "!");
+}
+
+PTR(Val) FunVal::call(const PTR(Val) &actualArg) {
+    if (formalargs->size() != 1) {
+        arity_error(formalargs->size(), 1);
+    }
+    //Every object is owned by a shared_ptr here, so this is a safe point to collect
+    gc_maybe_collect();
+    const string &formalarg = (*formalargs)[0];
+    StackFrame frame(body.get(), "_fun", formalarg, span.start);
     PTR(Env) newEnv = NEW(ExtendedEnv)(formalarg, actualArg, env);
     // Interpret the body of the function with the extended environment
     return body->interp(newEnv);
 }
 
+/**
+ * \brief Calls the function with all its arguments bound in a single FrameEnv.
+ * \param actual_args One value per formal argument.
+ * \return The value of the body.
+ */
+PTR(Val) FunVal::call_with(vector<PTR(Val)> actual_args) {
+    if (actual_args.size() == 1) {
+        return call(actual_args[0]);
+    }
+    if (formalargs->size() != actual_args.size()) {
+        arity_error(formalargs->size(), actual_args.size());
+    }
+    gc_maybe_collect();
+    StackFrame frame(body.get(), "_fun", (*formalargs)[0], span.start);
+    PTR(Env) newEnv = NEW(FrameEnv)(formalargs, std::move(actual_args), env);
+    return body->interp(newEnv);
+}
 
+std::shared_ptr<void> FunVal::gc_self() {
+    return shared_from_this();
+}
+
+void FunVal::gc_edges(std::vector<GcNode *> &out) {
+    GcNode *n = dynamic_cast<GcNode *>(env.get());
+    if (n != nullptr) {
+        out.push_back(n);
+    }
+}
+
+void FunVal::gc_clear() {
+    env = nullptr;
+}
 
+//ThunkVal
+THREAD_STATE bool lazy_let = false;
 
+ThunkVal::ThunkVal(PTR(Expr) expr, PTR(Env) env) {
+    this->expr = std::move(expr);
+    this->env = std::move(env);
+}
+
+/**
+ * \brief Evaluates the right-hand side the first time, then returns the same value.
+ * \return The value of expr in env.
+ */
+PTR(Val) ThunkVal::force() {
+    if (expr != nullptr) {
+        //interp() takes the environment by reference, and a nested force() may clear this one
+        PTR(Env) scope = env;
+        value = expr->interp(scope);
+        //Nothing else needs them, and dropping them lets the environment go
+        expr = nullptr;
+        env = nullptr;
+    }
+    return value;
+}
+
+PTR(Expr) ThunkVal::to_expr() {
+    return force()->to_expr();
+}
+
+bool ThunkVal::equals(const PTR(Val) &v) {
+    return force()->equals(forced(v));
+}
+
+PTR(Val) ThunkVal::add_to(const PTR(Val) &other_val) {
+    return force()->add_to(forced(other_val));
+}
+
+PTR(Val) ThunkVal::mult_with(const PTR(Val) &other_val) {
+    return force()->mult_with(forced(other_val));
+}
+
+void ThunkVal::print_to(string &out) {
+    force()->print_to(out);
+}
+
+PTR(Val) ThunkVal::call(const PTR(Val) &actualArg) {
+    return force()->call(actualArg);
+}
+
+PTR(Val) ThunkVal::call_with(vector<PTR(Val)> actual_args) {
+    return force()->call_with(std::move(actual_args));
+}
+
+std::shared_ptr<void> ThunkVal::gc_self() {
+    return shared_from_this();
+}
+
+void ThunkVal::gc_edges(std::vector<GcNode *> &out) {
+    GcNode *n = dynamic_cast<GcNode *>(env.get());
+    if (n != nullptr) {
+        out.push_back(n);
+    }
+    n = dynamic_cast<GcNode *>(value.get());
+    if (n != nullptr) {
+        out.push_back(n);
+    }
+}
+
+void ThunkVal::gc_clear() {
+    env = nullptr;
+    value = nullptr;
+}
@@ -7,63 +7,114 @@
 
 #include <stdio.h>
 #include <string>
+#include <vector>
+#include <typeinfo>
 #include "pointer.h"
 #include "Env.h"
+#include "Expr.h"
+#include "stats.h"
 
 using namespace std;
 class Expr;
 
 CLASS(Val) {
 public:
-    virtual bool equals (PTR(Val) v)= 0;
+    virtual bool equals(const PTR(Val) &v)= 0;
     virtual PTR(Expr) to_expr()= 0;
-    virtual PTR(Val) add_to(PTR(Val) other_val) = 0;
-    virtual PTR(Val) mult_with(PTR(Val) other_val) = 0;
-    virtual void print(ostream &ostream) = 0;
-    virtual PTR(Val) call(PTR(Val) actual_arg)=0;
+    virtual PTR(Val) add_to(const PTR(Val) &other_val) = 0;
+    virtual PTR(Val) mult_with(const PTR(Val) &other_val) = 0;
+    virtual void print_to(string &out) = 0;
+    virtual PTR(Val) call(const PTR(Val) &actual_arg)=0;
+    //Calls with several arguments; anything but a function fails the way call() does
+    virtual PTR(Val) call_with(vector<PTR(Val)> actual_args);
+    void print(ostream &ostream);
     string to_string();
 };
 
-class NumVal : public Val{
+class NumVal : public Val, private Counted<stats_num_val, NumVal> {
 public:
     int val;
     NumVal(int i);
     virtual PTR(Expr) to_expr();
-    virtual bool equals(PTR(Val) v);
-    virtual PTR(Val) add_to(PTR(Val) other_val);
-    virtual PTR(Val) mult_with(PTR(Val) other_val);
-    virtual void print (ostream &ostream);
+    virtual bool equals(const PTR(Val) &v);
+    virtual PTR(Val) add_to(const PTR(Val) &other_val);
+    virtual PTR(Val) mult_with(const PTR(Val) &other_val);
+    virtual void print_to(string &out);
     void is_true();
-    PTR(Val) call(PTR(Val) actualarg);
+    PTR(Val) call(const PTR(Val) &actualarg);
 };
 
-class BoolVal : public Val {
+class BoolVal : public Val, private Counted<stats_bool_val, BoolVal> {
 public:
     bool val;
     BoolVal(bool b);
     virtual PTR(Expr) to_expr();
-    virtual bool equals (PTR(Val) v);
-    virtual PTR(Val) add_to(PTR(Val) other_val);
-    virtual PTR(Val) mult_with(PTR(Val) other_val);
-    virtual void print (ostream &ostream);
+    virtual bool equals(const PTR(Val) &v);
+    virtual PTR(Val) add_to(const PTR(Val) &other_val);
+    virtual PTR(Val) mult_with(const PTR(Val) &other_val);
+    virtual void print_to(string &out);
     virtual bool is_true();
-    PTR(Val) call(PTR(Val) actualArg);
+    PTR(Val) call(const PTR(Val) &actualArg);
 };
 
-class FunVal : public Val {
+class FunVal : public Val, public GcNode, private Counted<stats_fun_val, FunVal> {
 public:
-    string formalarg;
+    std::shared_ptr<const vector<string> > formalargs;  //shared with the _fun that made this closure
     PTR(Expr) body;
     PTR(Env) env;
+    source_span_t span = { -1, -1 };    //of the _fun that made this closure, if it was parsed
 
     FunVal(string formal_arg, PTR(Expr) body, PTR(Env) env = nullptr);
+    FunVal(vector<string> formal_args, PTR(Expr) body, PTR(Env) env = nullptr);
+    FunVal(std::shared_ptr<const vector<string> > formal_args, PTR(Expr) body, PTR(Env) env = nullptr);
     PTR(Expr) to_expr();
-    virtual bool equals (PTR(Val) v);
-    virtual PTR(Val) add_to(PTR(Val) other_val);
-    virtual PTR(Val) mult_with(PTR(Val) other_val);
-    void print(ostream &ostream);
+    virtual bool equals(const PTR(Val) &v);
+    virtual PTR(Val) add_to(const PTR(Val) &other_val);
+    virtual PTR(Val) mult_with(const PTR(Val) &other_val);
+    virtual void print_to(string &out);
     virtual bool is_true();
-    PTR(Val) call(PTR(Val) actualarg);
+    PTR(Val) call(const PTR(Val) &actualarg);
+    PTR(Val) call_with(vector<PTR(Val)> actual_args);
+    std::shared_ptr<void> gc_self();
+    void gc_edges(std::vector<GcNode *> &out);
+    void gc_clear();
+};
+
+/**
+ * \brief The right-hand side of a _let that has not been evaluated yet.
+ * With --lazy, Let binds one of these instead of a value. Var::interp forces
+ * it the first time the variable is used and every later use gets the same
+ * value, so a binding the body never uses costs nothing.
+ */
+class ThunkVal : public Val, public GcNode, private Counted<stats_thunk_val, ThunkVal> {
+public:
+    PTR(Expr) expr;     //nullptr once forced
+    PTR(Env) env;
+    PTR(Val) value;
+
+    ThunkVal(PTR(Expr) expr, PTR(Env) env);
+    PTR(Val) force();
+    PTR(Expr) to_expr();
+    virtual bool equals(const PTR(Val) &v);
+    virtual PTR(Val) add_to(const PTR(Val) &other_val);
+    virtual PTR(Val) mult_with(const PTR(Val) &other_val);
+    virtual void print_to(string &out);
+    PTR(Val) call(const PTR(Val) &actualarg);
+    PTR(Val) call_with(vector<PTR(Val)> actual_args);
+    std::shared_ptr<void> gc_self();
+    void gc_edges(std::vector<GcNode *> &out);
+    void gc_clear();
 };
 
+//Set by --lazy: Let binds a ThunkVal instead of evaluating its right-hand side; per thread
+extern THREAD_STATE bool lazy_let;
+
+//The value v stands for, forcing it first if it is a ThunkVal
+inline PTR(Val) forced(PTR(Val) v) {
+    if (lazy_let && typeid(*v) == typeid(ThunkVal)) {
+        return static_cast<ThunkVal *>(v.get())->force();
+    }
+    return v;
+}
+
 #endif //EXPRESSIONCLASSES_VAL_H
@@ -0,0 +1,298 @@
+/**
+ * \file batch.cpp
+ * \brief Compiling expressions to column operations, and the kernels that run them.
+ */
+
+#include "batch.h"
+#include "Val.h"
+#include "Env.h"
+
+#include <typeinfo>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+//Rows per block; one register of this many ints stays in the L1 cache
+static const size_t BATCH_BLOCK = 1024;
+
+/**
+ * \brief Compiles e for the given columns, if it can be compiled.
+ * \param e The expression; its free variables should all be column names.
+ * \param columns The name bound to each input column, in the order run() takes them.
+ */
+BatchEval::BatchEval(PTR(Expr) e, const vector<string> &columns) {
+    this->expr = e;
+    this->names = columns;
+    this->registers = 0;
+    this->result = 0;
+    this->kind = batch_num;
+    vector<binding_t> scope;
+    compiled = compile(e, scope, result, kind);
+    if (!compiled) {
+        code.clear();
+        //run_rows() binds each column in a frame of its own, the first one outermost
+        frames_t frames;
+        for (size_t i = 0; i < columns.size(); i++) {
+            frames.push_back(vector<string>(1, columns[i]));
+        }
+        e->resolve(frames);
+    }
+}
+
+bool BatchEval::vectorized() {
+    return compiled;
+}
+
+size_t BatchEval::emit(op_t op, int value, size_t a, size_t b, size_t c) {
+    instr_t in = { op, value, registers++, a, b, c };
+    code.push_back(in);
+    return in.dst;
+}
+
+/**
+ * \brief Appends the operations for e, or returns false if e is not one this can run.
+ * \param e The subexpression.
+ * \param scope The _let names in scope, innermost last.
+ * \param reg Set to the register that holds e's value.
+ * \param kind Set to whether that value is a number or a boolean.
+ * \return False for a node type it does not handle, or an operation that could fail.
+ */
+bool BatchEval::compile(PTR(Expr) e, vector<binding_t> &scope, size_t &reg, batch_kind_t &kind) {
+    if (PTR(Num) num = CAST(Num)(e)) {
+        reg = emit(op_const, num->val);
+        kind = batch_num;
+        return true;
+    }
+    if (PTR(BoolExpr) b = CAST(BoolExpr)(e)) {
+        reg = emit(op_const, b->val ? 1 : 0);
+        kind = batch_bool;
+        return true;
+    }
+    if (PTR(Var) var = CAST(Var)(e)) {
+        for (size_t i = scope.size(); i > 0; i--) {
+            if (scope[i - 1].name == var->name) {
+                reg = scope[i - 1].reg;
+                kind = scope[i - 1].kind;
+                return true;
+            }
+        }
+        //The innermost binding of a repeated column name is the last one
+        for (size_t i = names.size(); i > 0; i--) {
+            if (names[i - 1] == var->name) {
+                reg = emit(op_column, (int) (i - 1));
+                kind = batch_num;
+                return true;
+            }
+        }
+        return false;
+    }
+    size_t lhs, rhs, cond;
+    batch_kind_t lhs_kind, rhs_kind, cond_kind;
+    if (PTR(Add) add = CAST(Add)(e)) {
+        if (!compile(add->lhs, scope, lhs, lhs_kind) || !compile(add->rhs, scope, rhs, rhs_kind)
+            || lhs_kind != batch_num || rhs_kind != batch_num) {
+            return false;
+        }
+        reg = emit(op_add, 0, lhs, rhs);
+        kind = batch_num;
+        return true;
+    }
+    if (PTR(Mult) mult = CAST(Mult)(e)) {
+        if (!compile(mult->lhs, scope, lhs, lhs_kind) || !compile(mult->rhs, scope, rhs, rhs_kind)
+            || lhs_kind != batch_num || rhs_kind != batch_num) {
+            return false;
+        }
+        reg = emit(op_mult, 0, lhs, rhs);
+        kind = batch_num;
+        return true;
+    }
+    if (PTR(Sum) sum = CAST(Sum)(e)) {
+        return compile_chain(op_add, sum->operands, scope, reg, kind);
+    }
+    if (PTR(Product) product = CAST(Product)(e)) {
+        return compile_chain(op_mult, product->operands, scope, reg, kind);
+    }
+    if (PTR(EqExpr) eq = CAST(EqExpr)(e)) {
+        if (!compile(eq->lhs, scope, lhs, lhs_kind) || !compile(eq->rhs, scope, rhs, rhs_kind)) {
+            return false;
+        }
+        //A number never equals a boolean
+        reg = lhs_kind == rhs_kind ? emit(op_eq, 0, lhs, rhs) : emit(op_const, 0);
+        kind = batch_bool;
+        return true;
+    }
+    if (PTR(IfExpr) ifExpr = CAST(IfExpr)(e)) {
+        if (!compile(ifExpr->if_, scope, cond, cond_kind)) {
+            return false;
+        }
+        if (cond_kind != batch_bool) {
+            //interp() takes the _else branch for anything but _true
+            return compile(ifExpr->else_, scope, reg, kind);
+        }
+        if (!compile(ifExpr->then_, scope, lhs, lhs_kind) || !compile(ifExpr->else_, scope, rhs, rhs_kind)
+            || lhs_kind != rhs_kind) {
+            return false;
+        }
+        reg = emit(op_select, 0, lhs, rhs, cond);
+        kind = lhs_kind;
+        return true;
+    }
+    if (PTR(Let) let = CAST(Let)(e)) {
+        binding_t binding;
+        binding.name = let->lhs;
+        if (!compile(let->rhs, scope, binding.reg, binding.kind)) {
+            return false;
+        }
+        scope.push_back(binding);
+        bool ok = compile(let->bodyExpr, scope, reg, kind);
+        scope.pop_back();
+        return ok;
+    }
+    return false;
+}
+
+//A Sum or Product becomes one op per operand after the first, folding left; wrapping arithmetic
+//makes that the same as the right-leaning chain it stands for
+bool BatchEval::compile_chain(op_t op, const vector<PTR(Expr)> &operands, vector<binding_t> &scope, size_t &reg,
+                              batch_kind_t &kind) {
+    size_t next;
+    batch_kind_t next_kind;
+    if (!compile(operands[0], scope, reg, kind) || kind != batch_num) {
+        return false;
+    }
+    for (size_t i = 1; i < operands.size(); i++) {
+        if (!compile(operands[i], scope, next, next_kind) || next_kind != batch_num) {
+            return false;
+        }
+        reg = emit(op, 0, reg, next);
+    }
+    return true;
+}
+
+/**
+ * \brief Evaluates the expression for every row.
+ * \param columns One array of rows values per column name given to the constructor.
+ * \param rows The number of rows.
+ * \param out Receives one value per row.
+ * \return Whether the values are numbers or booleans.
+ * Throws runtime_error if a row fails, or if rows give values of different kinds or a function.
+ */
+batch_kind_t BatchEval::run(const vector<const int *> &columns, size_t rows, int *out) {
+    if (columns.size() != names.size()) {
+        throw runtime_error("Expected " + std::to_string(names.size()) + " columns, not "
+                            + std::to_string(columns.size()) + "!");
+    }
+    return compiled ? run_compiled(columns, rows, out) : run_rows(columns, rows, out);
+}
+
+/****************KERNELS****************/
+//Each kernel runs a whole block: a fixed trip count and no aliasing between dst and the inputs let
+//an optimizing build vectorize the loop without a scalar tail or run-time overlap checks.
+//Arithmetic wraps through unsigned so that every lane is well defined.
+static void kernel_add(const int *__restrict a, const int *__restrict b, int *__restrict dst) {
+    for (size_t i = 0; i < BATCH_BLOCK; i++) {
+        dst[i] = (int) ((unsigned int) a[i] + (unsigned int) b[i]);
+    }
+}
+
+static void kernel_mult(const int *__restrict a, const int *__restrict b, int *__restrict dst) {
+    for (size_t i = 0; i < BATCH_BLOCK; i++) {
+        dst[i] = (int) ((unsigned int) a[i] * (unsigned int) b[i]);
+    }
+}
+
+static void kernel_eq(const int *__restrict a, const int *__restrict b, int *__restrict dst) {
+    for (size_t i = 0; i < BATCH_BLOCK; i++) {
+        dst[i] = a[i] == b[i];
+    }
+}
+
+//Blends with the condition as a mask instead of branching per row
+static void kernel_select(const int *__restrict cond, const int *__restrict a, const int *__restrict b,
+                          int *__restrict dst) {
+    for (size_t i = 0; i < BATCH_BLOCK; i++) {
+        int mask = -cond[i];
+        dst[i] = (a[i] & mask) | (b[i] & ~mask);
+    }
+}
+
+batch_kind_t BatchEval::run_compiled(const vector<const int *> &columns, size_t rows, int *out) {
+    vector<int> scratch(registers * BATCH_BLOCK);
+    vector<const int *> regs(registers);
+    for (size_t i = 0; i < code.size(); i++) {
+        const instr_t &in = code[i];
+        int *dst = &scratch[in.dst * BATCH_BLOCK];
+        regs[in.dst] = dst;
+        if (in.op == op_const) {
+            for (size_t j = 0; j < BATCH_BLOCK; j++) {
+                dst[j] = in.value;
+            }
+        }
+    }
+    for (size_t start = 0; start < rows; start += BATCH_BLOCK) {
+        size_t n = rows - start < BATCH_BLOCK ? rows - start : BATCH_BLOCK;
+        for (size_t i = 0; i < code.size(); i++) {
+            const instr_t &in = code[i];
+            int *dst = &scratch[in.dst * BATCH_BLOCK];
+            switch (in.op) {
+                case op_const:
+                    break;
+                case op_column:
+                    if (n == BATCH_BLOCK) {
+                        regs[in.dst] = columns[in.value] + start;
+                    } else {
+                        //The last, partial block is copied so the kernels never read past the column
+                        std::copy(columns[in.value] + start, columns[in.value] + rows, dst);
+                        std::fill(dst + n, dst + BATCH_BLOCK, 0);
+                        regs[in.dst] = dst;
+                    }
+                    break;
+                case op_add:
+                    kernel_add(regs[in.a], regs[in.b], dst);
+                    break;
+                case op_mult:
+                    kernel_mult(regs[in.a], regs[in.b], dst);
+                    break;
+                case op_eq:
+                    kernel_eq(regs[in.a], regs[in.b], dst);
+                    break;
+                case op_select:
+                    kernel_select(regs[in.c], regs[in.a], regs[in.b], dst);
+                    break;
+            }
+        }
+        const int *value = regs[result];
+        for (size_t j = 0; j < n; j++) {
+            out[start + j] = value[j];
+        }
+    }
+    return kind;
+}
+
+//The general path: one interp() per row, with the row's values bound in an ExtendedEnv chain
+batch_kind_t BatchEval::run_rows(const vector<const int *> &columns, size_t rows, int *out) {
+    batch_kind_t rows_kind = batch_num;
+    for (size_t row = 0; row < rows; row++) {
+        PTR(Env) env = Env::empty;
+        for (size_t i = 0; i < names.size(); i++) {
+            env = NEW(ExtendedEnv)(names[i], NEW(NumVal)(columns[i][row]), env);
+        }
+        PTR(Val) v = expr->interp(env);
+        batch_kind_t row_kind;
+        if (typeid(*v) == typeid(NumVal)) {
+            out[row] = static_cast<NumVal *>(v.get())->val;
+            row_kind = batch_num;
+        } else if (typeid(*v) == typeid(BoolVal)) {
+            out[row] = static_cast<BoolVal *>(v.get())->val ? 1 : 0;
+            row_kind = batch_bool;
+        } else {
+            throw runtime_error("Batch rows must give numbers or booleans, not " + v->to_string() + "!");
+        }
+        if (row > 0 && row_kind != rows_kind) {
+            throw runtime_error("Batch rows must all give numbers or all give booleans!");
+        }
+        rows_kind = row_kind;
+    }
+    return rows_kind;
+}
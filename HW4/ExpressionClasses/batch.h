@@ -0,0 +1,88 @@
+/**
+ * \file batch.h
+ * \brief Evaluating one expression over many rows of integer inputs at once.
+ *
+ * BatchEval takes an expression and the names of its input columns. Each row
+ * binds every name to that row's number, and the result for the row is what
+ * interp() would give with those bindings. When the expression uses only
+ * numbers, booleans, variables, +, *, ==, _if and _let, and no operation in it
+ * could fail, it is compiled to a short list of column operations. run() then
+ * evaluates a block of rows at a time, so each operation is one tight loop
+ * over plain int arrays that the compiler can turn into SIMD instructions. _if
+ * evaluates both branches and picks between them with the condition as a mask,
+ * which is safe because neither branch can fail.
+ *
+ * Anything else is run row by row through interp(), with the same results and
+ * errors; vectorized() tells which happened. The compiled path makes no Val or
+ * Env objects, so an EvalBudget does not apply to it.
+ */
+
+#ifndef EXPRESSIONCLASSES_BATCH_H
+#define EXPRESSIONCLASSES_BATCH_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include "pointer.h"
+#include "Expr.h"
+
+typedef enum {
+    batch_num,
+    batch_bool      //written to the output as 0 and 1
+} batch_kind_t;
+
+/**
+ * \brief One expression compiled for evaluation over columns of inputs.
+ */
+class BatchEval {
+public:
+    BatchEval(PTR(Expr) e, const std::vector<std::string> &columns);
+
+    //Whether run() uses the compiled column operations instead of interp()
+    bool vectorized();
+    //Evaluates rows [0, rows); columns[i] holds the values of the i'th name
+    batch_kind_t run(const std::vector<const int *> &columns, size_t rows, int *out);
+
+private:
+    typedef enum {
+        op_const,
+        op_column,
+        op_add,
+        op_mult,
+        op_eq,
+        op_select
+    } op_t;
+
+    //dst = a op b, or dst = c ? a : b for op_select; value is the constant or the column index
+    typedef struct {
+        op_t op;
+        int value;
+        size_t dst;
+        size_t a;
+        size_t b;
+        size_t c;
+    } instr_t;
+
+    typedef struct {
+        std::string name;
+        size_t reg;
+        batch_kind_t kind;
+    } binding_t;
+
+    PTR(Expr) expr;
+    std::vector<std::string> names;
+    bool compiled;
+    std::vector<instr_t> code;
+    size_t registers;
+    size_t result;
+    batch_kind_t kind;
+
+    bool compile(PTR(Expr) e, std::vector<binding_t> &scope, size_t &reg, batch_kind_t &kind);
+    bool compile_chain(op_t op, const std::vector<PTR(Expr)> &operands, std::vector<binding_t> &scope, size_t &reg,
+                       batch_kind_t &kind);
+    size_t emit(op_t op, int value, size_t a = 0, size_t b = 0, size_t c = 0);
+    batch_kind_t run_compiled(const std::vector<const int *> &columns, size_t rows, int *out);
+    batch_kind_t run_rows(const std::vector<const int *> &columns, size_t rows, int *out);
+};
+
+#endif //EXPRESSIONCLASSES_BATCH_H
@@ -0,0 +1,328 @@
+/**
+ * \file bench.cpp
+ * \brief msdscript_bench: timing and allocation counts for parse, interp, print and pretty print.
+ *
+ * Every workload is generated from a size, so two builds run exactly the same
+ * programs and their numbers can be compared line by line. Each phase is
+ * repeated until it has run for at least the minimum time, and the report
+ * gives the mean ns, heap allocations and heap bytes per run. Workloads that
+ * pass type inference are interpreted again after mark_typed(), as "typed".
+ * batch_100k scores one expression over 100000 rows of inputs, once with an
+ * interp() per row ("rows") and once through BatchEval ("batch"). formula
+ * parses and runs an embedded formula the way a service would at run time
+ * ("interp"), through msd::eval() ("msd_eval"), and as a PreparedProgram
+ * compiled once outside the loop ("prepared").
+ *
+ * Usage: msdscript_bench [--csv] [--min-ms <ms>] [name filter]
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <new>
+#include "Expr.h"
+#include "Val.h"
+#include "Env.h"
+#include "parse.hpp"
+#include "pointer.h"
+#include "typecheck.h"
+#include "batch.h"
+#include "constexpr_eval.h"
+#include "prepared.h"
+
+using namespace std;
+
+/****************ALLOCATION COUNTING****************/
+static unsigned long long alloc_count = 0;
+static unsigned long long alloc_bytes = 0;
+
+void *operator new(size_t size) {
+    alloc_count++;
+    alloc_bytes += size;
+    void *p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+/****************WORKLOADS****************/
+typedef struct {
+    string name;
+    string source;
+} workload_t;
+
+//Variable names are letters only, so i becomes xa, xb, ..., xba, ...
+static string var_name(int i) {
+    string digits;
+    do {
+        digits.insert(digits.begin(), (char) ('a' + i % 26));
+        i /= 26;
+    } while (i > 0);
+    return "x" + digits;
+}
+
+//_let xa = 1 _in _let xb = xa + 1 _in ...
+static string let_chain(int depth) {
+    string s;
+    for (int i = 0; i < depth; i++) {
+        s += "_let " + var_name(i) + " = ";
+        s += i == 0 ? "1" : var_name(i - 1) + " + 1";
+        s += " _in ";
+    }
+    return s + var_name(depth - 1);
+}
+
+//1 + 2 + ... + n
+static string long_sum(int terms) {
+    string s = "1";
+    for (int i = 2; i <= terms; i++) {
+        s += " + " + std::to_string(i);
+    }
+    return s;
+}
+
+//Recursion through self-application
+static string fib(int n) {
+    return "_let fib = _fun (fib) _fun (n) _if n == 0 _then 0 _else _if n == 1 _then 1"
+           " _else fib(fib)(n + -1) + fib(fib)(n + -2)"
+           " _in fib(fib)(" + std::to_string(n) + ")";
+}
+
+//The same function bound with _letrec
+static string fib_letrec(int n) {
+    return "_letrec fib = _fun (n) _if n == 0 _then 0 _else _if n == 1 _then 1"
+           " _else fib(n + -1) + fib(n + -2)"
+           " _in fib(" + std::to_string(n) + ")";
+}
+
+//A loop over three arguments, passed one at a time through nested closures
+static string loop_curried(int n) {
+    return "_letrec loop = _fun (n) _fun (a) _fun (b) _if n == 0 _then a + b"
+           " _else loop(n + -1)(a + 1)(b + 2)"
+           " _in loop(" + std::to_string(n) + ")(0)(0)";
+}
+
+//The same loop as one three-argument function
+static string loop_multiarg(int n) {
+    return "_letrec loop = _fun (n, a, b) _if n == 0 _then a + b"
+           " _else loop(n + -1, a + 1, b + 2)"
+           " _in loop(" + std::to_string(n) + ", 0, 0)";
+}
+
+//A full binary tree of _if with the given depth; only one path is taken
+static string if_tree(int depth, int &leaf) {
+    if (depth == 0) {
+        return std::to_string(leaf++);
+    }
+    string lhs = if_tree(depth - 1, leaf);
+    string rhs = if_tree(depth - 1, leaf);
+    return "(_if " + std::to_string(leaf) + " == " + std::to_string(leaf) + " _then " + lhs + " _else " + rhs + ")";
+}
+
+//Nested lets, products, functions and calls, to exercise pretty_print's indentation and parentheses
+static string pretty_input(int size) {
+    string s = "0";
+    for (int i = size; i > 0; i--) {
+        string v = var_name(i);
+        s = "_let " + v + " = (_fun (y) y * " + std::to_string(i) + ")(" + std::to_string(i) + ") * 2"
+            + " _in (" + v + " + " + s + ") * 1";
+    }
+    return s;
+}
+
+static vector<workload_t> workloads() {
+    vector<workload_t> all;
+    workload_t w;
+    int leaf = 0;
+    w.name = "let_chain_200";
+    w.source = let_chain(200);
+    all.push_back(w);
+    w.name = "long_sum_2000";
+    w.source = long_sum(2000);
+    all.push_back(w);
+    w.name = "fib_15";
+    w.source = fib(15);
+    all.push_back(w);
+    w.name = "fib_letrec_15";
+    w.source = fib_letrec(15);
+    all.push_back(w);
+    w.name = "loop_curry_500";
+    w.source = loop_curried(500);
+    all.push_back(w);
+    w.name = "loop_multi_500";
+    w.source = loop_multiarg(500);
+    all.push_back(w);
+    w.name = "if_tree_10";
+    w.source = if_tree(10, leaf);
+    all.push_back(w);
+    w.name = "pretty_100";
+    w.source = pretty_input(100);
+    all.push_back(w);
+    return all;
+}
+
+/****************TIMING****************/
+typedef struct {
+    double ns;
+    double allocs;
+    double bytes;
+} result_t;
+
+//Runs op until min_ns have passed (and at least 3 times) and averages over the runs
+template <class Op>
+static result_t measure(Op op, long long min_ns) {
+    op();   //warm up
+    unsigned long long allocs = alloc_count;
+    unsigned long long bytes = alloc_bytes;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    long long ns = 0;
+    long runs = 0;
+    while (runs < 3 || ns < min_ns) {
+        op();
+        runs++;
+        ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    }
+    result_t r = { (double) ns / runs, (double) (alloc_count - allocs) / runs, (double) (alloc_bytes - bytes) / runs };
+    return r;
+}
+
+static void report(bool csv, const string &workload, const char *phase, const result_t &r) {
+    if (csv) {
+        cout << workload << "," << phase << "," << (long long) r.ns << "," << (long long) r.allocs << ","
+             << (long long) r.bytes << "\n";
+    } else {
+        cout << left << setw(16) << workload << setw(8) << phase << right << fixed << setprecision(0)
+             << setw(14) << r.ns << setw(14) << r.allocs << setw(14) << r.bytes << "\n";
+    }
+}
+
+//One expression over many rows, the way a bulk scoring job runs it
+static int bench_batch(bool csv, const char *filter, long long min_ns) {
+    const string name = "batch_100k";
+    if (filter != nullptr && name.find(filter) == string::npos) {
+        return 0;
+    }
+    const size_t rows = 100000;
+    vector<int> xs(rows), ys(rows), by_row(rows), batched(rows);
+    for (size_t i = 0; i < rows; i++) {
+        xs[i] = (int) (i % 1000);
+        ys[i] = (int) (i % 37) - 18;
+    }
+    vector<string> names;
+    names.push_back("x");
+    names.push_back("y");
+    vector<const int *> columns;
+    columns.push_back(xs.data());
+    columns.push_back(ys.data());
+    PTR(Expr) e = parse_str("_if y == 0 _then x _else x * 3 + y * y");
+
+    report(csv, name, "rows", measure([&]() {
+        for (size_t i = 0; i < rows; i++) {
+            PTR(Env) env = NEW(ExtendedEnv)("y", NEW(NumVal)(ys[i]), NEW(ExtendedEnv)("x", NEW(NumVal)(xs[i]), Env::empty));
+            by_row[i] = CAST(NumVal)(e->interp(env))->val;
+        }
+    }, min_ns));
+    BatchEval batch(e, names);
+    report(csv, name, "batch", measure([&]() { batch.run(columns, rows, batched.data()); }, min_ns));
+    if (!batch.vectorized() || by_row != batched) {
+        cerr << name << ": batch results differ from interp\n";
+        return 1;
+    }
+    return 0;
+}
+
+//A formula kept as a string literal, with one input known only at run time
+static void bench_formula(bool csv, const char *filter, long long min_ns) {
+    const string name = "formula";
+    if (filter != nullptr && name.find(filter) == string::npos) {
+        return;
+    }
+    static volatile int input = 7;
+    int sink = 0;
+    report(csv, name, "interp", measure([&]() {
+        PTR(Expr) e = parse_str("_let y = x * x _in _if y == 49 _then y + 1 _else y * 2");
+        PTR(Val) v = e->interp(NEW(ExtendedEnv)("x", NEW(NumVal)(input), Env::empty));
+        sink += CAST(NumVal)(v)->val;
+    }, min_ns));
+    report(csv, name, "msd_eval", measure([&]() {
+        sink += msd::eval("_let y = x * x _in _if y == 49 _then y + 1 _else y * 2", msd::var("x", input)).as_int();
+    }, min_ns));
+    PreparedProgram prepared("_let y = x * x _in _if y == 49 _then y + 1 _else y * 2", vector<string>(1, "x"));
+    vector<int> args(1);
+    report(csv, name, "prepared", measure([&]() {
+        args[0] = input;
+        sink += prepared.run_int(args);
+    }, min_ns));
+    if (sink == 0) {
+        cerr << name << ": no result\n";
+    }
+}
+
+int main(int argc, char **argv) {
+    bool csv = false;
+    long long min_ns = 200 * 1000000LL;
+    const char *filter = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--csv") == 0) {
+            csv = true;
+        } else if (strcmp(argv[i], "--min-ms") == 0 && i + 1 < argc) {
+            min_ns = atoll(argv[++i]) * 1000000LL;
+        } else if (argv[i][0] != '-') {
+            filter = argv[i];
+        } else {
+            cerr << "Usage: msdscript_bench [--csv] [--min-ms <ms>] [name filter]\n";
+            return 1;
+        }
+    }
+
+    if (csv) {
+        cout << "workload,phase,ns_per_op,allocs_per_op,bytes_per_op\n";
+    } else {
+        cout << left << setw(16) << "workload" << setw(8) << "phase" << right
+             << setw(14) << "ns/op" << setw(14) << "allocs/op" << setw(14) << "bytes/op" << "\n";
+    }
+
+    vector<workload_t> all = workloads();
+    for (size_t i = 0; i < all.size(); i++) {
+        const workload_t &w = all[i];
+        if (filter != nullptr && w.name.find(filter) == string::npos) {
+            continue;
+        }
+        PTR(Expr) e = parse_str(w.source);
+        //Checked once up front so a broken interpreter fails here instead of timing an exception
+        string expected = e->interp(Env::empty)->to_string();
+
+        report(csv, w.name, "parse", measure([&]() { parse_str(w.source); }, min_ns));
+        report(csv, w.name, "interp", measure([&]() { e->interp(Env::empty); }, min_ns));
+        PTR(Expr) typed = parse_str(w.source);
+        if (mark_typed(typed)) {
+            report(csv, w.name, "typed", measure([&]() { typed->interp(Env::empty); }, min_ns));
+            if (typed->interp(Env::empty)->to_string() != expected) {
+                cerr << w.name << ": fast paths changed the result\n";
+                return 1;
+            }
+        }
+        report(csv, w.name, "print", measure([&]() { e->to_string(); }, min_ns));
+        report(csv, w.name, "pretty", measure([&]() { e->to_pretty_string(); }, min_ns));
+
+        if (e->interp(Env::empty)->to_string() != expected) {
+            cerr << w.name << ": result changed between runs\n";
+            return 1;
+        }
+    }
+    bench_formula(csv, filter, min_ns);
+    return bench_batch(csv, filter, min_ns);
+}
@@ -0,0 +1,39 @@
+/**
+ * \file budget.cpp
+ * \brief State for the limits declared in budget.h.
+ */
+
+#include "budget.h"
+
+using namespace std;
+
+THREAD_STATE bool budget_active = false;
+THREAD_STATE eval_limits_t budget_limits = { 0, 0, 0 };
+THREAD_STATE eval_usage_t budget_usage = { 0, 0, 0 };
+
+/**
+ * \brief Throws the error for a limit that has just been passed.
+ * \param kind Which limit it was.
+ */
+void budget_over(budget_kind_t kind) {
+    switch (kind) {
+        case budget_fuel:
+            throw BudgetExceeded(kind, "out of fuel after " + std::to_string(budget_limits.fuel) + " steps!");
+        case budget_bytes:
+            throw BudgetExceeded(kind, "memory limit of " + std::to_string(budget_limits.max_bytes) + " bytes exceeded!");
+        case budget_depth:
+        default:
+            throw BudgetExceeded(kind, "recursion deeper than " + std::to_string(budget_limits.max_depth) + " levels!");
+    }
+}
+
+EvalBudget::EvalBudget(const eval_limits_t &limits) {
+    budget_limits = limits;
+    eval_usage_t unused = { 0, 0, 0 };
+    budget_usage = unused;
+    budget_active = limits.fuel != 0 || limits.max_bytes != 0 || limits.max_depth != 0;
+}
+
+EvalBudget::~EvalBudget() {
+    budget_active = false;
+}
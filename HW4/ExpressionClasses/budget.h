@@ -0,0 +1,105 @@
+/**
+ * \file budget.h
+ * \brief Step, memory and depth limits for interpreting untrusted programs.
+ *
+ * While an EvalBudget is alive, every interp() call spends one step of fuel and
+ * counts toward the nesting depth, and every Val and Env created is charged its
+ * size in bytes. Going over any limit throws BudgetExceeded, which unwinds the
+ * interpreter like any other runtime_error. With no EvalBudget alive the hooks
+ * only test budget_active. The budget state is per thread, so an EvalBudget
+ * limits only what its own thread interprets.
+ */
+
+#ifndef EXPRESSIONCLASSES_BUDGET_H
+#define EXPRESSIONCLASSES_BUDGET_H
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include "pointer.h"
+
+//0 means no limit
+typedef struct {
+    unsigned long long fuel;        //interp() calls
+    unsigned long long max_bytes;   //bytes of objects created, never given back
+    unsigned long max_depth;        //interp() calls nested inside each other
+} eval_limits_t;
+
+typedef struct {
+    unsigned long long steps;
+    unsigned long long bytes;
+    unsigned long depth;
+} eval_usage_t;
+
+typedef enum {
+    budget_fuel,
+    budget_bytes,
+    budget_depth
+} budget_kind_t;
+
+/**
+ * \brief Thrown when a program uses more than its budget allows.
+ */
+class BudgetExceeded : public std::runtime_error {
+public:
+    BudgetExceeded(budget_kind_t kind, const std::string &message) : std::runtime_error(message) {
+        this->kind = kind;
+    }
+    budget_kind_t kind;
+};
+
+extern THREAD_STATE bool budget_active;
+extern THREAD_STATE eval_limits_t budget_limits;
+extern THREAD_STATE eval_usage_t budget_usage;
+
+void budget_over(budget_kind_t kind);
+
+/**
+ * \brief Applies limits to everything interpreted during its lifetime.
+ * Budgets do not nest; the usage starts from zero each time one is made.
+ */
+class EvalBudget {
+public:
+    explicit EvalBudget(const eval_limits_t &limits);
+    ~EvalBudget();
+};
+
+/**
+ * \brief Spends one step and one level of depth for an interp() call.
+ */
+class EvalStep {
+public:
+    EvalStep() {
+        active = budget_active;
+        if (active) {
+            budget_usage.steps++;
+            if (budget_limits.fuel != 0 && budget_usage.steps > budget_limits.fuel) {
+                budget_over(budget_fuel);
+            }
+            if (budget_limits.max_depth != 0 && budget_usage.depth >= budget_limits.max_depth) {
+                budget_over(budget_depth);
+            }
+            budget_usage.depth++;
+        }
+    }
+    ~EvalStep() {
+        if (active) {
+            budget_usage.depth--;
+        }
+    }
+
+private:
+    bool active;
+};
+
+//Charges a newly created object to the running budget
+inline void budget_charge(size_t bytes) {
+    if (budget_active) {
+        budget_usage.bytes += bytes;
+        if (budget_limits.max_bytes != 0 && budget_usage.bytes > budget_limits.max_bytes) {
+            budget_over(budget_bytes);
+        }
+    }
+}
+
+#endif //EXPRESSIONCLASSES_BUDGET_H
@@ -0,0 +1,160 @@
+/**
+ * \file cache.cpp
+ * \brief Reading and writing cache entries described in cache.h.
+ */
+
+#include "cache.h"
+#include "serialize.h"
+#include "parse.hpp"
+#include "Expr.h"
+
+#include <cstring>
+#include <cstdio>
+#include <errno.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+
+using namespace std;
+
+static const char CACHE_MAGIC[4] = {'M', 'S', 'D', 'C'};
+//Magic, key, source length and checksum; the source text follows, then the AST
+static const size_t CACHE_HEADER_SIZE = sizeof(CACHE_MAGIC) + 3 * sizeof(uint64_t);
+
+//64-bit FNV-1a, continuing from hash
+static uint64_t fnv1a(const char *data, size_t size, uint64_t hash = 14695981039346656037ull) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (unsigned char) data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static uint64_t cache_key(const string &source) {
+    uint64_t hash = fnv1a(CACHE_VERSION, strlen(CACHE_VERSION) + 1);
+    char version = (char) AST_VERSION;
+    hash = fnv1a(&version, 1, hash);
+    return fnv1a(source.data(), source.size(), hash);
+}
+
+static void put_u64(string &out, uint64_t n) {
+    for (int i = 0; i < 8; i++) {
+        out += (char) (n >> (8 * i));
+    }
+}
+
+static uint64_t get_u64(const char *data) {
+    uint64_t n = 0;
+    for (int i = 0; i < 8; i++) {
+        n |= (uint64_t) (unsigned char) data[i] << (8 * i);
+    }
+    return n;
+}
+
+/**
+ * \brief The file that holds the cache entry for a program.
+ * \param source The program text.
+ * \param cache_dir The cache directory.
+ * \return The path of the entry, whether or not it exists yet.
+ */
+string cache_path(const string &source, const string &cache_dir) {
+    static const char hex[] = "0123456789abcdef";
+    uint64_t key = cache_key(source);
+    string name(16, '0');
+    for (int i = 15; i >= 0; i--) {
+        name[i] = hex[key & 0xf];
+        key >>= 4;
+    }
+    return cache_dir + "/" + name + ".ast";
+}
+
+//Loads an entry, or returns nullptr if it is missing or fails any check
+static PTR(Expr) load_entry(const string &path, const string &source) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t) info.st_size <= CACHE_HEADER_SIZE) {
+        close(fd);
+        return nullptr;
+    }
+    size_t size = (size_t) info.st_size;
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return nullptr;
+    }
+
+    const char *data = (const char *) mapped;
+    PTR(Expr) e = nullptr;
+    if (size - CACHE_HEADER_SIZE > source.size()
+        && memcmp(data, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0
+        && get_u64(data + 4) == cache_key(source)
+        && get_u64(data + 12) == source.size()
+        && memcmp(data + CACHE_HEADER_SIZE, source.data(), source.size()) == 0) {
+        const char *payload = data + CACHE_HEADER_SIZE + source.size();
+        size_t payload_size = size - CACHE_HEADER_SIZE - source.size();
+        if (get_u64(data + 20) == fnv1a(payload, payload_size)) {
+            try {
+                e = load_ast(payload, payload_size);
+            } catch (runtime_error &) {
+                e = nullptr;
+            }
+        }
+    }
+    munmap(mapped, size);
+    return e;
+}
+
+//Writes an entry through a temporary file; a failure only means the next run misses again
+static void store_entry(const string &path, const string &source, PTR(Expr) e) {
+    string payload = emit_ast(e);
+    string bytes(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    put_u64(bytes, cache_key(source));
+    put_u64(bytes, source.size());
+    put_u64(bytes, fnv1a(payload.data(), payload.size()));
+    bytes += source;
+    bytes += payload;
+
+    string tmp = path + ".tmp." + std::to_string(getpid());
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return;
+    }
+    size_t done = 0;
+    while (done < bytes.size()) {
+        ssize_t len = write(fd, bytes.data() + done, bytes.size() - done);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        done += (size_t) len;
+    }
+    if (close(fd) != 0 || done != bytes.size() || rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+    }
+}
+
+/**
+ * \brief Parses a program, reusing the cached parse from an earlier run when there is one.
+ * \param source The program text.
+ * \param cache_dir The cache directory. It is created if it does not exist.
+ * \return The parsed program. Parse errors are thrown as from parse_str().
+ */
+PTR(Expr) parse_cached(const string &source, const string &cache_dir) {
+    string path = cache_path(source, cache_dir);
+    PTR(Expr) e = load_entry(path, source);
+    if (e != nullptr) {
+        return e;
+    }
+    e = parse_str(source);
+    mkdir(cache_dir.c_str(), 0755);
+    store_entry(path, source, e);
+    return e;
+}
@@ -0,0 +1,30 @@
+/**
+ * \file cache.h
+ * \brief On-disk cache of parsed programs, keyed by a hash of their source.
+ *
+ * Each entry is one file in the cache directory named after the hash of the
+ * source text and CACHE_VERSION. It holds a small header (the key, the source
+ * length and a checksum of the AST), the source text itself and then the
+ * binary AST from serialize.h. An entry is only used if its source matches the
+ * program byte for byte, so two programs whose hashes collide, or an entry
+ * planted under another program's name, are never mixed up. Entries
+ * are written to a temporary file and renamed into place, so concurrent
+ * writers never expose a partial file. Entries that fail any check are treated
+ * as misses and rewritten.
+ */
+
+#ifndef EXPRESSIONCLASSES_CACHE_H
+#define EXPRESSIONCLASSES_CACHE_H
+
+#include <string>
+#include "pointer.h"
+
+class Expr;
+
+//Change whenever parsing or the cached form changes, so old entries are never reused
+const char *const CACHE_VERSION = "msdscript-2";
+
+std::string cache_path(const std::string &source, const std::string &cache_dir);
+PTR(Expr) parse_cached(const std::string &source, const std::string &cache_dir);
+
+#endif //EXPRESSIONCLASSES_CACHE_H
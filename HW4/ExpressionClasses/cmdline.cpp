@@ -4,10 +4,35 @@
 //#define CATCH_CONFIG_RUNNER
 
 #include "cmdline.h"
+#include <cstdlib>
 
 
 using namespace std;
 
+run_options_t run_options = { nullptr, nullptr, false, false, nullptr, { 0, 0, 0 }, false, false, nullptr, nullptr, false };
+
+//Returns the value after an option like --cache-dir, or exits if it is missing
+static const char *option_value(int argc, char **argv, int &i) {
+    if (i + 1 >= argc) {
+        std::cerr << argv[i] << " needs a value!\n";
+        exit(1);
+    }
+    return argv[++i];
+}
+
+//Reads the positive number after an option like --fuel, or exits if it is not one
+static unsigned long long option_count(int argc, char **argv, int &i) {
+    const char *flag = argv[i];
+    const char *value = option_value(argc, argv, i);
+    char *end;
+    unsigned long long n = strtoull(value, &end, 10);
+    if (*value < '0' || *value > '9' || *end != '\0' || n == 0) {
+        std::cerr << flag << " needs a positive number!\n";
+        exit(1);
+    }
+    return n;
+}
+
 run_mode_t use_arguments(int argc, char **argv) {
     //Set the testTextSeen to false
     bool testTextSeen = false;
@@ -15,28 +40,89 @@ run_mode_t use_arguments(int argc, char **argv) {
 
     //Loop through
     for (int i = 1; i < argc; i++) {
-        if (strcmp(argv[1], "--help") == 0) {
+        if (strcmp(argv[i], "--help") == 0) {
             std::cout << "--Test: Tests the code.\n";
             std::cout << "--Help: Check your options.\n";
             std::cout << "--Print: Print.\n";
             std::cout << "--Prettyprint: Runs pretty_print_at().\n";
+            std::cout << "--emit-ast <file>: Parses stdin and saves it as a binary AST.\n";
+            std::cout << "--load-ast <file>: Interprets a saved binary AST.\n";
+            std::cout << "--cache-dir <dir>: Reuses parsed programs saved in <dir>.\n";
+            std::cout << "--serve: Runs many programs sent over stdin as framed requests (see serve.h).\n";
+            std::cout << "--profile: Reports time per phase and per node type on stderr.\n";
+            std::cout << "--stats: Reports object counts and lookup depths on stderr as JSON.\n";
+            std::cout << "--profile-stacks <file>: Writes time per _let and _fun call stack as folded stacks.\n";
+            std::cout << "--fuel <steps>: Stops interpreting after this many steps.\n";
+            std::cout << "--max-bytes <n>: Stops interpreting after allocating this many bytes of values.\n";
+            std::cout << "--max-depth <n>: Stops interpreting when calls nest this deep.\n";
+            std::cout << "--typecheck: Rejects a program that has no static type before running it.\n";
+            std::cout << "--lazy: Evaluates each _let right-hand side only when the body first uses it.\n";
+            std::cout << "--map <file.csv>: Evaluates stdin once per row of the file, with each column bound to its name; booleans print as 1 and 0.\n";
+            std::cout << "--trace <file>: Records recent interp() calls and writes them to <file> on an error or SIGUSR1.\n";
+            std::cout << "--trace-binary <file>: Like --trace, in the compact binary form (see trace.h).\n";
             exit(0);
         }
-        else if (strcmp(argv[1], "--test") == 0) {
+        else if (strcmp(argv[i], "--test") == 0) {
             if (!testTextSeen) {
                mode = do_tests;
 //                return do_tests;
                 testTextSeen = true;
             }
         }
-        else if (strcmp(argv[1], "--interp") == 0) {
-            return do_interp;
+        else if (strcmp(argv[i], "--interp") == 0) {
+            mode = do_interp;
+        }
+        else if (strcmp(argv[i], "--print") == 0) {
+            mode = do_print;
+        }
+        else if (strcmp(argv[i], "--prettyprint") == 0) {
+            mode = do_pretty_print;
+        }
+        else if (strcmp(argv[i], "--emit-ast") == 0) {
+            mode = do_emit_ast;
+            run_options.ast_file = option_value(argc, argv, i);
+        }
+        else if (strcmp(argv[i], "--load-ast") == 0) {
+            mode = do_load_ast;
+            run_options.ast_file = option_value(argc, argv, i);
+        }
+        else if (strcmp(argv[i], "--serve") == 0) {
+            mode = do_serve;
+        }
+        else if (strcmp(argv[i], "--map") == 0) {
+            mode = do_map;
+            run_options.map_file = option_value(argc, argv, i);
+        }
+        else if (strcmp(argv[i], "--cache-dir") == 0) {
+            run_options.cache_dir = option_value(argc, argv, i);
+        }
+        else if (strcmp(argv[i], "--profile") == 0) {
+            run_options.profile = true;
+        }
+        else if (strcmp(argv[i], "--stats") == 0) {
+            run_options.stats = true;
+        }
+        else if (strcmp(argv[i], "--typecheck") == 0) {
+            run_options.typecheck = true;
+        }
+        else if (strcmp(argv[i], "--lazy") == 0) {
+            run_options.lazy = true;
+        }
+        else if (strcmp(argv[i], "--profile-stacks") == 0) {
+            run_options.stacks_file = option_value(argc, argv, i);
+        }
+        else if (strcmp(argv[i], "--fuel") == 0) {
+            run_options.limits.fuel = option_count(argc, argv, i);
+        }
+        else if (strcmp(argv[i], "--max-bytes") == 0) {
+            run_options.limits.max_bytes = option_count(argc, argv, i);
         }
-        else if (strcmp(argv[1], "--print") == 0) {
-            return do_print;
+        else if (strcmp(argv[i], "--max-depth") == 0) {
+            run_options.limits.max_depth = (unsigned long) option_count(argc, argv, i);
         }
-        else if (strcmp(argv[1], "--prettyprint") == 0) {
-            return do_pretty_print;
+        else if (strcmp(argv[i], "--trace") == 0 || strcmp(argv[i], "--trace-binary") == 0) {
+            run_options.trace_binary = strcmp(argv[i], "--trace-binary") == 0;
+            run_options.trace_file = option_value(argc, argv, i);
         }
         else {
             //For anything else that is entered in
@@ -8,6 +8,7 @@
 #include "catch.h"
 #include <cstring>
 #include <iostream>
+#include "budget.h"
 
 typedef enum {
     do_tests,
@@ -16,8 +17,29 @@ typedef enum {
     do_interp,
     do_print,
     do_pretty_print,
+    do_emit_ast,
+    do_load_ast,
+    do_serve,
+    do_map,
 } run_mode_t;
 
+//Settings given alongside the mode, filled in by use_arguments()
+typedef struct {
+    const char *ast_file;   //--emit-ast / --load-ast <file>
+    const char *cache_dir;  //--cache-dir <dir>, or nullptr for no cache
+    bool profile;           //--profile
+    bool stats;             //--stats
+    const char *stacks_file;    //--profile-stacks <file>, or nullptr
+    eval_limits_t limits;       //--fuel, --max-bytes and --max-depth; 0 for no limit
+    bool typecheck;             //--typecheck
+    bool lazy;                  //--lazy
+    const char *map_file;       //--map <file.csv>
+    const char *trace_file;     //--trace / --trace-binary <file>, or nullptr
+    bool trace_binary;          //--trace-binary
+} run_options_t;
+
+extern run_options_t run_options;
+
 run_mode_t use_arguments(int argc, char **argv);
 
 
@@ -0,0 +1,366 @@
+/**
+ * \file constexpr_eval.h
+ * \brief Header-only constexpr parser and evaluator for fixed msdscript formulas.
+ *
+ * msd::eval() parses and evaluates the number and boolean subset of msdscript
+ * (numbers, variables, _true, _false, +, *, ==, _let and _if) straight from a
+ * string, with no Expr tree, no Val objects and no heap allocation:
+ *
+ *     constexpr msd::value v = msd::eval("_let x = 5 _in x * x");   //folded by the compiler
+ *     int y = msd::eval("x * 3 + 1", msd::var("x", n)).as_int();    //n known only at run time
+ *
+ * A formula whose inputs are all constants is a constant expression, so it is
+ * evaluated at build time and a syntax or type error in it is a compile error.
+ * With run-time variables the same functions run as ordinary inline code.
+ *
+ * Results and error messages are the ones parse_str()->interp() gives. Errors
+ * travel as values while parsing, so an error in an _if branch that is not
+ * taken is discarded just as interp() never reaches it, and the error that
+ * wins is the one interp() would hit first. Syntax errors are thrown as soon
+ * as they are found. _fun, calls and _letrec are not part of the subset.
+ *
+ * It is written in the C++11 form of constexpr (one return statement per
+ * function), so each nested expression, digit and space is a level of
+ * recursion; compilers allow a few hundred levels in a constant expression by
+ * default, which is plenty for formulas but not for generated programs.
+ */
+
+#ifndef EXPRESSIONCLASSES_CONSTEXPR_EVAL_H
+#define EXPRESSIONCLASSES_CONSTEXPR_EVAL_H
+
+#include <cstddef>
+#include <string>
+#include <stdexcept>
+
+namespace msd {
+
+/**
+ * \brief The value of a formula: a number, a boolean, or an error not yet thrown.
+ */
+class value {
+public:
+    enum kind_t {
+        num_kind,
+        bool_kind,
+        error_kind
+    };
+
+    kind_t kind;
+    int num;                //the number, or 0 and 1 for a boolean
+    const char *message;    //error_kind
+    const char *name;       //error_kind: the variable a "free variable: " error is about
+    size_t name_len;
+
+    constexpr value(kind_t kind, int num, const char *message = nullptr, const char *name = nullptr,
+                    size_t name_len = 0)
+            : kind(kind), num(num), message(message), name(name), name_len(name_len) {
+    }
+
+    constexpr bool is_num() const {
+        return kind == num_kind;
+    }
+
+    constexpr bool is_bool() const {
+        return kind == bool_kind;
+    }
+
+    constexpr int as_int() const {
+        return kind == num_kind ? num : throw std::runtime_error("Not a number!");
+    }
+
+    constexpr bool as_bool() const {
+        return kind == bool_kind ? num != 0 : throw std::runtime_error("Not a boolean!");
+    }
+};
+
+/**
+ * \brief A variable bound for a formula; make one with msd::var().
+ */
+struct binding {
+    const char *name;
+    size_t len;
+    int num;
+};
+
+template <size_t N>
+constexpr binding var(const char (&name)[N], int num) {
+    return binding{ name, N - 1, num };
+}
+
+namespace detail {
+
+struct source {
+    const char *s;
+    size_t n;
+};
+
+//A _let or msd::var() binding; the chain ends with a node whose name is nullptr
+struct env {
+    const char *name;
+    size_t len;
+    value v;
+    const env *rest;
+};
+
+struct result {
+    value v;
+    size_t pos;     //just past what was parsed
+};
+
+constexpr value number(int n) {
+    return value(value::num_kind, n);
+}
+
+constexpr value boolean(bool b) {
+    return value(value::bool_kind, b ? 1 : 0);
+}
+
+constexpr value error(const char *message, const char *name = "", size_t name_len = 0) {
+    return value(value::error_kind, 0, message, name, name_len);
+}
+
+constexpr char at(const source &src, size_t i) {
+    return i < src.n ? src.s[i] : '\0';
+}
+
+constexpr bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+constexpr bool is_alpha(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+constexpr bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+constexpr size_t skip(const source &src, size_t pos) {
+    return is_space(at(src, pos)) ? skip(src, pos + 1) : pos;
+}
+
+constexpr size_t alpha_end(const source &src, size_t pos) {
+    return is_alpha(at(src, pos)) ? alpha_end(src, pos + 1) : pos;
+}
+
+constexpr bool same_chars(const char *a, const char *b, size_t n) {
+    return n == 0 || (a[0] == b[0] && same_chars(a + 1, b + 1, n - 1));
+}
+
+template <size_t N>
+constexpr bool word_is(const source &src, size_t start, size_t end, const char (&word)[N]) {
+    return end - start == N - 1 && same_chars(src.s + start, word, N - 1);
+}
+
+//Where a keyword like "_then" ends, or a syntax error if it is not there
+template <size_t N>
+constexpr size_t expect_word(const source &src, size_t pos, const char (&word)[N]) {
+    return pos + N - 1 <= src.n && same_chars(src.s + pos, word, N - 1)
+           ? pos + N - 1 : throw std::runtime_error("consume mismatch");
+}
+
+constexpr value lookup(const env &e, const char *name, size_t len) {
+    return e.name == nullptr ? error("free variable: ", name, len)
+           : e.len == len && same_chars(e.name, name, len) ? e.v
+           : lookup(*e.rest, name, len);
+}
+
+//The same checks, in the same order, as NumVal/BoolVal add_to() and mult_with()
+constexpr value add(value l, value r) {
+    return l.kind == value::error_kind ? l
+           : r.kind == value::error_kind ? r
+           : l.kind == value::bool_kind ? error("Cannot add bool")
+           : r.kind == value::bool_kind ? error("You can't add a non-number!")
+           : number((int) ((unsigned int) l.num + (unsigned int) r.num));
+}
+
+constexpr value mult(value l, value r) {
+    return l.kind == value::error_kind ? l
+           : r.kind == value::error_kind ? r
+           : l.kind == value::bool_kind ? error("Cannot mult bool")
+           : r.kind == value::bool_kind ? error("You can't mult a non-number!")
+           : number((int) ((unsigned int) l.num * (unsigned int) r.num));
+}
+
+//EqExpr evaluates its right-hand side first
+constexpr value equal(value l, value r) {
+    return r.kind == value::error_kind ? r
+           : l.kind == value::error_kind ? l
+           : boolean(l.kind == r.kind && l.num == r.num);
+}
+
+//Anything but _true takes the _else branch
+constexpr value choose(value cond, value then_, value else_) {
+    return cond.kind == value::error_kind ? cond
+           : cond.kind == value::bool_kind && cond.num != 0 ? then_
+           : else_;
+}
+
+constexpr result parse_expr(const source &src, size_t pos, const env &e);
+constexpr result parse_comparg(const source &src, size_t pos, const env &e);
+
+constexpr result digits(const source &src, size_t pos, unsigned int n, bool negative) {
+    return is_digit(at(src, pos)) ? digits(src, pos + 1, n * 10 + (unsigned int) (at(src, pos) - '0'), negative)
+           : result{ number((int) (negative ? 0u - n : n)), pos };
+}
+
+constexpr result parse_num(const source &src, size_t pos) {
+    return at(src, pos) != '-' ? digits(src, pos, 0, false)
+           : is_digit(at(src, pos + 1)) ? digits(src, pos + 1, 0, true)
+           : throw std::runtime_error("Invalid Input!");
+}
+
+constexpr result close_paren(const source &src, result inner) {
+    return at(src, skip(src, inner.pos)) == ')' ? result{ inner.v, skip(src, inner.pos) + 1 }
+           : throw std::runtime_error("Missing close parenthesis!");
+}
+
+constexpr result if_else(value cond, value then_, result else_) {
+    return result{ choose(cond, then_, else_.v), else_.pos };
+}
+
+constexpr result if_then(const source &src, value cond, result then_, const env &e) {
+    return if_else(cond, then_.v, parse_expr(src, skip(src, expect_word(src, skip(src, then_.pos), "_else")), e));
+}
+
+constexpr result if_cond(const source &src, result cond, const env &e) {
+    return if_then(src, cond.v, parse_expr(src, skip(src, expect_word(src, skip(src, cond.pos), "_then")), e), e);
+}
+
+constexpr result parse_if(const source &src, size_t pos, const env &e) {
+    return if_cond(src, parse_expr(src, skip(src, pos), e), e);
+}
+
+//_let is eager, so an error in the right-hand side wins over the body
+constexpr result let_body(value rhs, result body) {
+    return result{ rhs.kind == value::error_kind ? rhs : body.v, body.pos };
+}
+
+constexpr result let_rhs(const source &src, size_t name, size_t name_end, result rhs, const env &e) {
+    return let_body(rhs.v, parse_comparg(src, skip(src, expect_word(src, skip(src, rhs.pos), "_in")),
+                                         env{ src.s + name, name_end - name, rhs.v, &e }));
+}
+
+constexpr result let_equals(const source &src, size_t name, size_t name_end, size_t pos, const env &e) {
+    return at(src, pos) == '=' ? let_rhs(src, name, name_end, parse_comparg(src, skip(src, pos + 1), e), e)
+           : throw std::runtime_error("Consume mismatch!");
+}
+
+constexpr result let_name(const source &src, size_t name, size_t name_end, const env &e) {
+    return let_equals(src, name, name_end, skip(src, name_end), e);
+}
+
+constexpr result parse_let(const source &src, size_t pos, const env &e) {
+    return let_name(src, skip(src, pos), alpha_end(src, skip(src, pos)), e);
+}
+
+//A syntax error; typed as a result so it can end a chain of ?:
+constexpr result fail(const char *message) {
+    return message == nullptr ? result{ number(0), 0 } : throw std::runtime_error(message);
+}
+
+constexpr result keyword(const source &src, size_t start, size_t end, const env &e) {
+    return word_is(src, start, end, "let") ? parse_let(src, end, e)
+           : word_is(src, start, end, "if") ? parse_if(src, end, e)
+           : word_is(src, start, end, "true") ? result{ boolean(true), end }
+           : word_is(src, start, end, "false") ? result{ boolean(false), end }
+           : fail(word_is(src, start, end, "fun") || word_is(src, start, end, "letrec")
+                  ? "_fun and _letrec are not supported in constant formulas!" : "Invalid Input!");
+}
+
+constexpr result variable(const source &src, size_t pos, size_t end, const env &e) {
+    return result{ lookup(e, src.s + pos, end - pos), end };
+}
+
+constexpr result parse_inner(const source &src, size_t pos, const env &e) {
+    return at(src, pos) == '-' || is_digit(at(src, pos)) ? parse_num(src, pos)
+           : at(src, pos) == '(' ? close_paren(src, parse_comparg(src, pos + 1, e))
+           : is_alpha(at(src, pos)) ? variable(src, pos, alpha_end(src, pos), e)
+           : at(src, pos) == '_' ? keyword(src, pos + 1, alpha_end(src, pos + 1), e)
+           : throw std::runtime_error("Invalid Input!");
+}
+
+constexpr result no_call(const source &src, result r) {
+    return at(src, r.pos) == '(' ? throw std::runtime_error("_fun and _letrec are not supported in constant formulas!")
+           : r;
+}
+
+constexpr result parse_multicand(const source &src, size_t pos, const env &e) {
+    return no_call(src, parse_inner(src, skip(src, pos), e));
+}
+
+constexpr result combine(value (*op)(value, value), value l, result r) {
+    return result{ op(l, r.v), r.pos };
+}
+
+constexpr result parse_addend(const source &src, size_t pos, const env &e);
+
+//The operand l with the whitespace after it skipped, so the tails below can look at the next character
+constexpr result skipped(const source &src, result l) {
+    return result{ l.v, skip(src, l.pos) };
+}
+
+constexpr result mult_tail(const source &src, result l, const env &e) {
+    return at(src, l.pos) == '*' ? combine(mult, l.v, parse_addend(src, skip(src, l.pos + 1), e)) : l;
+}
+
+constexpr result parse_addend(const source &src, size_t pos, const env &e) {
+    return mult_tail(src, skipped(src, parse_multicand(src, pos, e)), e);
+}
+
+constexpr result add_tail(const source &src, result l, const env &e) {
+    return at(src, l.pos) == '+' ? combine(add, l.v, parse_comparg(src, l.pos + 1, e)) : l;
+}
+
+constexpr result parse_comparg(const source &src, size_t pos, const env &e) {
+    return add_tail(src, skipped(src, parse_addend(src, pos, e)), e);
+}
+
+constexpr result eq_tail(const source &src, result l, const env &e) {
+    return at(src, l.pos) != '=' ? l
+           : at(src, l.pos + 1) == '=' ? combine(equal, l.v, parse_expr(src, l.pos + 2, e))
+           : throw std::runtime_error("need '=='!");
+}
+
+constexpr result parse_expr(const source &src, size_t pos, const env &e) {
+    return eq_tail(src, skipped(src, parse_comparg(src, pos, e)), e);
+}
+
+constexpr value finish(const source &src, result r) {
+    return skip(src, r.pos) != src.n ? throw std::runtime_error("Invalid Input!")
+           : r.v.kind == value::error_kind
+             ? throw std::runtime_error(std::string(r.v.message) + std::string(r.v.name, r.v.name_len))
+           : r.v;
+}
+
+constexpr value run(const source &src, const env &e) {
+    return finish(src, parse_expr(src, 0, e));
+}
+
+template <class... Bindings>
+constexpr value run(const source &src, const env &e, binding first, Bindings... rest) {
+    return run(src, env{ first.name, first.len, number(first.num), &e }, rest...);
+}
+
+} //namespace detail
+
+/**
+ * \brief Parses and evaluates a formula, at compile time when everything it uses is constant.
+ * \param src The formula.
+ * \param vars Its free variables, made with msd::var(); a later one hides an earlier one of the same name.
+ * \return Its value. Throws runtime_error (a compile error in a constant expression) if it has none.
+ */
+template <size_t N, class... Bindings>
+constexpr value eval(const char (&src)[N], Bindings... vars) {
+    return detail::run(detail::source{ src, N - 1 }, detail::env{ nullptr, 0, detail::number(0), nullptr }, vars...);
+}
+
+//The same for text that is not a string literal
+template <class... Bindings>
+constexpr value eval(const char *src, size_t len, Bindings... vars) {
+    return detail::run(detail::source{ src, len }, detail::env{ nullptr, 0, detail::number(0), nullptr }, vars...);
+}
+
+} //namespace msd
+
+#endif //EXPRESSIONCLASSES_CONSTEXPR_EVAL_H
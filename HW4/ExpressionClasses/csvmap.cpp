@@ -0,0 +1,231 @@
+/**
+ * \file csvmap.cpp
+ * \brief Row scanning, field parsing and output buffering for the --map mode in csvmap.h.
+ */
+
+#include "csvmap.h"
+#include "batch.h"
+
+#include <cstring>
+#include <climits>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+//Rows parsed before each BatchEval::run()
+static const size_t MAP_ROWS = 4096;
+//Bytes of output collected before each write
+static const size_t MAP_OUTPUT = 1 << 16;
+
+static void csv_error(size_t line, const string &what) {
+    throw runtime_error("line " + std::to_string(line) + ": " + what);
+}
+
+static const char *skip_blanks(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    return p;
+}
+
+//Parses the integer at p without copying it anywhere, and returns where it stopped
+static const char *parse_field(const char *p, const char *end, int &value, size_t line) {
+    p = skip_blanks(p, end);
+    bool negative = p < end && *p == '-';
+    if (negative) {
+        p++;
+    }
+    if (p == end || *p < '0' || *p > '9') {
+        csv_error(line, "not an integer");
+    }
+    long long n = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        n = n * 10 + (*p - '0');
+        if (n > (long long) INT_MAX + 1) {
+            csv_error(line, "number out of range");
+        }
+        p++;
+    }
+    if (!negative && n > INT_MAX) {
+        csv_error(line, "number out of range");
+    }
+    value = (int) (negative ? -n : n);
+    return skip_blanks(p, end);
+}
+
+//The end of the line starting at p, not counting a "\r\n" ending
+static const char *line_end(const char *p, const char *end, const char *&next) {
+    const char *eol = (const char *) memchr(p, '\n', (size_t) (end - p));
+    next = eol == nullptr ? end : eol + 1;
+    if (eol == nullptr) {
+        eol = end;
+    }
+    if (eol > p && eol[-1] == '\r') {
+        eol--;
+    }
+    return eol;
+}
+
+/**
+ * \brief Evaluates an expression for every row of CSV text and writes one result per line.
+ * \param e The expression; its free variables are column names.
+ * \param data The CSV text, header line first.
+ * \param size Its length in bytes.
+ * \param out Where results go, in row order.
+ * \param release_pages True when data is the start of a read-only mapping whose pages can be dropped once read.
+ * Booleans are written as 1 and 0, as --interp prints them.
+ * Throws runtime_error, naming the line, for a row that is not all integers or has the wrong number of fields,
+ * and for rows that give a number where earlier rows gave a boolean or the reverse.
+ */
+void map_csv(PTR(Expr) e, const char *data, size_t size, ostream &out, bool release_pages) {
+    const char *p = data;
+    const char *end = data + size;
+    if (p == end) {
+        return;
+    }
+    size_t line = 1;
+    const char *next;
+    const char *eol = line_end(p, end, next);
+    vector<string> names;
+    while (p < eol) {
+        const char *comma = (const char *) memchr(p, ',', (size_t) (eol - p));
+        const char *field_end = comma == nullptr ? eol : comma;
+        const char *start = skip_blanks(p, field_end);
+        const char *stop = field_end;
+        while (stop > start && (stop[-1] == ' ' || stop[-1] == '\t')) {
+            stop--;
+        }
+        names.push_back(string(start, stop));
+        p = comma == nullptr ? eol : comma + 1;
+        if (comma != nullptr && p == eol) {
+            names.push_back("");
+        }
+    }
+    p = next;
+
+    BatchEval batch(e, names);
+    vector<vector<int> > columns(names.size(), vector<int>(MAP_ROWS));
+    vector<const int *> column_data;
+    for (size_t c = 0; c < columns.size(); c++) {
+        column_data.push_back(columns[c].data());
+    }
+    vector<int> results(MAP_ROWS);
+    string buffer;
+    buffer.reserve(MAP_OUTPUT + 16);
+    size_t rows = 0;
+    //The line of the first row in the block
+    size_t block_line = 0;
+    bool have_kind = false;
+    batch_kind_t kind = batch_num;
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t released = 0;
+
+    //Whatever finished blocks produced is written out even when a later row fails
+    try {
+        while (true) {
+            bool done = p >= end;
+            if (!done) {
+                line++;
+                eol = line_end(p, end, next);
+                if (eol > p) {
+                    if (rows == 0) {
+                        block_line = line;
+                    }
+                    const char *q = p;
+                    for (size_t c = 0; c < names.size(); c++) {
+                        q = parse_field(q, eol, columns[c][rows], line);
+                        if (c + 1 < names.size()) {
+                            if (q == eol) {
+                                csv_error(line, "expected " + std::to_string(names.size()) + " fields");
+                            }
+                            if (*q != ',') {
+                                csv_error(line, "not an integer");
+                            }
+                            q++;
+                        }
+                    }
+                    if (q != eol) {
+                        csv_error(line, *q == ',' ? "expected " + std::to_string(names.size()) + " fields"
+                                                  : "not an integer");
+                    }
+                    rows++;
+                }
+                p = next;
+            }
+            if (rows == MAP_ROWS || (done && rows > 0)) {
+                batch_kind_t block_kind = batch.run(column_data, rows, results.data());
+                if (have_kind && block_kind != kind) {
+                    csv_error(block_line, "rows must all give numbers or all give booleans");
+                }
+                have_kind = true;
+                kind = block_kind;
+                for (size_t i = 0; i < rows; i++) {
+                    append_int(buffer, results[i]);
+                    buffer += '\n';
+                    if (buffer.size() >= MAP_OUTPUT) {
+                        out.write(buffer.data(), (streamsize) buffer.size());
+                        buffer.clear();
+                    }
+                }
+                rows = 0;
+                if (release_pages) {
+                    //Everything before p has been copied into the columns, so its pages can go
+                    size_t read = (size_t) (p - data) / page * page;
+                    if (read > released) {
+                        madvise((void *) (data + released), read - released, MADV_DONTNEED);
+                        released = read;
+                    }
+                }
+            }
+            if (done) {
+                break;
+            }
+        }
+    } catch (...) {
+        out.write(buffer.data(), (streamsize) buffer.size());
+        throw;
+    }
+    out.write(buffer.data(), (streamsize) buffer.size());
+}
+
+/**
+ * \brief Memory-maps a CSV file and runs map_csv() over it.
+ * \param e The expression.
+ * \param path The file.
+ * \param out Where results go.
+ */
+void map_csv_file(PTR(Expr) e, const char *path, ostream &out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        throw runtime_error(string("Could not open ") + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw runtime_error(string("Could not open ") + path);
+    }
+    size_t size = (size_t) info.st_size;
+    if (size == 0) {
+        close(fd);
+        return;
+    }
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        throw runtime_error(string("Could not map ") + path);
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+    try {
+        map_csv(e, (const char *) data, size, out, true);
+        munmap(data, size);
+    } catch (...) {
+        munmap(data, size);
+        throw;
+    }
+}
@@ -0,0 +1,34 @@
+/**
+ * \file csvmap.h
+ * \brief The --map mode: one expression evaluated for every row of a CSV file.
+ *
+ * The first line of the file names the columns. Every later line is a row of
+ * integers, and the result of the expression with each column name bound to
+ * that row's value is written as one line of output. Every row must give a
+ * number or every row a boolean; booleans are written as 1 and 0, the way
+ * --interp prints them. Blank lines are skipped; fields may have spaces around
+ * them but no quotes.
+ *
+ * Fields are parsed straight from the memory-mapped file into per-column int
+ * arrays, a block of rows at a time, and each block is evaluated with
+ * BatchEval (see batch.h), so no string or Val is made per field or per row
+ * unless the expression has to run through interp(). Results go to an output
+ * buffer that is written out whenever it fills. Memory stays bounded by the
+ * block size whatever the size of the file: pages of the mapping that have
+ * been read are handed back to the kernel as the scan passes them.
+ */
+
+#ifndef EXPRESSIONCLASSES_CSVMAP_H
+#define EXPRESSIONCLASSES_CSVMAP_H
+
+#include <iostream>
+#include <cstddef>
+#include "pointer.h"
+#include "Expr.h"
+
+//Evaluates e for every row of the CSV text in data; release_pages is for a page-aligned mapping
+void map_csv(PTR(Expr) e, const char *data, size_t size, std::ostream &out, bool release_pages = false);
+//Maps the file at path and runs map_csv() over it
+void map_csv_file(PTR(Expr) e, const char *path, std::ostream &out);
+
+#endif //EXPRESSIONCLASSES_CSVMAP_H
@@ -1,11 +1,17 @@
 #include <string>
 #include <iostream>
 #include <cassert>
+#include <cstring>
+#include <cstdio>
+#include <csignal>
+#include <cstdlib>
+#include <stdexcept>
 
 #include <unistd.h>
 #include <fcntl.h>
 #include <poll.h>
 #include <errno.h>
+#include <sys/wait.h>
 
 #include "exec.h"
 
@@ -222,3 +228,160 @@ static void wait_child(pid_t pid, int &exit_code) {
   else
     throw std::runtime_error("unrecognized status from waitpid");
 }
+
+// How long a freshly started server gets to send its greeting
+static const int GREETING_TIMEOUT_MS = 2000;
+// Must match SERVE_GREETING in serve.h
+static const char *const GREETING = "msdscript-serve 1";
+
+CoProcess::CoProcess(const char *path) {
+  this->path = path;
+  supported = true;
+  pid = -1;
+  to_child = -1;
+  from_child = -1;
+  signal(SIGPIPE, SIG_IGN);
+}
+
+CoProcess::~CoProcess() {
+  int exit_code;
+  stop(exit_code);
+}
+
+// Launch `path --serve` and check its greeting
+bool CoProcess::start() {
+  int in[2];
+  if (pipe(in) != 0)
+    throw std::runtime_error("stdin pipe failed");
+  int out[2];
+  if (pipe(out) != 0)
+    throw std::runtime_error("stdout pipe failed");
+
+  pid = fork();
+  if (pid == -1)
+    throw std::runtime_error("fork failed");
+  else if (pid == 0) {
+    // child; errors come back in the responses, so stderr is not needed
+    dup2(in[READ_END], STDIN_FD);
+    dup2(out[WRITE_END], STDOUT_FD);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd >= 0)
+      dup2(null_fd, STDERR_FD);
+    close(in[READ_END]);
+    close(in[WRITE_END]);
+    close(out[READ_END]);
+    close(out[WRITE_END]);
+    const char *command[] = { path.c_str(), "--serve", NULL };
+    execv(command[0], (char * const *)command);
+    exit(1);
+  }
+
+  close(in[READ_END]);
+  close(out[WRITE_END]);
+  to_child = in[WRITE_END];
+  from_child = out[READ_END];
+  pending.clear();
+
+  std::string greeting;
+  if (read_line(greeting, GREETING_TIMEOUT_MS) && greeting == GREETING)
+    return true;
+  int exit_code;
+  stop(exit_code);
+  return false;
+}
+
+// Close the pipes and reap the server, killing it if it is still running
+void CoProcess::stop(int &exit_code) {
+  exit_code = 0;
+  if (pid <= 0)
+    return;
+  close(to_child);
+  close(from_child);
+  kill(pid, SIGKILL);
+  wait_child(pid, exit_code);
+  pid = -1;
+}
+
+// Read whatever the server has sent into `pending`; false on EOF or timeout
+bool CoProcess::fill(int timeout_ms) {
+  struct pollfd poll_info;
+  poll_info.fd = from_child;
+  poll_info.events = POLLIN;
+  int rtn;
+  do {
+    rtn = poll(&poll_info, 1, timeout_ms);
+  } while (needs_retry(rtn));
+  if (rtn <= 0)
+    return false;
+
+  char buffer[4096];
+  ssize_t len;
+  do {
+    len = read(from_child, buffer, sizeof(buffer));
+  } while (needs_retry((int)len));
+  if (len <= 0)
+    return false;
+  pending.append(buffer, len);
+  return true;
+}
+
+bool CoProcess::read_line(std::string &line, int timeout_ms) {
+  size_t newline;
+  while ((newline = pending.find('\n')) == std::string::npos) {
+    if (!fill(timeout_ms))
+      return false;
+  }
+  line = pending.substr(0, newline);
+  pending.erase(0, newline + 1);
+  return true;
+}
+
+bool CoProcess::read_bytes(std::string &str, size_t len) {
+  while (pending.length() < len) {
+    if (!fill(-1))
+      return false;
+  }
+  str = pending.substr(0, len);
+  pending.erase(0, len);
+  return true;
+}
+
+// Send one input to the server and wait for its framed response
+ExecResult CoProcess::run(const char *mode, std::string input) {
+  if (supported && pid <= 0)
+    supported = start();
+  if (!supported) {
+    const char * const argv[] = { path.c_str(), mode };
+    return exec_program(2, argv, input);
+  }
+
+  ExecResult r;
+  std::string request = std::string(mode) + " " + std::to_string(input.length()) + "\n" + input;
+  size_t sent = 0;
+  while (sent < request.length()) {
+    ssize_t len = write(to_child, request.c_str() + sent, request.length() - sent);
+    if (len < 0 && needs_retry((int)len))
+      continue;
+    if (len <= 0)
+      break;
+    sent += len;
+  }
+
+  std::string header;
+  int exit_code;
+  size_t out_len, err_len;
+  if (sent == request.length()
+      && read_line(header, -1)
+      && sscanf(header.c_str(), "%d %zu %zu", &exit_code, &out_len, &err_len) == 3
+      && read_bytes(r.out, out_len)
+      && read_bytes(r.err, err_len)) {
+    r.exit_code = exit_code;
+    return r;
+  }
+
+  // The server died (or broke the protocol) partway through this input
+  r.out = "";
+  r.err = "";
+  stop(r.exit_code);
+  return r;
+}
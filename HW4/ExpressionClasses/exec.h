@@ -17,4 +17,35 @@ public:
 
 extern ExecResult exec_program(int argc, const char * const *argv, std::string input);
 
+// Runs many inputs through one long-lived `<path> --serve` process instead
+// of starting a process per input (see serve.h for the protocol). If the
+// program does not answer with the expected greeting, every run falls back
+// to exec_program, so any msdscript binary can be driven the same way. If
+// the server dies during a run, that run reports the signal like
+// exec_program does and the next run starts a fresh server.
+class CoProcess {
+public:
+  CoProcess(const char *path);
+  ~CoProcess();
+
+  // `mode` is the flag a separate run would get, e.g. "--interp"
+  ExecResult run(const char *mode, std::string input);
+  // Whether runs go through the server rather than exec_program
+  bool persistent() { return supported; }
+
+private:
+  std::string path;
+  bool supported;
+  int pid;
+  int to_child;
+  int from_child;
+  std::string pending;
+
+  bool start();
+  void stop(int &exit_code);
+  bool fill(int timeout_ms);
+  bool read_line(std::string &line, int timeout_ms);
+  bool read_bytes(std::string &str, size_t len);
+};
+
 #endif /* exec_hpp */
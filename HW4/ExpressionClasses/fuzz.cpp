@@ -0,0 +1,993 @@
+/**
+ * \file fuzz.cpp
+ * \brief msdscript_fuzz: grammar-aware, in-process fuzzer for the parser and interpreter.
+ *
+ * Programs are generated as typed trees over the whole language (numbers,
+ * variables, +, *, _let, _letrec, _true/_false, _if, ==, _funs of one or two
+ * parameters and calls), so nearly every program is well formed and well
+ * typed; a small share is deliberately ill typed, or calls a function with the
+ * wrong number of arguments, to exercise the error paths. Each program is written out as source
+ * text that respects the parser's grammar, then checked in-process:
+ *
+ *   parse     the parser accepts it and builds the same tree
+ *   interp    interp() agrees with the small reference evaluator below
+ *   lazy      with --lazy, a program that has a value gets the same value
+ *   typecheck a program mark_typed() accepts never fails a run-time type
+ *             check, and runs the same on interp()'s unchecked fast paths;
+ *             reading a _letrec variable before its value is ready is not a
+ *             type error, so programs that do are exempt
+ *   ast       the binary AST round trip gives an equal tree and the same value
+ *   constexpr msd::eval() gives the same value or error for a program in its subset
+ *   print     to_string() and to_pretty_string() do not throw; with
+ *             --check-print, reparsing to_string() also gives the same value
+ *
+ * Programs that reach a new (parent, child) node pairing or a new kind of
+ * result are kept in a corpus, and later programs are often made by replacing
+ * one subtree of a corpus entry. A failing program is shrunk by repeatedly
+ * swapping subtrees for smaller ones of the same type while the same check
+ * still fails, and the minimal reproducer is printed.
+ *
+ * Usage: msdscript_fuzz [--runs <n>] [--seconds <s>] [--seed <n>] [--corpus <dir>] [--check-print]
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <random>
+#include <memory>
+#include <stdexcept>
+#include "Expr.h"
+#include "Val.h"
+#include "Env.h"
+#include "parse.hpp"
+#include "serialize.h"
+#include "budget.h"
+#include "typecheck.h"
+#include "constexpr_eval.h"
+#include "pointer.h"
+
+using namespace std;
+
+/****************PROGRAM TREES****************/
+typedef enum {
+    type_num,
+    type_bool,
+    type_fun,   //_fun from a number to a number
+    type_fun2,  //_fun from two numbers to a number
+    type_count
+} fuzz_type_t;
+
+typedef enum {
+    node_num,
+    node_var,
+    node_add,
+    node_mult,
+    node_let,
+    node_bool,
+    node_if,
+    node_eq,
+    node_fun,
+    node_call,
+    node_letrec,
+    node_count
+} fuzz_node_t;
+
+struct Node;
+typedef shared_ptr<Node> NodeP;
+
+typedef struct {
+    string name;
+    fuzz_type_t type;
+} binding_t;
+
+//Everything needed to regenerate a subtree in place: what it must produce and what it may use
+typedef struct {
+    fuzz_type_t type;
+    vector<binding_t> scope;
+    bool allow_eq;      //== only parses where the grammar expects an <expr>, not inside a <comparg>
+} slot_t;
+
+struct Node {
+    fuzz_node_t kind;
+    slot_t slot;
+    int num;            //node_num, and 0/1 for node_bool
+    string name;        //node_var, the variable bound by node_let and node_letrec
+    vector<string> params;  //node_fun
+    vector<NodeP> kids;
+};
+
+static NodeP make_node(fuzz_node_t kind, const slot_t &slot) {
+    NodeP n = make_shared<Node>();
+    n->kind = kind;
+    n->slot = slot;
+    n->num = 0;
+    return n;
+}
+
+static int tree_size(const NodeP &n) {
+    int size = 1;
+    for (size_t i = 0; i < n->kids.size(); i++) {
+        size += tree_size(n->kids[i]);
+    }
+    return size;
+}
+
+static NodeP copy_tree(const NodeP &n) {
+    NodeP c = make_shared<Node>(*n);
+    for (size_t i = 0; i < c->kids.size(); i++) {
+        c->kids[i] = copy_tree(c->kids[i]);
+    }
+    return c;
+}
+
+//Every node of a tree, parents before children
+static void collect(const NodeP &n, vector<NodeP> &out) {
+    out.push_back(n);
+    for (size_t i = 0; i < n->kids.size(); i++) {
+        collect(n->kids[i], out);
+    }
+}
+
+static bool same_tree(const NodeP &a, const NodeP &b) {
+    if (a->kind != b->kind || a->num != b->num || a->name != b->name || a->params != b->params
+        || a->kids.size() != b->kids.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a->kids.size(); i++) {
+        if (!same_tree(a->kids[i], b->kids[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/****************SOURCE TEXT****************/
+static string join_params(const vector<string> &params) {
+    string out;
+    for (size_t i = 0; i < params.size(); i++) {
+        out += (i > 0 ? ", " : "") + params[i];
+    }
+    return out;
+}
+
+//Writes n so that parse() rebuilds exactly this tree: every compound node except ==
+//is parenthesized, and == only occurs where the generator allowed it
+static void write_source(const NodeP &n, string &out) {
+    switch (n->kind) {
+        case node_num:
+            out += std::to_string(n->num);
+            break;
+        case node_var:
+            out += n->name;
+            break;
+        case node_bool:
+            out += n->num ? "_true" : "_false";
+            break;
+        case node_add:
+        case node_mult:
+            out += "(";
+            write_source(n->kids[0], out);
+            out += n->kind == node_add ? " + " : " * ";
+            write_source(n->kids[1], out);
+            out += ")";
+            break;
+        case node_eq:
+            write_source(n->kids[0], out);
+            out += " == ";
+            write_source(n->kids[1], out);
+            break;
+        case node_let:
+        case node_letrec:
+            out += (n->kind == node_let ? "(_let " : "(_letrec ") + n->name + " = ";
+            write_source(n->kids[0], out);
+            out += " _in ";
+            write_source(n->kids[1], out);
+            out += ")";
+            break;
+        case node_if:
+            out += "(_if ";
+            write_source(n->kids[0], out);
+            out += " _then ";
+            write_source(n->kids[1], out);
+            out += " _else ";
+            write_source(n->kids[2], out);
+            out += ")";
+            break;
+        case node_fun:
+            out += "(_fun (" + join_params(n->params) + ") ";
+            write_source(n->kids[0], out);
+            out += ")";
+            break;
+        case node_call:
+            write_source(n->kids[0], out);
+            out += "(";
+            for (size_t i = 1; i < n->kids.size(); i++) {
+                if (i > 1) {
+                    out += ", ";
+                }
+                write_source(n->kids[i], out);
+            }
+            out += ")";
+            break;
+        default:
+            break;
+    }
+}
+
+static string source_of(const NodeP &n) {
+    string out;
+    write_source(n, out);
+    return out;
+}
+
+//The Expr the parser should build for n
+static PTR(Expr) expected_expr(const NodeP &n) {
+    switch (n->kind) {
+        case node_num:
+            return NEW(Num)(n->num);
+        case node_var:
+            return NEW(Var)(n->name);
+        case node_bool:
+            return NEW(BoolExpr)(n->num != 0);
+        case node_add:
+            return NEW(Add)(expected_expr(n->kids[0]), expected_expr(n->kids[1]));
+        case node_mult:
+            return NEW(Mult)(expected_expr(n->kids[0]), expected_expr(n->kids[1]));
+        case node_eq:
+            return NEW(EqExpr)(expected_expr(n->kids[0]), expected_expr(n->kids[1]));
+        case node_let:
+            return NEW(Let)(n->name, expected_expr(n->kids[0]), expected_expr(n->kids[1]));
+        case node_letrec:
+            return NEW(LetRec)(n->name, expected_expr(n->kids[0]), expected_expr(n->kids[1]));
+        case node_if:
+            return NEW(IfExpr)(expected_expr(n->kids[0]), expected_expr(n->kids[1]), expected_expr(n->kids[2]));
+        case node_fun:
+            return NEW(FunExpr)(n->params, expected_expr(n->kids[0]));
+        case node_call:
+        default: {
+            vector<PTR(Expr)> args;
+            for (size_t i = 1; i < n->kids.size(); i++) {
+                args.push_back(expected_expr(n->kids[i]));
+            }
+            return NEW(CallExpr)(expected_expr(n->kids[0]), args);
+        }
+    }
+}
+
+/****************GENERATION****************/
+static mt19937 rng;
+static const int MAX_DEPTH = 6;
+//Out of 1000, how often a subtree is generated for the wrong type
+static const int ILL_TYPED_PER_MILLE = 15;
+//Out of 1000, how often a call passes the wrong number of arguments
+static const int WRONG_ARITY_PER_MILLE = 30;
+//One in this many of the places a _letrec could go gets one
+static const int LETREC_ODDS = 8;
+static const char *const VAR_NAMES[] = { "a", "b", "c", "f", "g", "x", "y", "n" };
+
+static slot_t child_slot(const slot_t &parent, fuzz_type_t type, bool allow_eq) {
+    slot_t s;
+    s.type = type;
+    s.scope = parent.scope;
+    s.allow_eq = allow_eq;
+    return s;
+}
+
+static int pick(int n) {
+    return (int) (rng() % (unsigned) n);
+}
+
+static size_t arity_of(fuzz_type_t type) {
+    return type == type_fun2 ? 2 : 1;
+}
+
+//A _fun with parameters for a function type, in a slot; the returned slot is its body's
+static NodeP make_fun(const slot_t &slot, fuzz_type_t type, slot_t &body) {
+    NodeP n = make_node(node_fun, slot);
+    body = child_slot(slot, type_num, true);
+    for (size_t i = 0; i < arity_of(type); i++) {
+        n->params.push_back(VAR_NAMES[pick(8)]);
+        binding_t arg = { n->params.back(), type_num };
+        body.scope.push_back(arg);
+    }
+    return n;
+}
+
+
+static NodeP generate(const slot_t &slot, int depth);
+
+//A leaf of the slot's type: a constant, or a variable in scope
+static NodeP generate_leaf(const slot_t &slot) {
+    vector<const binding_t *> vars;
+    for (size_t i = 0; i < slot.scope.size(); i++) {
+        if (slot.scope[i].type == slot.type) {
+            vars.push_back(&slot.scope[i]);
+        }
+    }
+    if (!vars.empty() && pick(3) != 0) {
+        NodeP n = make_node(node_var, slot);
+        n->name = vars[pick((int) vars.size())]->name;
+        return n;
+    }
+    switch (slot.type) {
+        case type_num: {
+            NodeP n = make_node(node_num, slot);
+            n->num = pick(10) == 0 ? -pick(50) : pick(100);
+            return n;
+        }
+        case type_bool: {
+            NodeP n = make_node(node_bool, slot);
+            n->num = pick(2);
+            return n;
+        }
+        default: {
+            //_fun (x) x + k is the smallest function; with more parameters, the last one is used
+            slot_t body;
+            NodeP n = make_fun(slot, slot.type, body);
+            NodeP add = make_node(node_add, body);
+            slot_t operand = child_slot(body, type_num, false);
+            NodeP var = make_node(node_var, operand);
+            var->name = n->params.back();
+            NodeP k = make_node(node_num, operand);
+            k->num = pick(10);
+            add->kids.push_back(var);
+            add->kids.push_back(k);
+            n->kids.push_back(add);
+            return n;
+        }
+    }
+}
+
+static NodeP generate_let(const slot_t &slot, int depth) {
+    NodeP n = make_node(node_let, slot);
+    n->name = VAR_NAMES[pick(8)];
+    n->kids.push_back(generate(child_slot(slot, (fuzz_type_t) pick(type_count), false), depth + 1));
+    slot_t body = child_slot(slot, slot.type, false);
+    binding_t bound = { n->name, n->kids[0]->slot.type };
+    body.scope.push_back(bound);
+    n->kids.push_back(generate(body, depth + 1));
+    return n;
+}
+
+//A one-argument _fun that counts its argument down to 0, calling self on the way
+static NodeP generate_recursive(const slot_t &slot, const string &self, int depth) {
+    NodeP n = make_node(node_fun, slot);
+    string param;
+    do {
+        param = VAR_NAMES[pick(8)];
+    } while (param == self);
+    n->params.push_back(param);
+    slot_t body = child_slot(slot, type_num, true);
+    binding_t arg = { param, type_num };
+    body.scope.push_back(arg);
+    slot_t operand = child_slot(body, type_num, false);
+
+    NodeP test = make_node(node_eq, child_slot(body, type_bool, true));
+    NodeP var = make_node(node_var, operand);
+    var->name = param;
+    test->kids.push_back(var);
+    test->kids.push_back(make_node(node_num, child_slot(body, type_num, true)));
+
+    NodeP step = make_node(node_add, child_slot(body, type_num, true));
+    var = make_node(node_var, operand);
+    var->name = param;
+    NodeP minus_one = make_node(node_num, operand);
+    minus_one->num = -1;
+    step->kids.push_back(var);
+    step->kids.push_back(minus_one);
+    NodeP call = make_node(node_call, operand);
+    NodeP callee = make_node(node_var, child_slot(body, type_fun, false));
+    callee->name = self;
+    call->kids.push_back(callee);
+    call->kids.push_back(step);
+    NodeP combine = make_node(pick(2) ? node_add : node_mult, child_slot(body, type_num, true));
+    combine->kids.push_back(generate(operand, depth + 1));
+    combine->kids.push_back(call);
+
+    NodeP branch = make_node(node_if, body);
+    branch->kids.push_back(test);
+    branch->kids.push_back(generate(child_slot(body, type_num, true), depth + 1));
+    branch->kids.push_back(combine);
+    n->kids.push_back(branch);
+    return n;
+}
+
+//Mostly a recursive function; otherwise any right-hand side, which may read the variable before it is ready
+static NodeP generate_letrec(const slot_t &slot, int depth) {
+    NodeP n = make_node(node_letrec, slot);
+    n->name = VAR_NAMES[pick(8)];
+    fuzz_type_t type = pick(4) == 0 ? (fuzz_type_t) pick(type_count) : type_fun;
+    binding_t bound = { n->name, type };
+    slot_t rhs = child_slot(slot, type, false);
+    rhs.scope.push_back(bound);
+    n->kids.push_back(type == type_fun && pick(4) != 0 ? generate_recursive(rhs, n->name, depth + 1)
+                                                       : generate(rhs, depth + 1));
+    slot_t body = child_slot(slot, slot.type, false);
+    body.scope.push_back(bound);
+    n->kids.push_back(generate(body, depth + 1));
+    return n;
+}
+
+static NodeP generate_if(const slot_t &slot, int depth) {
+    NodeP n = make_node(node_if, slot);
+    n->kids.push_back(generate(child_slot(slot, type_bool, true), depth + 1));
+    n->kids.push_back(generate(child_slot(slot, slot.type, true), depth + 1));
+    n->kids.push_back(generate(child_slot(slot, slot.type, true), depth + 1));
+    return n;
+}
+
+//Usually as many arguments as the function takes, sometimes from one to three of the wrong number
+static NodeP generate_call(const slot_t &slot, int depth) {
+    NodeP n = make_node(node_call, slot);
+    fuzz_type_t type = pick(3) == 0 ? type_fun2 : type_fun;
+    n->kids.push_back(generate(child_slot(slot, type, false), depth + 1));
+    size_t args = arity_of(type);
+    if (pick(1000) < WRONG_ARITY_PER_MILLE) {
+        do {
+            args = 1 + (size_t) pick(3);
+        } while (args == arity_of(type));
+    }
+    for (size_t i = 0; i < args; i++) {
+        n->kids.push_back(generate(child_slot(slot, type_num, true), depth + 1));
+    }
+    return n;
+}
+
+/**
+ * \brief Generates a random tree that fits a slot.
+ * \param slot The type to produce, the variables in scope and whether == may appear.
+ * \param depth How deep in the program this is; deeper slots get more leaves.
+ */
+static NodeP generate(const slot_t &slot, int depth) {
+    if (pick(1000) < ILL_TYPED_PER_MILLE) {
+        slot_t wrong = slot;
+        wrong.type = (fuzz_type_t) pick(type_count);
+        NodeP n = generate(wrong, depth + 1);
+        n->slot.type = slot.type;
+        return n;
+    }
+    if (depth >= MAX_DEPTH || pick(MAX_DEPTH + 1) < depth) {
+        return generate_leaf(slot);
+    }
+    switch (slot.type) {
+        case type_num:
+            switch (pick(5)) {
+                case 0:
+                case 1: {
+                    NodeP n = make_node(pick(2) ? node_add : node_mult, slot);
+                    n->kids.push_back(generate(child_slot(slot, type_num, false), depth + 1));
+                    n->kids.push_back(generate(child_slot(slot, type_num, false), depth + 1));
+                    return n;
+                }
+                case 2:
+                    return generate_let(slot, depth);
+                case 3:
+                    return generate_if(slot, depth);
+                default:
+                    //A _letrec that recurses forever is slow to reach a limit, so they are kept rare
+                    return pick(LETREC_ODDS) == 0 ? generate_letrec(slot, depth) : generate_call(slot, depth);
+            }
+        case type_bool:
+            if (slot.allow_eq && pick(2) == 0) {
+                NodeP n = make_node(node_eq, slot);
+                fuzz_type_t compared = pick(3) ? type_num : type_bool;
+                n->kids.push_back(generate(child_slot(slot, compared, false), depth + 1));
+                n->kids.push_back(generate(child_slot(slot, compared, true), depth + 1));
+                return n;
+            }
+            if (pick(LETREC_ODDS) == 0) {
+                return generate_letrec(slot, depth);
+            }
+            return pick(2) ? generate_let(slot, depth) : generate_if(slot, depth);
+        default: {
+            if (pick(3) == 0) {
+                if (pick(LETREC_ODDS) == 0) {
+                    return generate_letrec(slot, depth);
+                }
+                return pick(2) ? generate_let(slot, depth) : generate_if(slot, depth);
+            }
+            slot_t body;
+            NodeP n = make_fun(slot, slot.type, body);
+            n->kids.push_back(generate(body, depth + 1));
+            return n;
+        }
+    }
+}
+
+/****************REFERENCE EVALUATOR****************/
+//A direct evaluator over the generated trees, independent of Expr::interp
+struct RefEnv;
+typedef shared_ptr<RefEnv> RefEnvP;
+
+typedef struct {
+    fuzz_type_t type;   //type_fun for every closure, whatever its arity
+    int num;            //the number, or 0/1 for a bool
+    const Node *fun;    //the node_fun, for a closure
+    RefEnvP env;
+} ref_val_t;
+
+struct RefEnv {
+    string name;
+    ref_val_t val;
+    RefEnvP rest;
+    bool pending;       //a _letrec variable whose right-hand side is still being evaluated
+};
+
+class RefError : public runtime_error {
+public:
+    explicit RefError(const string &message) : runtime_error(message) {
+    }
+};
+
+static const unsigned long REF_FUEL = 200000;
+//Well past FUZZ_LIMITS' depth, so the reference evaluator never gives up on a program interp() finishes
+static const int REF_MAX_DEPTH = 5000;
+static unsigned long ref_steps;
+static int ref_depth;
+//Every _letrec frame made by one run; a closure bound in one points back at it, so the cycles are broken afterwards
+static vector<RefEnvP> ref_letrecs;
+
+//One level of ref_eval() nesting, for as long as it lives
+class RefDepth {
+public:
+    RefDepth() {
+        if (++ref_depth > REF_MAX_DEPTH) {
+            ref_depth--;
+            throw BudgetExceeded(budget_depth, "reference evaluator too deep");
+        }
+    }
+    ~RefDepth() {
+        ref_depth--;
+    }
+};
+
+static ref_val_t ref_num(int n) {
+    ref_val_t v = { type_num, n, nullptr, nullptr };
+    return v;
+}
+
+static ref_val_t ref_eval(const Node *n, const RefEnvP &env) {
+    if (++ref_steps > REF_FUEL) {
+        throw BudgetExceeded(budget_fuel, "reference evaluator out of fuel");
+    }
+    RefDepth depth;
+    switch (n->kind) {
+        case node_num:
+            return ref_num(n->num);
+        case node_bool: {
+            ref_val_t v = { type_bool, n->num, nullptr, nullptr };
+            return v;
+        }
+        case node_var:
+            for (RefEnv *e = env.get(); e != nullptr; e = e->rest.get()) {
+                if (e->name == n->name) {
+                    if (e->pending) {
+                        throw RefError("variable used before its _letrec value is ready");
+                    }
+                    return e->val;
+                }
+            }
+            throw RefError("free variable");
+        case node_add:
+        case node_mult: {
+            ref_val_t lhs = ref_eval(n->kids[0].get(), env);
+            ref_val_t rhs = ref_eval(n->kids[1].get(), env);
+            if (lhs.type != type_num || rhs.type != type_num) {
+                throw RefError("arithmetic on a non-number");
+            }
+            //Wrap around like the int arithmetic in NumVal does on every target we build for
+            unsigned int a = (unsigned int) lhs.num;
+            unsigned int b = (unsigned int) rhs.num;
+            return ref_num((int) (n->kind == node_add ? a + b : a * b));
+        }
+        case node_eq: {
+            ref_val_t lhs = ref_eval(n->kids[0].get(), env);
+            ref_val_t rhs = ref_eval(n->kids[1].get(), env);
+            bool same = lhs.type == rhs.type;
+            if (same && lhs.type == type_fun) {
+                same = lhs.fun->params == rhs.fun->params && same_tree(lhs.fun->kids[0], rhs.fun->kids[0]);
+            } else if (same) {
+                same = lhs.num == rhs.num;
+            }
+            ref_val_t v = { type_bool, same ? 1 : 0, nullptr, nullptr };
+            return v;
+        }
+        case node_let: {
+            RefEnvP extended = make_shared<RefEnv>();
+            extended->name = n->name;
+            extended->val = ref_eval(n->kids[0].get(), env);
+            extended->rest = env;
+            return ref_eval(n->kids[1].get(), extended);
+        }
+        case node_letrec: {
+            RefEnvP extended = make_shared<RefEnv>();
+            extended->name = n->name;
+            extended->pending = true;
+            extended->rest = env;
+            ref_letrecs.push_back(extended);
+            extended->val = ref_eval(n->kids[0].get(), extended);
+            extended->pending = false;
+            return ref_eval(n->kids[1].get(), extended);
+        }
+        case node_if: {
+            //Anything but _true takes the _else branch, as IfExpr::interp does
+            ref_val_t test = ref_eval(n->kids[0].get(), env);
+            bool taken = test.type == type_bool && test.num != 0;
+            return ref_eval(n->kids[taken ? 1 : 2].get(), env);
+        }
+        case node_fun: {
+            ref_val_t v = { type_fun, 0, n, env };
+            return v;
+        }
+        case node_call:
+        default: {
+            ref_val_t fun = ref_eval(n->kids[0].get(), env);
+            vector<ref_val_t> args;
+            for (size_t i = 1; i < n->kids.size(); i++) {
+                args.push_back(ref_eval(n->kids[i].get(), env));
+            }
+            if (fun.type != type_fun) {
+                throw RefError("call of a non-function");
+            }
+            if (fun.fun->params.size() != args.size()) {
+                throw RefError("wrong number of arguments");
+            }
+            //Bound in order, so a repeated parameter name refers to the last argument
+            RefEnvP extended = fun.env;
+            for (size_t i = 0; i < args.size(); i++) {
+                RefEnvP frame = make_shared<RefEnv>();
+                frame->name = fun.fun->params[i];
+                frame->val = args[i];
+                frame->rest = extended;
+                extended = frame;
+            }
+            return ref_eval(fun.fun->kids[0].get(), extended);
+        }
+    }
+}
+
+//Values are compared as text; functions print as nothing, so they are shown by parameter and body
+static string describe(const ref_val_t &v) {
+    switch (v.type) {
+        case type_num:
+            return std::to_string(v.num);
+        case type_bool:
+            return v.num ? "1" : "0";
+        default:
+            return "_fun (" + join_params(v.fun->params) + ") " + expected_expr(v.fun->kids[0])->to_string();
+    }
+}
+
+static string describe(PTR(Val) v) {
+    PTR(FunVal) fun = CAST(FunVal)(v);
+    if (fun != nullptr) {
+        string params;
+        for (size_t i = 0; i < fun->formalargs->size(); i++) {
+            params += (i > 0 ? ", " : "") + (*fun->formalargs)[i];
+        }
+        return "_fun (" + params + ") " + fun->body->to_string();
+    }
+    return v->to_string();
+}
+
+/****************CHECKS****************/
+typedef enum {
+    result_value,
+    result_error,
+    result_limit
+} result_kind_t;
+
+typedef struct {
+    string failed;      //name of the failing check, empty if all passed
+    string detail;
+    result_kind_t kind;
+    fuzz_type_t type;
+} outcome_t;
+
+static bool check_print = false;
+static const eval_limits_t FUZZ_LIMITS = { 200000, 0, 2000 };
+//The message of the last error run_interp() caught
+static string interp_error;
+
+//interp() with the fuzzing budget; the text --interp would print, "error", or "limit"
+static string run_interp(PTR(Expr) e, result_kind_t &kind) {
+    try {
+        EvalBudget budget(FUZZ_LIMITS);
+        string out = describe(e->interp(Env::empty));
+        kind = result_value;
+        return out;
+    } catch (BudgetExceeded &) {
+        kind = result_limit;
+        return "limit";
+    } catch (runtime_error &ex) {
+        kind = result_error;
+        interp_error = ex.what();
+        return "error";
+    }
+}
+
+static outcome_t check(const NodeP &program) {
+    outcome_t o;
+    o.kind = result_error;
+    o.type = program->slot.type;
+    string source = source_of(program);
+
+    PTR(Expr) e;
+    try {
+        e = parse_str(source);
+    } catch (runtime_error &ex) {
+        o.failed = "parse";
+        o.detail = ex.what();
+        return o;
+    }
+    if (!e->equals(expected_expr(program))) {
+        o.failed = "parse";
+        o.detail = "parsed as " + e->to_string();
+        return o;
+    }
+
+    result_kind_t kind;
+    string actual = run_interp(e, kind);
+    //A program that ran into a limit is not compared with anything, so none of the later runs are repeated for it
+    string expected = "limit";
+    result_kind_t expected_kind = result_limit;
+    if (kind != result_limit) {
+        ref_steps = 0;
+        ref_depth = 0;
+        try {
+            ref_val_t v = ref_eval(program.get(), nullptr);
+            expected = describe(v);
+            expected_kind = result_value;
+            o.type = v.type;
+        } catch (BudgetExceeded &) {
+        } catch (RefError &) {
+            expected = "error";
+            expected_kind = result_error;
+        }
+        for (size_t i = 0; i < ref_letrecs.size(); i++) {
+            ref_letrecs[i]->val.env = nullptr;
+        }
+        ref_letrecs.clear();
+    }
+    o.kind = kind;
+    if (kind != result_limit && expected_kind != result_limit && actual != expected) {
+        o.failed = "interp";
+        o.detail = "interp gave " + actual + ", expected " + expected;
+        return o;
+    }
+
+    if (kind == result_value) {
+        result_kind_t lazy_kind;
+        lazy_let = true;
+        string lazy = run_interp(e, lazy_kind);
+        lazy_let = false;
+        if (lazy_kind != result_limit && lazy != actual) {
+            o.failed = "lazy";
+            o.detail = "interp gave " + actual + ", but " + lazy + " with --lazy";
+            return o;
+        }
+    }
+
+    bool not_ready = kind == result_error && interp_error.find("before its _letrec value is ready") != string::npos;
+    if (mark_typed(e) && kind != result_limit) {
+        result_kind_t typed_kind;
+        string typed = run_interp(e, typed_kind);
+        if ((kind == result_error && !not_ready) || (kind == result_value && typed != actual)) {
+            o.failed = "typecheck";
+            o.detail = "well typed, but interp gave " + actual + " and the fast paths gave " + typed;
+            return o;
+        }
+    }
+
+    string bytes = emit_ast(e);
+    PTR(Expr) loaded = load_ast(bytes.data(), bytes.size());
+    result_kind_t loaded_kind;
+    if (!loaded->equals(e) || (kind != result_limit && run_interp(loaded, loaded_kind) != actual)) {
+        o.failed = "ast";
+        o.detail = "binary AST round trip changed the program";
+        return o;
+    }
+
+    if (kind != result_limit) {
+        string folded;
+        try {
+            msd::value v = msd::eval(source.data(), source.size());
+            folded = std::to_string(v.num);
+        } catch (runtime_error &ex) {
+            folded = string(ex.what()).find("not supported") != string::npos ? actual : "error";
+        }
+        if (folded != actual) {
+            o.failed = "constexpr";
+            o.detail = "interp gave " + actual + ", msd::eval gave " + folded;
+            return o;
+        }
+    }
+
+    string printed;
+    try {
+        printed = e->to_string();
+        e->to_pretty_string();
+    } catch (runtime_error &ex) {
+        o.failed = "print";
+        o.detail = ex.what();
+        return o;
+    }
+    if (check_print && kind == result_value) {
+        result_kind_t reprinted_kind;
+        string reprinted;
+        try {
+            reprinted = run_interp(parse_str(printed), reprinted_kind);
+        } catch (runtime_error &ex) {
+            reprinted = string("parse error: ") + ex.what();
+        }
+        if (reprinted != actual) {
+            o.failed = "print";
+            o.detail = "to_string() gave " + printed + ", which runs as " + reprinted;
+            return o;
+        }
+    }
+    return o;
+}
+
+/****************CORPUS****************/
+static set<unsigned int> features;
+static vector<NodeP> corpus;
+static const size_t MAX_CORPUS = 2000;
+
+//Adds the features of a run; true if any were new
+static bool add_features(const NodeP &program, const outcome_t &o) {
+    bool added = features.insert(0x10000u | (o.kind << 8) | o.type).second;
+    vector<NodeP> nodes;
+    collect(program, nodes);
+    for (size_t i = 0; i < nodes.size(); i++) {
+        for (size_t k = 0; k < nodes[i]->kids.size(); k++) {
+            unsigned int edge = (unsigned int) ((nodes[i]->kind * node_count + nodes[i]->kids[k]->kind) * 4 + k);
+            added = features.insert(edge).second || added;
+        }
+    }
+    return added;
+}
+
+//A copy of a corpus entry with one subtree regenerated for the same slot
+static NodeP mutate(const NodeP &original) {
+    NodeP program = copy_tree(original);
+    vector<NodeP> nodes;
+    collect(program, nodes);
+    NodeP target = nodes[pick((int) nodes.size())];
+    NodeP fresh = generate(target->slot, MAX_DEPTH / 2);
+    *target = *fresh;
+    return program;
+}
+
+/****************SHRINKING****************/
+//Smaller trees that could take n's place
+static vector<NodeP> shrink_candidates(const NodeP &n) {
+    vector<NodeP> out;
+    for (size_t i = 0; i < n->kids.size(); i++) {
+        out.push_back(n->kids[i]);
+        for (size_t k = 0; k < n->kids[i]->kids.size(); k++) {
+            out.push_back(n->kids[i]->kids[k]);
+        }
+    }
+    if (n->kind == node_num && n->num != 0) {
+        NodeP zero = make_node(node_num, n->slot);
+        zero->num = n->num / 2;
+        out.push_back(zero);
+    }
+    if (n->kind != node_num && n->kind != node_bool && n->kind != node_var) {
+        NodeP leaf = make_node(node_num, n->slot);
+        out.push_back(leaf);
+        leaf = make_node(node_bool, n->slot);
+        out.push_back(leaf);
+        for (size_t i = 0; i < n->slot.scope.size(); i++) {
+            leaf = make_node(node_var, n->slot);
+            leaf->name = n->slot.scope[i].name;
+            out.push_back(leaf);
+        }
+    }
+    return out;
+}
+
+/**
+ * \brief Shrinks a failing program while the same check keeps failing.
+ * \param program The failing program.
+ * \param failed The name of the check that failed.
+ * \return The smallest failing program found.
+ */
+static NodeP shrink(NodeP program, const string &failed) {
+    bool progress = true;
+    while (progress) {
+        progress = false;
+        vector<NodeP> nodes;
+        collect(program, nodes);
+        for (size_t i = 0; i < nodes.size() && !progress; i++) {
+            vector<NodeP> candidates = shrink_candidates(nodes[i]);
+            for (size_t c = 0; c < candidates.size() && !progress; c++) {
+                if (tree_size(candidates[c]) >= tree_size(nodes[i]) && candidates[c]->num == nodes[i]->num) {
+                    continue;
+                }
+                Node saved = *nodes[i];
+                *nodes[i] = *copy_tree(candidates[c]);
+                if (check(program).failed == failed) {
+                    progress = true;
+                } else {
+                    *nodes[i] = saved;
+                }
+            }
+        }
+    }
+    return program;
+}
+
+/****************MAIN****************/
+static void save_corpus_entry(const string &dir, size_t index, const NodeP &program) {
+    ofstream out(dir + "/" + std::to_string(index) + ".msd");
+    out << source_of(program) << "\n";
+}
+
+int main(int argc, char **argv) {
+    unsigned long long runs = 0;
+    double seconds = 10;
+    unsigned int seed = (unsigned int) chrono::steady_clock::now().time_since_epoch().count();
+    const char *corpus_dir = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            runs = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = (unsigned int) strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--corpus") == 0 && i + 1 < argc) {
+            corpus_dir = argv[++i];
+        } else if (strcmp(argv[i], "--check-print") == 0) {
+            check_print = true;
+        } else {
+            cerr << "Usage: msdscript_fuzz [--runs <n>] [--seconds <s>] [--seed <n>] [--corpus <dir>] [--check-print]\n";
+            return 1;
+        }
+    }
+    rng.seed(seed);
+    cout << "seed " << seed << "\n";
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    unsigned long long done = 0;
+    double elapsed = 0;
+    while (runs != 0 ? done < runs : elapsed < seconds) {
+        NodeP program;
+        if (!corpus.empty() && pick(2) == 0) {
+            program = mutate(corpus[pick((int) corpus.size())]);
+        } else {
+            slot_t top = { (fuzz_type_t) pick(type_count), vector<binding_t>(), true };
+            program = generate(top, 0);
+        }
+
+        outcome_t o = check(program);
+        done++;
+        if (!o.failed.empty()) {
+            cout << "FAILED " << o.failed << " after " << done << " runs: " << o.detail << "\n";
+            cout << "program:\n" << source_of(program) << "\n";
+            NodeP minimal = shrink(program, o.failed);
+            cout << "minimized:\n" << source_of(minimal) << "\n" << check(minimal).detail << "\n";
+            return 1;
+        }
+        if (add_features(program, o) && corpus.size() < MAX_CORPUS) {
+            if (corpus_dir != nullptr) {
+                save_corpus_entry(corpus_dir, corpus.size(), program);
+            }
+            corpus.push_back(program);
+        }
+        if ((done & 1023) == 0) {
+            elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        }
+    }
+    elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << done << " runs in " << elapsed << "s (" << (long long) (done / (elapsed > 0 ? elapsed : 1)) << "/s), "
+         << corpus.size() << " corpus entries, " << features.size() << " features\n";
+    return 0;
+}
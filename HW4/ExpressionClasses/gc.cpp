@@ -0,0 +1,146 @@
+/**
+ * \file gc.cpp
+ * \brief The GcNode list and the trial-deletion collector described in gc.h.
+ */
+
+#include "gc.h"
+
+using namespace std;
+
+THREAD_STATE gc_stats_t gc_stats = { 0, 0, 0 };
+THREAD_STATE size_t gc_allocated_since = 0;
+//At least this many new GcNodes between automatic collections
+static const size_t GC_MIN_THRESHOLD = 10000;
+THREAD_STATE size_t gc_threshold = GC_MIN_THRESHOLD;
+
+//This thread's list, made by its first GcNode
+static THREAD_STATE gc_list_t *gc_thread_list = nullptr;
+
+/**
+ * \brief Frees the thread's garbage cycles when it exits and hands what is left to its last GcNode.
+ */
+class GcListOwner {
+public:
+    ~GcListOwner() {
+        gc_collect();
+        if (gc_thread_list->head == nullptr) {
+            delete gc_thread_list;
+        } else {
+            gc_thread_list->orphaned = true;
+        }
+        gc_thread_list = nullptr;
+    }
+};
+
+static gc_list_t *gc_make_thread_list() {
+    static thread_local GcListOwner owner;
+    gc_thread_list = new gc_list_t();
+    gc_thread_list->head = nullptr;
+    gc_thread_list->orphaned = false;
+    return gc_thread_list;
+}
+
+GcNode::GcNode() {
+    gc_list = gc_thread_list != nullptr ? gc_thread_list : gc_make_thread_list();
+    gc_prev = nullptr;
+    gc_next = gc_list->head;
+    if (gc_list->head != nullptr) {
+        gc_list->head->gc_prev = this;
+    }
+    gc_list->head = this;
+    gc_stats.tracked++;
+    gc_allocated_since++;
+}
+
+GcNode::GcNode(const GcNode &) : GcNode() {
+}
+
+GcNode::~GcNode() {
+    if (gc_prev != nullptr) {
+        gc_prev->gc_next = gc_next;
+    } else {
+        gc_list->head = gc_next;
+    }
+    if (gc_next != nullptr) {
+        gc_next->gc_prev = gc_prev;
+    }
+    if (gc_list == gc_thread_list) {
+        gc_stats.tracked--;
+    } else if (gc_list->orphaned && gc_list->head == nullptr) {
+        delete gc_list;
+    }
+}
+
+/**
+ * \brief Frees every ExtendedEnv, FrameEnv, FunVal and ThunkVal made on this thread that is only reachable from a cycle.
+ * \return How many objects were freed.
+ */
+size_t gc_collect() {
+    gc_stats.collections++;
+    gc_allocated_since = 0;
+    gc_list_t *list = gc_thread_list;
+    vector<GcNode *> nodes;
+    for (GcNode *n = list != nullptr ? list->head : nullptr; n != nullptr; n = n->gc_next) {
+        //use_count includes the temporary made by gc_self()
+        n->gc_count = n->gc_self().use_count() - 1;
+        n->gc_live = false;
+        nodes.push_back(n);
+    }
+
+    //Take away the references that come from other tracked objects; another thread's are left alone
+    vector<GcNode *> edges;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        edges.clear();
+        nodes[i]->gc_edges(edges);
+        for (size_t e = 0; e < edges.size(); e++) {
+            if (edges[e]->gc_list == list) {
+                edges[e]->gc_count--;
+            }
+        }
+    }
+
+    //Whatever is still referenced from outside is live, along with everything it reaches
+    vector<GcNode *> pending;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i]->gc_count > 0 && !nodes[i]->gc_live) {
+            nodes[i]->gc_live = true;
+            pending.push_back(nodes[i]);
+        }
+        while (!pending.empty()) {
+            GcNode *n = pending.back();
+            pending.pop_back();
+            edges.clear();
+            n->gc_edges(edges);
+            for (size_t e = 0; e < edges.size(); e++) {
+                if (edges[e]->gc_list == list && !edges[e]->gc_live) {
+                    edges[e]->gc_live = true;
+                    pending.push_back(edges[e]);
+                }
+            }
+        }
+    }
+
+    //Hold the garbage while breaking it up, so nothing is freed mid-loop
+    vector<shared_ptr<void> > garbage;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (!nodes[i]->gc_live) {
+            garbage.push_back(nodes[i]->gc_self());
+        }
+    }
+    size_t freed = garbage.size();
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (!nodes[i]->gc_live) {
+            nodes[i]->gc_clear();
+        }
+    }
+    garbage.clear();
+
+    gc_stats.freed += freed;
+    //Collect again after the live set has at least doubled, so the cost per allocation stays constant
+    gc_threshold = nodes.size() - freed > GC_MIN_THRESHOLD ? nodes.size() - freed : GC_MIN_THRESHOLD;
+    return freed;
+}
+
+void gc_maybe_collect_slow() {
+    gc_collect();
+}
@@ -0,0 +1,92 @@
+/**
+ * \file gc.h
+ * \brief Cycle collector for the Val and Env objects that shared_ptr cannot free on its own.
+ *
+ * Only ExtendedEnv, FrameEnv, FunVal and ThunkVal hold pointers to other values
+ * and environments, so only they can form cycles (an environment that binds a
+ * closure or a thunk which captured that same environment). All of them derive
+ * from GcNode, which keeps every live one on a list.
+ *
+ * gc_collect() finds garbage cycles by trial deletion, the way CPython's
+ * collector works on top of its reference counts: for each object, count the
+ * references that come from other objects on the list. Any reference beyond
+ * those must come from outside (the C++ stack, a global, an Expr), so that
+ * object is live, and so is everything it reaches. What is left is only
+ * reachable from itself; its pointers are cleared and shared_ptr frees it.
+ * Because every outside reference is a real shared_ptr, a collection is safe
+ * at any point where no object is half constructed, even in the middle of
+ * interp().
+ *
+ * Each thread has its own list, counters and threshold, and collects only the
+ * objects it made, so threads that each interpret their own programs never
+ * touch each other's lists. An object may be freed on another thread once the
+ * thread that made it is no longer interpreting (for example after it has been
+ * joined); a list whose thread has exited is kept until its last object goes.
+ */
+
+#ifndef EXPRESSIONCLASSES_GC_H
+#define EXPRESSIONCLASSES_GC_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "pointer.h"
+
+class GcNode;
+
+//The GcNodes made by one thread
+typedef struct {
+    GcNode *head;           //most recently made; the list is linked through gc_prev/gc_next
+    bool orphaned;          //the thread has exited, so the last GcNode to go frees the list
+} gc_list_t;
+
+/**
+ * \brief Base class of every object that can be part of a reference cycle.
+ */
+class GcNode {
+public:
+    GcNode();
+    GcNode(const GcNode &);
+    virtual ~GcNode();
+
+    //The shared_ptr that owns this object
+    virtual std::shared_ptr<void> gc_self() = 0;
+    //Appends the GcNodes this object points to
+    virtual void gc_edges(std::vector<GcNode *> &out) = 0;
+    //Drops this object's pointers so a dead cycle falls apart
+    virtual void gc_clear() = 0;
+
+private:
+    gc_list_t *gc_list;
+    GcNode *gc_prev;
+    GcNode *gc_next;
+    long gc_count;
+    bool gc_live;
+
+    friend size_t gc_collect();
+};
+
+typedef struct {
+    unsigned long collections;
+    unsigned long long freed;
+    size_t tracked;             //GcNodes made on this thread and alive right now
+} gc_stats_t;
+
+//This thread's counters
+extern THREAD_STATE gc_stats_t gc_stats;
+
+//Collects the objects made on this thread
+size_t gc_collect();
+
+//Collects once enough GcNodes have been made since the last collection; called at safe points in interp()
+void gc_maybe_collect_slow();
+extern THREAD_STATE size_t gc_allocated_since;
+extern THREAD_STATE size_t gc_threshold;
+
+inline void gc_maybe_collect() {
+    if (gc_allocated_since >= gc_threshold) {
+        gc_maybe_collect_slow();
+    }
+}
+
+#endif //EXPRESSIONCLASSES_GC_H
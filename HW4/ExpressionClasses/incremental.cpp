@@ -0,0 +1,247 @@
+/**
+ * \file incremental.cpp
+ * \brief Closed-subtree hashing and the MemoExpr wrapper described in incremental.h.
+ */
+
+#include "incremental.h"
+#include "Val.h"
+#include "parse.hpp"
+#include "typecheck.h"
+
+#include <algorithm>
+#include <functional>
+
+using namespace std;
+
+thread_local incremental_stats_t incremental_stats = { 0, 0, 0 };
+
+/****************MEMOEXPR****************/
+MemoExpr::MemoExpr(PTR(Expr) expr, std::shared_ptr<memo_entry_t> entry) {
+    this->expr = std::move(expr);
+    this->entry = std::move(entry);
+    this->span = this->expr->span;
+    this->match = this->entry->expr == this->expr ? match_same : match_unknown;
+}
+
+/**
+ * \brief Compares the wrapped expression, looking through a MemoExpr on the other side too.
+ * \param e The expression you compare.
+ * \return true if the wrapped expression equals e.
+ */
+bool MemoExpr::equals(const PTR(Expr) &e) {
+    PTR(MemoExpr) other = CAST(MemoExpr)(e);
+    return expr->equals(other != nullptr ? other->expr : e);
+}
+
+/**
+ * \brief Returns the remembered value, or evaluates the subtree and remembers it.
+ * \param env Unused by the subtree, which is closed, but passed along when it is evaluated.
+ * \return The value of the wrapped expression.
+ */
+PTR(Val) MemoExpr::interp(const PTR(Env) &env) {
+    if (entry->value != nullptr) {
+        if (match == match_unknown) {
+            incremental_stats.compared++;
+            match = entry->expr == expr || entry->expr->equals(expr) ? match_same : match_different;
+        }
+        if (match == match_same) {
+            incremental_stats.reused++;
+            return entry->value;
+        }
+    }
+    incremental_stats.evaluated++;
+    PTR(Val) value = expr->interp(env);
+    //A different subtree with the same hash keeps the entry it found
+    if (entry->expr == expr) {
+        entry->value = value;
+    }
+    return value;
+}
+
+void MemoExpr::resolve(frames_t &scope) {
+    expr->resolve(scope);
+}
+
+void MemoExpr::print_to(string &out) {
+    expr->print_to(out);
+}
+
+void MemoExpr::emit_ast(AstWriter &out) {
+    expr->emit_ast(out);
+}
+
+PTR(Type) MemoExpr::infer(TypeChecker &tc) {
+    return expr->infer(tc);
+}
+
+void MemoExpr::pretty_print_at(PrettyStream &os, precedence_t node, bool let_parent, streampos &strmpos) {
+    expr->pretty_print_at(os, node, let_parent, strmpos);
+}
+
+/****************HASHING****************/
+static uint64_t mix(uint64_t h, uint64_t v) {
+    //FNV-1a over 64-bit words, with a final avalanche so nearby inputs spread out
+    h ^= v;
+    h *= 0x100000001b3ULL;
+    h ^= h >> 29;
+    return h;
+}
+
+static uint64_t mix(uint64_t h, const string &s) {
+    return mix(h, (uint64_t) std::hash<string>()(s));
+}
+
+static void add_free(vector<string> &to, const vector<string> &from) {
+    vector<string> merged;
+    std::set_union(to.begin(), to.end(), from.begin(), from.end(), back_inserter(merged));
+    to.swap(merged);
+}
+
+static void remove_free(vector<string> &from, const string &name) {
+    vector<string>::iterator it = std::lower_bound(from.begin(), from.end(), name);
+    if (it != from.end() && *it == name) {
+        from.erase(it);
+    }
+}
+
+/****************INCREMENTAL****************/
+Incremental::Incremental(size_t min_nodes) {
+    this->min_nodes = min_nodes;
+}
+
+/**
+ * \brief Prepares a new program, keeping only the entries it uses.
+ * \param e A freshly parsed program; its closed subtrees are replaced in place.
+ * \return The program to interpret, possibly a MemoExpr itself.
+ */
+PTR(Expr) Incremental::prepare(PTR(Expr) e) {
+    next.clear();
+    shape_t shape = visit(e);
+    if (shape.free.empty() && shape.nodes >= min_nodes) {
+        wrap(e, shape);
+    }
+    table.swap(next);
+    next.clear();
+    return e;
+}
+
+/**
+ * \brief Runs an edited program, evaluating only what is not remembered from the last one.
+ * \param source The program text.
+ * \return Its value.
+ */
+PTR(Val) Incremental::run(const string &source) {
+    PTR(Expr) e = prepare(parse_str(source));
+    mark_typed(e);
+    return e->interp(Env::empty);
+}
+
+void Incremental::wrap(PTR(Expr) &e, const shape_t &shape) {
+    std::shared_ptr<memo_entry_t> &entry = next[shape.hash];
+    if (entry == nullptr) {
+        std::unordered_map<uint64_t, std::shared_ptr<memo_entry_t> >::iterator old = table.find(shape.hash);
+        if (old != table.end()) {
+            entry = old->second;
+            if (entry->value == nullptr) {
+                //Never evaluated last time, so let this copy fill it in
+                entry->expr = e;
+            }
+        } else {
+            entry = std::make_shared<memo_entry_t>();
+            entry->expr = e;
+        }
+    }
+    e = NEW(MemoExpr)(e, entry);
+}
+
+//Visits a child, folds it into its parent's shape, and wraps it if it is a big enough closed subtree
+void Incremental::visit_child(PTR(Expr) &child, shape_t &parent) {
+    shape_t shape = visit(child);
+    parent.hash = mix(parent.hash, shape.hash);
+    parent.nodes += shape.nodes;
+    add_free(parent.free, shape.free);
+    if (shape.free.empty() && shape.nodes >= min_nodes) {
+        wrap(child, shape);
+    }
+}
+
+/**
+ * \brief Computes the hash, size and free variables of a subtree, wrapping its closed parts.
+ * \param e The subtree.
+ * \return Its shape.
+ */
+Incremental::shape_t Incremental::visit(PTR(Expr) &e) {
+    shape_t shape;
+    shape.nodes = 1;
+    if (PTR(Num) num = CAST(Num)(e)) {
+        shape.hash = mix(1, (uint64_t) (unsigned int) num->val);
+    } else if (PTR(Var) var = CAST(Var)(e)) {
+        shape.hash = mix(2, var->name);
+        shape.free.push_back(var->name);
+    } else if (PTR(BoolExpr) b = CAST(BoolExpr)(e)) {
+        shape.hash = mix(3, (uint64_t) b->val);
+    } else if (PTR(Add) add = CAST(Add)(e)) {
+        shape.hash = 4;
+        visit_child(add->lhs, shape);
+        visit_child(add->rhs, shape);
+    } else if (PTR(Mult) mult = CAST(Mult)(e)) {
+        shape.hash = 5;
+        visit_child(mult->lhs, shape);
+        visit_child(mult->rhs, shape);
+    } else if (PTR(Sum) sum = CAST(Sum)(e)) {
+        shape.hash = 13;
+        for (size_t i = 0; i < sum->operands.size(); i++) {
+            visit_child(sum->operands[i], shape);
+        }
+    } else if (PTR(Product) product = CAST(Product)(e)) {
+        shape.hash = 14;
+        for (size_t i = 0; i < product->operands.size(); i++) {
+            visit_child(product->operands[i], shape);
+        }
+    } else if (PTR(Let) let = CAST(Let)(e)) {
+        shape.hash = mix(6, let->lhs);
+        shape_t body;
+        body.hash = 0;
+        body.nodes = 0;
+        visit_child(let->bodyExpr, body);
+        remove_free(body.free, let->lhs);
+        visit_child(let->rhs, shape);
+        shape.hash = mix(shape.hash, body.hash);
+        shape.nodes += body.nodes;
+        add_free(shape.free, body.free);
+    } else if (PTR(LetRec) letrec = CAST(LetRec)(e)) {
+        shape.hash = mix(12, letrec->lhs);
+        visit_child(letrec->rhs, shape);
+        visit_child(letrec->bodyExpr, shape);
+        remove_free(shape.free, letrec->lhs);
+    } else if (PTR(IfExpr) ifExpr = CAST(IfExpr)(e)) {
+        shape.hash = 7;
+        visit_child(ifExpr->if_, shape);
+        visit_child(ifExpr->then_, shape);
+        visit_child(ifExpr->else_, shape);
+    } else if (PTR(EqExpr) eq = CAST(EqExpr)(e)) {
+        shape.hash = 8;
+        visit_child(eq->lhs, shape);
+        visit_child(eq->rhs, shape);
+    } else if (PTR(FunExpr) fun = CAST(FunExpr)(e)) {
+        shape.hash = mix(9, (uint64_t) fun->formalargs().size());
+        for (size_t i = 0; i < fun->formalargs().size(); i++) {
+            shape.hash = mix(shape.hash, fun->formalargs()[i]);
+        }
+        visit_child(fun->body, shape);
+        for (size_t i = 0; i < fun->formalargs().size(); i++) {
+            remove_free(shape.free, fun->formalargs()[i]);
+        }
+    } else if (PTR(CallExpr) call = CAST(CallExpr)(e)) {
+        shape.hash = mix(10, (uint64_t) call->actualArgs.size());
+        visit_child(call->toBeCalled, shape);
+        for (size_t i = 0; i < call->actualArgs.size(); i++) {
+            visit_child(call->actualArgs[i], shape);
+        }
+    } else {
+        //Already wrapped, or a node type this pass does not know; never treated as closed
+        shape.hash = 11;
+        shape.free.push_back("");
+    }
+    return shape;
+}
@@ -0,0 +1,101 @@
+/**
+ * \file incremental.h
+ * \brief Re-evaluation of an edited program that reuses the values of unchanged closed subtrees.
+ *
+ * A closed subtree (one with no free variables) has the same value wherever it
+ * appears, so once it has been evaluated its value can be kept. Incremental
+ * remembers, for every closed subtree of at least min_nodes nodes in the last
+ * program it ran, a structural hash, the subtree and its value. prepare()
+ * hashes the closed subtrees of the next program and wraps each one in a
+ * MemoExpr; when interp() reaches a MemoExpr whose subtree is equal to one
+ * from the previous run, it returns the old value without evaluating anything
+ * inside it. Only the changed regions, and the nodes enclosing them, are
+ * evaluated again.
+ *
+ * The new source is still parsed and hashed in full, but both are cheap linear
+ * passes next to evaluation. Only entries used by the latest program are kept,
+ * so memory follows the size of the current program.
+ */
+
+#ifndef EXPRESSIONCLASSES_INCREMENTAL_H
+#define EXPRESSIONCLASSES_INCREMENTAL_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include "pointer.h"
+#include "Expr.h"
+
+/**
+ * \brief A closed subtree from some run and, once it has been evaluated, its value.
+ */
+typedef struct {
+    PTR(Expr) expr;
+    PTR(Val) value;
+} memo_entry_t;
+
+/**
+ * \brief Stands in for a closed subtree, returning a value remembered from an earlier run.
+ * Printing, AST output, equality and type inference all go to the wrapped expression.
+ */
+class MemoExpr : public Expr, private Counted<stats_memo, MemoExpr> {
+public:
+    PTR(Expr) expr;
+    std::shared_ptr<memo_entry_t> entry;
+    //Whether expr is entry->expr or equal to it; decided once, since an entry's expr is fixed once it has a value
+    typedef enum {
+        match_unknown,
+        match_same,
+        match_different
+    } match_t;
+    match_t match;
+
+    MemoExpr(PTR(Expr) expr, std::shared_ptr<memo_entry_t> entry);
+    virtual bool equals(const PTR(Expr) &e);
+    virtual PTR(Val) interp(const PTR(Env) &env = nullptr);
+    virtual void print_to(string &out);
+    virtual void emit_ast(AstWriter &out);
+    virtual PTR(Type) infer(TypeChecker &tc);
+    virtual void resolve(frames_t &scope);
+    void pretty_print_at(PrettyStream &os, precedence_t node, bool let_parent, streampos &strmpos);
+};
+
+typedef struct {
+    unsigned long reused;       //MemoExprs that returned a value from an earlier run
+    unsigned long evaluated;    //MemoExprs that had to evaluate their subtree
+    unsigned long compared;     //deep comparisons of a subtree with an earlier run's
+} incremental_stats_t;
+
+//Counted per thread
+extern thread_local incremental_stats_t incremental_stats;
+
+/**
+ * \brief Remembers closed subtree values from one program to the next.
+ */
+class Incremental {
+public:
+    explicit Incremental(size_t min_nodes = 8);
+
+    //Wraps the closed subtrees of e in MemoExprs, reusing entries from the last program
+    PTR(Expr) prepare(PTR(Expr) e);
+    //Parses, prepares and interprets source
+    PTR(Val) run(const std::string &source);
+
+private:
+    typedef struct {
+        uint64_t hash;
+        size_t nodes;
+        std::vector<std::string> free;  //sorted
+    } shape_t;
+
+    size_t min_nodes;
+    std::unordered_map<uint64_t, std::shared_ptr<memo_entry_t> > table;
+    std::unordered_map<uint64_t, std::shared_ptr<memo_entry_t> > next;
+
+    shape_t visit(PTR(Expr) &e);
+    void visit_child(PTR(Expr) &child, shape_t &parent);
+    void wrap(PTR(Expr) &e, const shape_t &shape);
+};
+
+#endif //EXPRESSIONCLASSES_INCREMENTAL_H
@@ -15,11 +15,84 @@
 #include "pointer.h"
 #include "Env.h"
 #include "Val.h"
+#include "serialize.h"
+#include "cache.h"
+#include "profile.h"
+#include "stats.h"
+#include "budget.h"
+#include "serve.h"
+#include "typecheck.h"
+#include "csvmap.h"
+#include "trace.h"
+#include <iterator>
+#include <fstream>
 
 using namespace std;
 
+//The program text from stdin, kept so --profile-stacks can report line numbers
+static string source;
+
+//Parses the program on stdin, going through the cache when --cache-dir is given
+static PTR(Expr) parse_program() {
+    source.assign(istreambuf_iterator<char>(std::cin), istreambuf_iterator<char>());
+    if (run_options.cache_dir == nullptr) {
+        return parse_str(source);
+    }
+    return parse_cached(source, run_options.cache_dir);
+}
+
+//Marks a well-typed program for interp()'s unchecked fast paths. With --typecheck,
+//a program that has no type is reported and exits with status 1 instead of running.
+static void check_program(PTR(Expr) e) {
+    if (mark_typed(e) || !run_options.typecheck) {
+        return;
+    }
+    try {
+        infer_type(e);
+    } catch (TypeError &ex) {
+        cerr << "Error: " << ex.what() << "\n";
+        exit(1);
+    }
+}
+
+//Writes the --trace ring buffer, reporting a file that could not be written
+static void write_trace() {
+    if (!trace_write_file(run_options.trace_file, run_options.trace_binary, source)) {
+        cerr << "Could not write " << run_options.trace_file << "\n";
+    }
+}
+
+//Interprets a program within the --fuel/--max-bytes/--max-depth limits, as one
+//outermost frame when --profile-stacks is on. Going over a limit exits with status 2.
+//With --trace, any error first writes the calls leading up to it.
+static PTR(Val) interp_program(PTR(Expr) e) {
+    try {
+        EvalBudget budget(run_options.limits);
+        StackFrame frame(e.get(), "program", "", -1);
+        return e->interp(Env::empty);
+    } catch (BudgetExceeded &ex) {
+        if (trace_enabled) {
+            write_trace();
+        }
+        cerr << "Error: " << ex.what() << "\n";
+        exit(2);
+    } catch (...) {
+        if (trace_enabled) {
+            write_trace();
+        }
+        throw;
+    }
+}
+
 int main(int argc, char **argv) {
     run_mode_t runType = use_arguments(argc, argv);
+    profile_enabled = run_options.profile;
+    profile_stacks_enabled = run_options.stacks_file != nullptr;
+    lazy_let = run_options.lazy;
+    if (run_options.trace_file != nullptr) {
+        trace_start();
+        trace_on_signal(run_options.trace_file, run_options.trace_binary, &source);
+    }
 
     switch (runType) {
         case do_help:
@@ -27,6 +100,21 @@ int main(int argc, char **argv) {
             cout << "--Help: Check your options.\n";
             cout << "--Print: Print.\n";
             cout << "--Prettyprint: Runs pretty_print_at().\n";
+            cout << "--emit-ast <file>: Parses stdin and saves it as a binary AST.\n";
+            cout << "--load-ast <file>: Interprets a saved binary AST.\n";
+            cout << "--cache-dir <dir>: Reuses parsed programs saved in <dir>.\n";
+            cout << "--serve: Runs many programs sent over stdin as framed requests (see serve.h).\n";
+            cout << "--profile: Reports time per phase and per node type on stderr.\n";
+            cout << "--stats: Reports object counts and lookup depths on stderr as JSON.\n";
+            cout << "--profile-stacks <file>: Writes time per _let and _fun call stack as folded stacks.\n";
+            cout << "--fuel <steps>: Stops interpreting after this many steps.\n";
+            cout << "--max-bytes <n>: Stops interpreting after allocating this many bytes of values.\n";
+            cout << "--max-depth <n>: Stops interpreting when calls nest this deep.\n";
+            cout << "--typecheck: Rejects a program that has no static type before running it.\n";
+            cout << "--lazy: Evaluates each _let right-hand side only when the body first uses it.\n";
+            cout << "--map <file.csv>: Evaluates stdin once per row of the file, with each column bound to its name; booleans print as 1 and 0.\n";
+            cout << "--trace <file>: Records recent interp() calls and writes them to <file> on an error or SIGUSR1.\n";
+            cout << "--trace-binary <file>: Like --trace, in the compact binary form (see trace.h).\n";
             break;
         case do_tests:
             std::cout << "Before if sessions";
@@ -39,18 +127,62 @@ int main(int argc, char **argv) {
                 exit(0);
             }
         case do_interp: {
-            PTR(Expr) e = parse(std::cin);
-            cout << e->interp(Env::empty)->to_string() << "\n";
+            profile_phase("parse");
+            PTR(Expr) e = parse_program();
+            profile_phase("typecheck");
+            check_program(e);
+            profile_phase("interp");
+            PTR(Val) v = interp_program(e);
+            profile_phase("print");
+            cout << v->to_string() << "\n";
             break;
         }
         case do_print: {
-            PTR(Expr) e = parse(std::cin);
+            profile_phase("parse");
+            PTR(Expr) e = parse_program();
+            profile_phase("print");
             std::cout << e->to_string() << "\n";
             break;
         }
         case do_pretty_print: {
-            PTR(Expr) e = parse(std::cin);
-            std::cout << e->to_pretty_string() << "\n";
+            profile_phase("parse");
+            PTR(Expr) e = parse_program();
+            profile_phase("print");
+            e->pretty_print(std::cout);
+            std::cout << "\n";
+            break;
+        }
+        case do_emit_ast: {
+            profile_phase("parse");
+            PTR(Expr) e = parse_program();
+            profile_phase("emit");
+            emit_ast_file(e, run_options.ast_file);
+            break;
+        }
+        case do_load_ast: {
+            profile_phase("load");
+            PTR(Expr) e = load_ast_file(run_options.ast_file);
+            profile_phase("typecheck");
+            check_program(e);
+            profile_phase("interp");
+            PTR(Val) v = interp_program(e);
+            profile_phase("print");
+            cout << v->to_string() << "\n";
+            break;
+        }
+        case do_serve:
+            return serve(std::cin, std::cout, run_options.limits);
+        case do_map: {
+            profile_phase("parse");
+            PTR(Expr) e = parse_program();
+            profile_phase("map");
+            try {
+                map_csv_file(e, run_options.map_file, cout);
+            } catch (runtime_error &ex) {
+                cout.flush();
+                cerr << "Error: " << ex.what() << "\n";
+                exit(1);
+            }
             break;
         }
         case do_nothing:
@@ -59,5 +191,22 @@ int main(int argc, char **argv) {
             break;
     }
 
+    if (profile_enabled) {
+        cout.flush();
+        profile_report(cerr);
+    }
+    if (profile_stacks_enabled) {
+        ofstream stacks(run_options.stacks_file);
+        profile_stacks_report(stacks, source);
+        if (!stacks) {
+            cerr << "Could not write " << run_options.stacks_file << "\n";
+            return 1;
+        }
+    }
+    if (run_options.stats) {
+        cout.flush();
+        stats_report(cerr);
+    }
+
     return 0;
 }
@@ -3,6 +3,20 @@
 #include "pointer.h"
 using namespace std;
 
+//Offset of the next character, or -1 when the stream cannot seek (e.g. a pipe)
+static int position(istream &in) {
+    return (int) (streamoff) in.rdbuf()->pubseekoff(0, ios::cur, ios::in);
+}
+
+//Records where e came from in the source and returns it
+static PTR(Expr) spanned(PTR(Expr) e, int start, int end) {
+    if (start >= 0 && end >= 0) {
+        e->span.start = start;
+        e->span.end = end;
+    }
+    return e;
+}
+
 static void consume_word(istream &in, string str){
     for(char c : str){
         if (in.get()!=c){
@@ -11,7 +25,7 @@ static void consume_word(istream &in, string str){
     }
 }
 
-PTR(Expr) parse_if( std::istream &stream ){
+PTR(Expr) parse_if( std::istream &stream, int start ){
     skip_whitespace(stream);
 
     PTR(Expr) ifStatement = parse_expr(stream);
@@ -32,7 +46,7 @@ PTR(Expr) parse_if( std::istream &stream ){
 
     PTR(Expr) elseStatement = parse_expr(stream);
 
-    return NEW(IfExpr)(ifStatement, thenStatement, elseStatement);
+    return spanned(NEW(IfExpr)(ifStatement, thenStatement, elseStatement), start, elseStatement->span.end);
 }
 
 PTR(Expr) parse_expr(std::istream &in) {
@@ -45,36 +59,63 @@ PTR(Expr) parse_expr(std::istream &in) {
         }
         consume(in, '=');
         PTR(Expr) rhs = parse_expr(in);
-        return NEW (EqExpr)(e, rhs);
+        return spanned(NEW (EqExpr)(e, rhs), e->span.start, rhs->span.end);
     }
     return e;
 }
 
+//A run of + is collected in a loop rather than by recursion: two operands make an Add, more make one Sum
 PTR(Expr) parse_comparg(istream &in){
     PTR(Expr) e = parse_addend(in);
     skip_whitespace(in);
-    if (in.peek() == '+'){
+    if (in.peek() != '+'){
+        return e;
+    }
+    consume(in, '+');
+    PTR(Expr) rhs = parse_addend(in);
+    skip_whitespace(in);
+    if (in.peek() != '+'){
+        return spanned(NEW(Add)(e, rhs), e->span.start, rhs->span.end);
+    }
+    vector<PTR(Expr)> operands;
+    operands.push_back(e);
+    operands.push_back(rhs);
+    while (in.peek() == '+'){
         consume(in, '+');
-        PTR(Expr) rhs = parse_comparg(in);
-        return NEW(Add)(e, rhs);
+        operands.push_back(parse_addend(in));
+        skip_whitespace(in);
     }
-    return e;
+    int end = operands.back()->span.end;
+    return spanned(NEW(Sum)(std::move(operands)), e->span.start, end);
 }
 
+//Likewise for *: a Mult for two operands, a Product for more
 PTR(Expr) parse_addend(std::istream &in) {
     PTR(Expr) e;
     e = parse_multicand(in);
     skip_whitespace(in);
 
-    int c = in.peek();
-    if (c == '*') {
+    if (in.peek() != '*') {
+        return e;
+    }
+    consume(in, '*');
+    skip_whitespace(in);
+    PTR(Expr) rhs = parse_multicand(in);
+    skip_whitespace(in);
+    if (in.peek() != '*') {
+        return spanned(NEW(Mult)(e, rhs), e->span.start, rhs->span.end);
+    }
+    vector<PTR(Expr)> operands;
+    operands.push_back(e);
+    operands.push_back(rhs);
+    while (in.peek() == '*') {
         consume(in, '*');
         skip_whitespace(in);
-        PTR(Expr) rhs = parse_addend(in);
-        return NEW(Mult)(e, rhs);
-    } else {
-        return e;
+        operands.push_back(parse_multicand(in));
+        skip_whitespace(in);
     }
+    int end = operands.back()->span.end;
+    return spanned(NEW(Product)(std::move(operands)), e->span.start, end);
 }
 
 static string parse_term(istream &in){
@@ -95,9 +136,14 @@ PTR(Expr) parse_multicand(istream &in) {
     PTR(Expr) e = parse_inner(in);
     while (in.peek() == '(') {
         consume(in, '(');
-        PTR(Expr) actual_arg = parse_expr(in);
+        vector<PTR(Expr)> actual_args;
+        actual_args.push_back(parse_expr(in));
+        while (in.peek() == ',') {
+            consume(in, ',');
+            actual_args.push_back(parse_expr(in));
+        }
         consume(in, ')');
-        e = NEW(CallExpr)(e, actual_arg);
+        e = spanned(NEW(CallExpr)(e, actual_args), e->span.start, position(in));
     }
     return e;
 }
@@ -105,9 +151,11 @@ PTR(Expr) parse_multicand(istream &in) {
 PTR(Expr) parse_inner(std::istream &in) {
     skip_whitespace(in);
     int c = in.peek();
+    int start = position(in);
 
     if ((c == '-') || isdigit(c)){
-        return parse_num(in);
+        PTR(Expr) e = parse_num(in);
+        return spanned(e, start, position(in));
     }
 
     else if (c == '(') {
@@ -122,7 +170,8 @@ PTR(Expr) parse_inner(std::istream &in) {
     }
 
     else if (isalpha(c)) {
-        return parse_var(in);
+        PTR(Expr) e = parse_var(in);
+        return spanned(e, start, position(in));
     }
 
     else if (c=='_'){
@@ -131,19 +180,22 @@ PTR(Expr) parse_inner(std::istream &in) {
         string term = parse_term(in);
 
         if(term == "let"){
-            return parse_let(in);
+            return parse_let(in, start);
+        }
+        else if(term == "letrec"){
+            return parse_letrec(in, start);
         }
         else if(term == "if"){
-            return parse_if(in);
+            return parse_if(in, start);
         }
         else if(term == "true"){
-            return NEW(BoolExpr)(true);
+            return spanned(NEW(BoolExpr)(true), start, position(in));
         }
         else if(term == "false"){
-            return NEW(BoolExpr)(false);
+            return spanned(NEW(BoolExpr)(false), start, position(in));
         }
         else if(term == "fun"){
-            return parse_fun(in);
+            return parse_fun(in, start);
         }
         else{
             throw runtime_error("Invalid Input!");
@@ -231,12 +283,13 @@ PTR(Expr) parseInput() {
 }
 
 
-PTR(Expr) parse_let(std::istream &in){
+//The "<var> = <rhs> _in <body>" shared by _let and _letrec
+static void parse_binding(std::istream &in, string &lhs, PTR(Expr) &rhs, PTR(Expr) &body){
     skip_whitespace(in);
 
     PTR(Expr) e = parse_var(in);
 
-    string lhs = e->to_string();
+    lhs = e->to_string();
 
     skip_whitespace(in);
 
@@ -244,7 +297,7 @@ PTR(Expr) parse_let(std::istream &in){
 
     skip_whitespace(in);
 
-    PTR(Expr) rhs = parse_comparg(in);
+    rhs = parse_comparg(in);
 
     skip_whitespace(in);
 
@@ -252,9 +305,23 @@ PTR(Expr) parse_let(std::istream &in){
 
     skip_whitespace(in);
 
-    PTR(Expr) body = parse_comparg(in);
+    body = parse_comparg(in);
+}
+
+PTR(Expr) parse_let(std::istream &in, int start){
+    string lhs;
+    PTR(Expr) rhs;
+    PTR(Expr) body;
+    parse_binding(in, lhs, rhs, body);
+    return spanned(NEW(Let)(lhs, rhs, body), start, body->span.end);
+}
 
-    return NEW(Let)(lhs, rhs, body);
+PTR(Expr) parse_letrec(std::istream &in, int start){
+    string lhs;
+    PTR(Expr) rhs;
+    PTR(Expr) body;
+    parse_binding(in, lhs, rhs, body);
+    return spanned(NEW(LetRec)(lhs, rhs, body), start, body->span.end);
 }
 
 PTR(Expr)parse_var(std::istream &in){
@@ -277,14 +344,27 @@ PTR(Expr) parse_str(const string& s){
     return parse (in);
 }
 
-PTR(Expr) parse_fun(istream &in){
+PTR(Expr) parse_fun(istream &in, int start){
     skip_whitespace(in);
 
     consume(in, '(');
 
     PTR(Expr) e = parse_var(in);
 
-    string var = e->to_string();
+    vector<string> vars;
+    vars.push_back(e->to_string());
+
+    skip_whitespace(in);
+    while (in.peek() == ',') {
+        consume(in, ',');
+        skip_whitespace(in);
+        string var = parse_var(in)->to_string();
+        if (var.empty()) {
+            throw runtime_error("Invalid Input!");
+        }
+        vars.push_back(var);
+        skip_whitespace(in);
+    }
 
     consume(in, ')');
 
@@ -292,6 +372,6 @@ PTR(Expr) parse_fun(istream &in){
 
     e = parse_expr(in);
 
-    return NEW(FunExpr)(var, e);
+    return spanned(NEW(FunExpr)(vars, e), start, e->span.end);
 
 }
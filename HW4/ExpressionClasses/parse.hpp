@@ -54,7 +54,7 @@ PTR(Expr) parse_expr(std::istream &in);
 PTR(Expr) parse_expr(const std::string &in);
 PTR(Expr) parse_addend(std::istream &in);
 PTR(Expr) parse_bool( std::istream & stream );
-PTR(Expr) parse_if ( std::istream & stream );
+PTR(Expr) parse_if ( std::istream & stream, int start );
 PTR(Expr) parse_eqs ( std::istream & stream );
 PTR(Expr) parse_comparg( std::istream & stream );
 void consume(std::istream &in, int expect);
@@ -65,11 +65,12 @@ void skip_whitespace(std::istream &in);
 PTR(Expr) parse(std::istream &in);
 PTR(Expr) parse_str(const string& s);
 PTR(Expr) parse_var(std::istream &in);
-PTR(Expr) parse_let(std::istream &in);
+PTR(Expr) parse_let(std::istream &in, int start);
+PTR(Expr) parse_letrec(std::istream &in, int start);
 static void consumeWord(std::istream &in, std::string word);
 PTR(Expr) parseInput();
 std::string peek_keyword(std::istream &in);
-PTR(Expr) parse_fun(istream &in);
+PTR(Expr) parse_fun(istream &in, int start);
 PTR(Expr) parse_inner(std::istream &in);
 
 
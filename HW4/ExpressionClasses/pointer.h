@@ -26,4 +26,12 @@
 
 #endif
 
+//Per-thread state that interp() reads on every call. With the initial-exec model
+//a read is one instruction in libmsdscript.so too, not a call to __tls_get_addr.
+#if defined(__GNUC__)
+# define THREAD_STATE thread_local __attribute__((tls_model("initial-exec")))
+#else
+# define THREAD_STATE thread_local
+#endif
+
 #endif //EXPRESSIONCLASSES_POINTER_H
@@ -0,0 +1,95 @@
+/**
+ * \file prepared.cpp
+ * \brief Compiling and running the PreparedPrograms declared in prepared.h.
+ */
+
+#include "prepared.h"
+#include "parse.hpp"
+#include "typecheck.h"
+
+#include <stdexcept>
+
+using namespace std;
+
+/**
+ * \brief Parses a program and, if asked, marks it with what type inference proves.
+ * \param source The program text.
+ * \param inputs The names its inputs are bound to, in the order run() takes their values.
+ * \param optimize Whether to run type inference, with every input a number, and skip the checks it makes unnecessary.
+ * Throws runtime_error if source does not parse.
+ */
+PreparedProgram::PreparedProgram(const string &source, const vector<string> &inputs, bool optimize) {
+    this->expr = parse_str(source);
+    this->names = make_shared<const vector<string> >(inputs);
+    this->is_typed = false;
+    if (optimize) {
+        TypeChecker tc;
+        for (size_t i = 0; i < inputs.size(); i++) {
+            tc.bind(inputs[i], tc.num());
+        }
+        try {
+            expr->infer(tc);
+            for (size_t i = 0; i < tc.marks.size(); i++) {
+                tc.marks[i].node->statically_typed = resolve(tc.marks[i].operand)->kind == tc.marks[i].kind;
+            }
+            is_typed = true;
+        } catch (TypeError &) {
+        }
+    }
+    //Every run binds the inputs in the one frame that make_frame() builds
+    frames_t frames(1, inputs);
+    expr->resolve(frames);
+}
+
+void PreparedProgram::make_frame() {
+    args.clear();
+    vector<PTR(Val)> vals;
+    for (size_t i = 0; i < names->size(); i++) {
+        args.push_back(NEW(NumVal)(0));
+        vals.push_back(args.back());
+    }
+    frame = NEW(FrameEnv)(names, std::move(vals), Env::empty);
+}
+
+/**
+ * \brief Runs the program once.
+ * \param args The value of each input, in the order the names were given.
+ * \return What the program evaluates to.
+ * Throws runtime_error for the wrong number of values and for any error the program itself hits.
+ */
+PTR(Val) PreparedProgram::run(const vector<int> &args) {
+    if (args.size() != names->size()) {
+        throw runtime_error("Expected " + std::to_string(names->size()) + " inputs, got " +
+                            std::to_string(args.size()));
+    }
+    //The frame is only shared with this->args, and each number only with this->args and the frame;
+    //the first run makes it, so that it belongs to the thread that runs the program
+    bool reusable = frame != nullptr && frame.use_count() == 1;
+    for (size_t i = 0; reusable && i < this->args.size(); i++) {
+        reusable = this->args[i].use_count() == 2;
+    }
+    if (!reusable) {
+        make_frame();
+    }
+    for (size_t i = 0; i < args.size(); i++) {
+        this->args[i]->val = args[i];
+    }
+    return expr->interp(frame);
+}
+
+int PreparedProgram::run_int(const vector<int> &args) {
+    PTR(Val) v = run(args);
+    PTR(NumVal) n = CAST(NumVal)(v);
+    if (n == nullptr) {
+        throw runtime_error("The program did not return a number");
+    }
+    return n->val;
+}
+
+const vector<string> &PreparedProgram::inputs() {
+    return *names;
+}
+
+bool PreparedProgram::typed() {
+    return is_typed;
+}
@@ -0,0 +1,70 @@
+/**
+ * \file prepared.h
+ * \brief The embedding API of libmsdscript: programs compiled once and run many times.
+ *
+ * A PreparedProgram is made from program text and the names of its inputs.
+ * The text is parsed once, and, when the program passes type inference with
+ * every input a number, its checked operations are marked to skip their run
+ * time checks as mark_typed() does. Each run() binds the inputs to the given
+ * numbers in one frame and interprets the program again, so there is no
+ * parsing or checking per call; the first run also fixes where each variable
+ * is found, as Var does for any program it runs twice.
+ *
+ * The frame and the numbers in it are kept between runs and overwritten in
+ * place, unless something the last result still holds (a closure, or an input
+ * returned as the result) points at them, in which case fresh ones are made.
+ * A run that returns a number therefore allocates only what the program itself
+ * computes.
+ *
+ * A PreparedProgram is not safe to run from two threads at once; give each
+ * thread its own. It can be made on any thread, since nothing it keeps between
+ * runs exists before the first one. Everything else the interpreter keeps
+ * between calls (the cycle collector's list, budgets, counters) is per thread,
+ * so threads running their own PreparedPrograms share no state. The values a
+ * run returns belong to the thread that ran it: use them and drop them there,
+ * or on another thread once that one has stopped running programs (e.g. after
+ * it has been joined). The same goes for the PreparedProgram itself.
+ *
+ * To embed msdscript, build libmsdscript (make libmsdscript.a or
+ * libmsdscript.so, or the msdscript CMake target), include prepared.h and link
+ * with -lmsdscript.
+ */
+
+#ifndef EXPRESSIONCLASSES_PREPARED_H
+#define EXPRESSIONCLASSES_PREPARED_H
+
+#include <string>
+#include <vector>
+#include "pointer.h"
+#include "Expr.h"
+#include "Val.h"
+#include "Env.h"
+
+/**
+ * \brief A parsed program with named integer inputs, ready to be run many times.
+ */
+class PreparedProgram {
+public:
+    PreparedProgram(const std::string &source, const std::vector<std::string> &inputs, bool optimize = true);
+
+    //Interprets the program with the i'th input bound to args[i]
+    PTR(Val) run(const std::vector<int> &args);
+    //The same, for a program whose result is a number
+    int run_int(const std::vector<int> &args);
+
+    const std::vector<std::string> &inputs();
+    //Whether type inference succeeded and the run time checks it made unnecessary are skipped
+    bool typed();
+
+private:
+    PTR(Expr) expr;
+    std::shared_ptr<const std::vector<std::string> > names;
+    bool is_typed;
+    //Made by the first run() and reused while nothing else points at them
+    PTR(Env) frame;
+    std::vector<PTR(NumVal)> args;
+
+    void make_frame();
+};
+
+#endif //EXPRESSIONCLASSES_PREPARED_H
@@ -0,0 +1,189 @@
+/**
+ * \file profile.cpp
+ * \brief Collecting and reporting the timings declared in profile.h.
+ */
+
+#include "profile.h"
+
+#include <vector>
+#include <map>
+#include <iomanip>
+
+using namespace std;
+
+THREAD_STATE bool profile_enabled = false;
+THREAD_STATE bool profile_stacks_enabled = false;
+thread_local profile_counts_t profile_counts[prof_node_count];
+const char *const profile_node_names[prof_node_count] = {
+        "Num", "Var", "Add", "Mult", "Let", "BoolExpr", "IfExpr", "EqExpr", "FunExpr", "CallExpr", "LetRec", "Sum", "Product"
+};
+
+typedef struct {
+    const char *name;
+    long long ns;
+} profile_phase_t;
+
+static thread_local vector<profile_phase_t> phases;
+static thread_local chrono::steady_clock::time_point phase_started;
+//The innermost ProfileScope that is still running
+static thread_local ProfileScope *current_scope = nullptr;
+
+//A node of the call-stack tree; frames[0] is an unnamed root above the outermost frames
+typedef struct {
+    const char *kind;
+    std::string name;
+    int offset;
+    int parent;
+    long long self_ns;
+    map<const void *, int> children;
+} stack_frame_t;
+
+static thread_local vector<stack_frame_t> frames;
+static thread_local StackFrame *current_frame = nullptr;
+
+static long long elapsed_ns(chrono::steady_clock::time_point since) {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - since).count();
+}
+
+void ProfileScope::start(profile_node_t node) {
+    this->node = node;
+    this->child_ns = 0;
+    this->parent = current_scope;
+    current_scope = this;
+    this->started = chrono::steady_clock::now();
+}
+
+void ProfileScope::finish() {
+    long long ns = elapsed_ns(started);
+    profile_counts_t &counts = profile_counts[node];
+    counts.calls++;
+    counts.total_ns += ns;
+    counts.self_ns += ns - child_ns;
+    current_scope = parent;
+    if (parent != nullptr) {
+        parent->child_ns += ns;
+    }
+}
+
+/**
+ * \brief Ends the running phase (if any) and starts timing the next one.
+ * \param name The phase name shown in the report, e.g. "parse".
+ */
+void profile_phase(const char *name) {
+    if (!profile_enabled) {
+        return;
+    }
+    if (!phases.empty()) {
+        phases.back().ns = elapsed_ns(phase_started);
+    }
+    profile_phase_t phase = { name, 0 };
+    phases.push_back(phase);
+    phase_started = chrono::steady_clock::now();
+}
+
+void profile_reset() {
+    phases.clear();
+    for (int i = 0; i < prof_node_count; i++) {
+        profile_counts[i] = profile_counts_t();
+    }
+}
+
+/**
+ * \brief Ends the running phase and writes the phase and node tables.
+ * \param out Where to write the report; main uses stderr so stdout is unchanged.
+ * Node totals include time spent in child nodes, so nested types overlap.
+ */
+void profile_report(ostream &out) {
+    if (!phases.empty()) {
+        phases.back().ns = elapsed_ns(phase_started);
+    }
+    out << fixed << setprecision(3);
+    out << left << setw(10) << "phase" << right << setw(12) << "ms" << "\n";
+    for (size_t i = 0; i < phases.size(); i++) {
+        out << left << setw(10) << phases[i].name << right << setw(12) << phases[i].ns / 1e6 << "\n";
+    }
+    out << "\n" << left << setw(10) << "node" << right << setw(12) << "calls"
+        << setw(12) << "total ms" << setw(12) << "self ms" << "\n";
+    for (int i = 0; i < prof_node_count; i++) {
+        if (profile_counts[i].calls == 0) {
+            continue;
+        }
+        out << left << setw(10) << profile_node_names[i] << right << setw(12) << profile_counts[i].calls
+            << setw(12) << profile_counts[i].total_ns / 1e6 << setw(12) << profile_counts[i].self_ns / 1e6 << "\n";
+    }
+}
+
+void StackFrame::push(const void *site, const char *kind, const string &name, int offset) {
+    if (frames.empty()) {
+        stack_frame_t root = { "", "", -1, -1, 0, map<const void *, int>() };
+        frames.push_back(root);
+    }
+    int caller = current_frame == nullptr ? 0 : current_frame->frame;
+    map<const void *, int>::iterator found = frames[caller].children.find(site);
+    if (found == frames[caller].children.end()) {
+        stack_frame_t callee = { kind, name, offset, caller, 0, map<const void *, int>() };
+        frame = (int) frames.size();
+        frames.push_back(callee);
+        frames[caller].children[site] = frame;
+    } else {
+        frame = found->second;
+    }
+    child_ns = 0;
+    parent = current_frame;
+    current_frame = this;
+    started = chrono::steady_clock::now();
+}
+
+void StackFrame::pop() {
+    long long ns = elapsed_ns(started);
+    frames[frame].self_ns += ns - child_ns;
+    current_frame = parent;
+    if (parent != nullptr) {
+        parent->child_ns += ns;
+    }
+}
+
+void profile_stacks_reset() {
+    frames.clear();
+}
+
+//"line:column" of a source offset, both counted from 1
+static string source_location(const string &source, int offset) {
+    int line = 1;
+    int column = 1;
+    for (int i = 0; i < offset && i < (int) source.size(); i++) {
+        if (source[i] == '\n') {
+            line++;
+            column = 1;
+        } else {
+            column++;
+        }
+    }
+    return std::to_string(line) + ":" + std::to_string(column);
+}
+
+/**
+ * \brief Writes the self time of every call stack in folded-stack form.
+ * \param out Where to write, one "frame;frame;frame ns" line per stack.
+ * \param source The program text, used to turn offsets into line:column.
+ * Frames are named like "_let x @1:1" and "_fun n @3:9"; without the source
+ * (e.g. a program loaded from --load-ast) the byte offset is shown instead.
+ */
+void profile_stacks_report(ostream &out, const string &source) {
+    vector<string> labels(frames.size());
+    for (size_t i = 1; i < frames.size(); i++) {
+        stack_frame_t &f = frames[i];
+        string label = f.kind;
+        if (!f.name.empty()) {
+            label += " " + f.name;
+        }
+        if (f.offset >= 0) {
+            label += " @" + (source.empty() ? "+" + std::to_string(f.offset) : source_location(source, f.offset));
+        }
+        //Parents always come before their children, so their labels are already complete
+        labels[i] = f.parent == 0 ? label : labels[f.parent] + ";" + label;
+        if (f.self_ns > 0) {
+            out << labels[i] << " " << f.self_ns << "\n";
+        }
+    }
+}
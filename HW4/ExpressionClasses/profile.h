@@ -0,0 +1,116 @@
+/**
+ * \file profile.h
+ * \brief The --profile report: wall time per phase of main and per Expr subclass during interp.
+ *
+ * Every interp() starts with a ProfileScope for its node type. When profiling is
+ * off the scope only tests profile_enabled, so a normal run does no timing work.
+ *
+ * --profile-stacks keeps a second set of timings by msdscript call stack: each
+ * _let and each call to a _fun is a StackFrame named after its source position.
+ * The report is folded-stack text ("frame;frame;frame ns" per line), which
+ * flamegraph.pl, speedscope and similar tools read directly.
+ *
+ * Profiling is switched on, recorded and reported per thread.
+ */
+
+#ifndef EXPRESSIONCLASSES_PROFILE_H
+#define EXPRESSIONCLASSES_PROFILE_H
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include "pointer.h"
+
+typedef enum {
+    prof_num,
+    prof_var,
+    prof_add,
+    prof_mult,
+    prof_let,
+    prof_bool,
+    prof_if,
+    prof_eq,
+    prof_fun,
+    prof_call,
+    prof_letrec,
+    prof_sum,
+    prof_product,
+    prof_node_count
+} profile_node_t;
+
+typedef struct {
+    unsigned long calls;
+    long long total_ns;     //including the time spent in child nodes
+    long long self_ns;      //excluding it
+} profile_counts_t;
+
+extern THREAD_STATE bool profile_enabled;
+extern thread_local profile_counts_t profile_counts[prof_node_count];
+extern const char *const profile_node_names[prof_node_count];
+
+/**
+ * \brief Times one interp() call of a node type, from construction to destruction.
+ */
+class ProfileScope {
+public:
+    explicit ProfileScope(profile_node_t node) {
+        active = profile_enabled;
+        if (active) {
+            start(node);
+        }
+    }
+    ~ProfileScope() {
+        if (active) {
+            finish();
+        }
+    }
+
+private:
+    bool active;
+    profile_node_t node;
+    std::chrono::steady_clock::time_point started;
+    long long child_ns;
+    ProfileScope *parent;
+
+    void start(profile_node_t node);
+    void finish();
+};
+
+extern THREAD_STATE bool profile_stacks_enabled;
+
+/**
+ * \brief Times one _let or function call as a frame of the msdscript call stack.
+ * Every run of the same source node under the same caller shares a frame, keyed by site.
+ */
+class StackFrame {
+public:
+    StackFrame(const void *site, const char *kind, const std::string &name, int offset) {
+        active = profile_stacks_enabled;
+        if (active) {
+            push(site, kind, name, offset);
+        }
+    }
+    ~StackFrame() {
+        if (active) {
+            pop();
+        }
+    }
+
+private:
+    bool active;
+    int frame;
+    std::chrono::steady_clock::time_point started;
+    long long child_ns;
+    StackFrame *parent;
+
+    void push(const void *site, const char *kind, const std::string &name, int offset);
+    void pop();
+};
+
+void profile_phase(const char *name);
+void profile_reset();
+void profile_report(std::ostream &out);
+void profile_stacks_reset();
+void profile_stacks_report(std::ostream &out, const std::string &source);
+
+#endif //EXPRESSIONCLASSES_PROFILE_H
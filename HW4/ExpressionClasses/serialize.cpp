@@ -0,0 +1,313 @@
+/**
+ * \file serialize.cpp
+ * \brief Writing and reading the binary AST format described in serialize.h.
+ */
+
+#include "serialize.h"
+#include "Expr.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const char AST_MAGIC[4] = {'M', 'S', 'D', 'A'};
+
+//Seven bits per byte, high bit set while more bytes follow
+static void put_varint(string &out, unsigned int n) {
+    while (n >= 0x80) {
+        out += (char) ((n & 0x7f) | 0x80);
+        n >>= 7;
+    }
+    out += (char) n;
+}
+
+/****************AST WRITER****************/
+/**
+ * \brief Starts a node.
+ * \param t The node type.
+ * \param span Where the node came from, so profiles of loaded programs still point at the source.
+ */
+void AstWriter::tag(ast_tag_t t, const source_span_t &span) {
+    nodes += (char) t;
+    num(span.start);
+    num(span.end);
+}
+
+/**
+ * \brief Writes a number, zigzag encoded so small negative numbers stay short.
+ * \param n The number to write.
+ */
+void AstWriter::num(int n) {
+    unsigned int u = (unsigned int) n;
+    put_varint(nodes, (u << 1) ^ (n < 0 ? 0xffffffffu : 0u));
+}
+
+/**
+ * \brief Writes a name as an index into the name table.
+ * \param s The variable name.
+ */
+void AstWriter::name(const string &s) {
+    map<string, unsigned int>::iterator found = name_ids.find(s);
+    unsigned int id;
+    if (found == name_ids.end()) {
+        id = (unsigned int) names.size();
+        name_ids[s] = id;
+        names.push_back(s);
+    } else {
+        id = found->second;
+    }
+    put_varint(nodes, id);
+}
+
+/**
+ * \brief Builds the finished file contents.
+ * \return The header, the name table and the emitted nodes.
+ */
+string AstWriter::finish() {
+    string out(AST_MAGIC, sizeof(AST_MAGIC));
+    out += (char) AST_VERSION;
+    put_varint(out, (unsigned int) names.size());
+    for (size_t i = 0; i < names.size(); i++) {
+        put_varint(out, (unsigned int) names[i].size());
+        out += names[i];
+    }
+    out += nodes;
+    return out;
+}
+
+/****************AST READER****************/
+class AstReader {
+public:
+    AstReader(const char *data, size_t size) {
+        p = (const unsigned char *) data;
+        end = p + size;
+    }
+
+    void header() {
+        if (end - p < (long) sizeof(AST_MAGIC) + 1 || memcmp(p, AST_MAGIC, sizeof(AST_MAGIC)) != 0) {
+            throw runtime_error("Not an AST file!");
+        }
+        p += sizeof(AST_MAGIC);
+        if (*p++ != AST_VERSION) {
+            throw runtime_error("Unsupported AST file version!");
+        }
+        unsigned int count = varint();
+        names.reserve(count);
+        for (unsigned int i = 0; i < count; i++) {
+            unsigned int len = varint();
+            if ((size_t) (end - p) < len) {
+                throw runtime_error("Truncated AST file!");
+            }
+            names.push_back(string((const char *) p, len));
+            p += len;
+        }
+    }
+
+    PTR(Expr) expr() {
+        if (p == end) {
+            throw runtime_error("Truncated AST file!");
+        }
+        unsigned char tag = *p++;
+        source_span_t span;
+        span.start = num();
+        span.end = num();
+        PTR(Expr) e = node(tag);
+        e->span = span;
+        return e;
+    }
+
+    bool at_end() {
+        return p == end;
+    }
+
+private:
+    const unsigned char *p;
+    const unsigned char *end;
+    vector<string> names;
+
+    //The fields and children of a node whose tag has been read
+    PTR(Expr) node(unsigned char tag) {
+        switch (tag) {
+            case ast_num:
+                return NEW(Num)(num());
+            case ast_var:
+                return NEW(Var)(name());
+            case ast_add: {
+                PTR(Expr) lhs = expr();
+                return NEW(Add)(lhs, expr());
+            }
+            case ast_mult: {
+                PTR(Expr) lhs = expr();
+                return NEW(Mult)(lhs, expr());
+            }
+            case ast_let: {
+                const string &lhs = name();
+                PTR(Expr) rhs = expr();
+                return NEW(Let)(lhs, rhs, expr());
+            }
+            case ast_true:
+                return NEW(BoolExpr)(true);
+            case ast_false:
+                return NEW(BoolExpr)(false);
+            case ast_if: {
+                PTR(Expr) if_ = expr();
+                PTR(Expr) then_ = expr();
+                return NEW(IfExpr)(if_, then_, expr());
+            }
+            case ast_eq: {
+                PTR(Expr) lhs = expr();
+                return NEW(EqExpr)(lhs, expr());
+            }
+            case ast_fun: {
+                vector<string> formalargs(count());
+                for (size_t i = 0; i < formalargs.size(); i++) {
+                    formalargs[i] = name();
+                }
+                return NEW(FunExpr)(formalargs, expr());
+            }
+            case ast_call: {
+                vector<PTR(Expr)> actualArgs(count());
+                PTR(Expr) toBeCalled = expr();
+                for (size_t i = 0; i < actualArgs.size(); i++) {
+                    actualArgs[i] = expr();
+                }
+                return NEW(CallExpr)(toBeCalled, actualArgs);
+            }
+            case ast_letrec: {
+                const string &lhs = name();
+                PTR(Expr) rhs = expr();
+                return NEW(LetRec)(lhs, rhs, expr());
+            }
+            case ast_sum:
+                return NEW(Sum)(operands());
+            case ast_product:
+                return NEW(Product)(operands());
+            default:
+                throw runtime_error("Unknown node in AST file!");
+        }
+    }
+
+    unsigned int varint() {
+        unsigned int n = 0;
+        for (int shift = 0; shift < 35; shift += 7) {
+            if (p == end) {
+                throw runtime_error("Truncated AST file!");
+            }
+            unsigned char b = *p++;
+            n |= (unsigned int) (b & 0x7f) << shift;
+            if (!(b & 0x80)) {
+                return n;
+            }
+        }
+        throw runtime_error("Bad number in AST file!");
+    }
+
+    int num() {
+        unsigned int u = varint();
+        return (int) ((u >> 1) ^ (0u - (u & 1)));
+    }
+
+    //An argument count; every argument takes at least a byte, so a count past the end is corrupt
+    size_t count() {
+        int n = num();
+        if (n < 1 || n > end - p) {
+            throw runtime_error("Bad argument count in AST file!");
+        }
+        return (size_t) n;
+    }
+
+    //The operands of a Sum or Product, which always has at least two
+    vector<PTR(Expr)> operands() {
+        vector<PTR(Expr)> operands(count());
+        if (operands.size() < 2) {
+            throw runtime_error("Bad argument count in AST file!");
+        }
+        for (size_t i = 0; i < operands.size(); i++) {
+            operands[i] = expr();
+        }
+        return operands;
+    }
+
+    const string &name() {
+        unsigned int id = varint();
+        if (id >= names.size()) {
+            throw runtime_error("Bad name in AST file!");
+        }
+        return names[id];
+    }
+};
+
+/****************ENTRY POINTS****************/
+/**
+ * \brief Serializes an expression tree.
+ * \param e The root of the tree.
+ * \return The bytes of the AST file.
+ */
+string emit_ast(PTR(Expr) e) {
+    AstWriter out;
+    e->emit_ast(out);
+    return out.finish();
+}
+
+/**
+ * \brief Rebuilds an expression tree from the bytes written by emit_ast().
+ * \param data The start of the file contents.
+ * \param size The number of bytes.
+ * \return The root of the tree. Throws runtime_error if the bytes are not a valid AST file.
+ */
+PTR(Expr) load_ast(const char *data, size_t size) {
+    AstReader in(data, size);
+    in.header();
+    PTR(Expr) e = in.expr();
+    if (!in.at_end()) {
+        throw runtime_error("Trailing bytes in AST file!");
+    }
+    return e;
+}
+
+void emit_ast_file(PTR(Expr) e, const string &path) {
+    string bytes = emit_ast(e);
+    ofstream file(path.c_str(), ios::binary | ios::trunc);
+    file.write(bytes.data(), bytes.size());
+    file.close();
+    if (!file) {
+        throw runtime_error("Could not write " + path);
+    }
+}
+
+/**
+ * \brief Memory-maps an AST file and loads the tree in it.
+ * \param path The file written by emit_ast_file().
+ * \return The root of the tree.
+ */
+PTR(Expr) load_ast_file(const string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw runtime_error("Could not open " + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        throw runtime_error("Not an AST file!");
+    }
+    size_t size = (size_t) info.st_size;
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        throw runtime_error("Could not map " + path);
+    }
+    try {
+        PTR(Expr) e = load_ast((const char *) data, size);
+        munmap(data, size);
+        return e;
+    } catch (...) {
+        munmap(data, size);
+        throw;
+    }
+}
@@ -0,0 +1,65 @@
+/**
+ * \file serialize.h
+ * \brief Compact binary format for saving and loading Expr trees.
+ *
+ * A file starts with the magic bytes "MSDA" and a version byte, followed by a
+ * table of every name used in the program and then the nodes in pre-order.
+ * Each node is its tag, its source span and then its fields and children.
+ * Numbers, lengths and name indexes are stored as variable-length integers.
+ * Loading walks the bytes directly (the file is memory-mapped), so none of the
+ * character-level scanning in parse.cpp is repeated.
+ */
+
+#ifndef EXPRESSIONCLASSES_SERIALIZE_H
+#define EXPRESSIONCLASSES_SERIALIZE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include "pointer.h"
+#include "Expr.h"
+
+//Bump whenever the layout of the file changes
+const unsigned char AST_VERSION = 5;
+
+typedef enum {
+    ast_num = 1,
+    ast_var,
+    ast_add,
+    ast_mult,
+    ast_let,
+    ast_true,
+    ast_false,
+    ast_if,
+    ast_eq,
+    ast_fun,
+    ast_call,
+    ast_letrec,
+    ast_sum,
+    ast_product
+} ast_tag_t;
+
+/**
+ * \brief Collects the nodes of a tree as it is emitted.
+ * Each Expr subclass writes itself through emit_ast(), then finish() puts
+ * the header and the name table in front of the nodes.
+ */
+class AstWriter {
+public:
+    void tag(ast_tag_t t, const source_span_t &span);
+    void num(int n);
+    void name(const std::string &s);
+    std::string finish();
+
+private:
+    std::string nodes;
+    std::vector<std::string> names;
+    std::map<std::string, unsigned int> name_ids;
+};
+
+std::string emit_ast(PTR(Expr) e);
+PTR(Expr) load_ast(const char *data, size_t size);
+void emit_ast_file(PTR(Expr) e, const std::string &path);
+PTR(Expr) load_ast_file(const std::string &path);
+
+#endif //EXPRESSIONCLASSES_SERIALIZE_H
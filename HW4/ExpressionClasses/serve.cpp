@@ -0,0 +1,108 @@
+/**
+ * \file serve.cpp
+ * \brief Request loop for the --serve mode described in serve.h.
+ */
+
+#include "serve.h"
+#include "Expr.h"
+#include "Val.h"
+#include "Env.h"
+#include "parse.hpp"
+#include "gc.h"
+#include "typecheck.h"
+#include "incremental.h"
+
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+/**
+ * \brief Runs one program the way a separate msdscript process would.
+ * \param mode --interp, --print or --prettyprint.
+ * \param source The program text.
+ * \param limits Budget for --interp; zeros for no limit.
+ * \param out Set to what the run prints on stdout.
+ * \param err Set to what the run prints on stderr.
+ * \param incremental Values kept from earlier --incremental requests, or nullptr to run it like --interp.
+ * \return The exit code: 0 on success, 2 over budget, 1 for any other error.
+ */
+int run_request(const string &mode, const string &source, const eval_limits_t &limits, string &out, string &err,
+                Incremental *incremental) {
+    out.clear();
+    err.clear();
+    try {
+        PTR(Expr) e = parse_str(source);
+        if (mode == "--interp") {
+            mark_typed(e);
+            EvalBudget budget(limits);
+            out = e->interp(Env::empty)->to_string();
+        } else if (mode == "--incremental") {
+            if (incremental != nullptr) {
+                e = incremental->prepare(e);
+            }
+            mark_typed(e);
+            EvalBudget budget(limits);
+            out = e->interp(Env::empty)->to_string();
+        } else if (mode == "--print") {
+            out = e->to_string();
+        } else if (mode == "--prettyprint") {
+            out = e->to_pretty_string();
+        } else {
+            err = "Unknown mode " + mode + "!\n";
+            return 1;
+        }
+        out += "\n";
+        return 0;
+    } catch (BudgetExceeded &ex) {
+        err = string("Error: ") + ex.what() + "\n";
+        return 2;
+    } catch (runtime_error &ex) {
+        err = string("Error: ") + ex.what() + "\n";
+        return 1;
+    }
+}
+
+/**
+ * \brief Answers framed requests until the input ends.
+ * \param in Where requests come from; stdin for --serve.
+ * \param out Where responses go; flushed after each one.
+ * \param limits Budget applied to every --interp request.
+ * \return 0 when the input ended cleanly, 1 for a malformed request.
+ */
+int serve(istream &in, ostream &out, const eval_limits_t &limits) {
+    out << SERVE_GREETING << "\n" << flush;
+    string header;
+    string source;
+    string result;
+    string error;
+    Incremental incremental;
+    while (getline(in, header)) {
+        istringstream fields(header);
+        string mode;
+        string digits;
+        if (!(fields >> mode >> digits) || digits.size() > 9) {
+            return 1;
+        }
+        //Only digits, so "-1" and "1e9" are malformed rather than read as huge lengths
+        size_t length = 0;
+        for (size_t i = 0; i < digits.size(); i++) {
+            if (digits[i] < '0' || digits[i] > '9') {
+                return 1;
+            }
+            length = length * 10 + (size_t) (digits[i] - '0');
+        }
+        if (length > SERVE_MAX_SOURCE) {
+            return 1;
+        }
+        source.resize(length);
+        if (length > 0 && !in.read(&source[0], (streamsize) length)) {
+            return 1;
+        }
+        int code = run_request(mode, source, limits, result, error, &incremental);
+        //Nothing from this request is referenced any more, so any cycles it made can go now
+        gc_collect();
+        out << code << " " << result.size() << " " << error.size() << "\n" << result << error << flush;
+    }
+    return 0;
+}
@@ -0,0 +1,39 @@
+/**
+ * \file serve.h
+ * \brief The --serve co-process mode: many programs over one stdin/stdout.
+ *
+ * On start the server writes the greeting line SERVE_GREETING. Each request is
+ * a line "<mode> <length>" followed by exactly length bytes of program text,
+ * where mode is one of --interp, --print, --prettyprint or --incremental. The
+ * last is --interp for a program that is an edit of the one before: values of
+ * closed subtrees that did not change are reused (see incremental.h). Each response is a
+ * line "<exit code> <stdout length> <stderr length>" followed by the stdout
+ * bytes and then the stderr bytes. Stdout is what a separate run with that
+ * mode prints; an error gives exit code 1 (2 when over a --fuel, --max-bytes or
+ * --max-depth limit) and its message instead of aborting. The server exits
+ * when its input ends, or with 1 at a malformed request: a header that is not
+ * a mode and a plain decimal length of at most SERVE_MAX_SOURCE, or input that
+ * ends before the program does.
+ *
+ * CoProcess in exec.h is the client side.
+ */
+
+#ifndef EXPRESSIONCLASSES_SERVE_H
+#define EXPRESSIONCLASSES_SERVE_H
+
+#include <iostream>
+#include <string>
+#include "budget.h"
+
+class Incremental;
+
+//Change the number whenever the framing changes
+const char *const SERVE_GREETING = "msdscript-serve 1";
+//The longest program a request may carry, in bytes
+const size_t SERVE_MAX_SOURCE = 64 << 20;
+
+int run_request(const std::string &mode, const std::string &source, const eval_limits_t &limits,
+                std::string &out, std::string &err, Incremental *incremental = nullptr);
+int serve(std::istream &in, std::ostream &out, const eval_limits_t &limits);
+
+#endif //EXPRESSIONCLASSES_SERVE_H
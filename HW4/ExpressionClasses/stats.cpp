@@ -0,0 +1,63 @@
+/**
+ * \file stats.cpp
+ * \brief Storage and the --stats report for the counters in stats.h.
+ */
+
+#include "stats.h"
+#include "gc.h"
+
+using namespace std;
+
+thread_local stats_counts_t stats_counts[stats_class_count];
+const char *const stats_class_names[stats_class_count] = {
+        "Num", "Var", "Add", "Mult", "Let", "BoolExpr", "IfExpr", "EqExpr", "FunExpr", "CallExpr", "MemoExpr", "LetRec",
+        "Sum", "Product", "NumVal", "BoolVal", "FunVal", "ThunkVal", "EmptyEnv", "ExtendedEnv", "FrameEnv"
+};
+thread_local size_t stats_live_bytes = 0;
+thread_local size_t stats_peak_bytes = 0;
+thread_local unsigned long stats_lookup_depths[STATS_MAX_DEPTH + 1];
+thread_local int stats_lookup_frames = 0;
+
+/**
+ * \brief Clears the totals, the peak and the lookup histogram.
+ * Live counts are kept, since those objects still exist; the peak restarts from the current live bytes.
+ */
+void stats_reset() {
+    for (int i = 0; i < stats_class_count; i++) {
+        stats_counts[i].total = stats_counts[i].live;
+    }
+    stats_peak_bytes = stats_live_bytes;
+    for (int i = 0; i <= STATS_MAX_DEPTH; i++) {
+        stats_lookup_depths[i] = 0;
+    }
+    stats_lookup_frames = 0;
+}
+
+/**
+ * \brief Writes every counter as one JSON object.
+ * \param out Where to write; main uses stderr for --stats.
+ */
+void stats_report(ostream &out) {
+    out << "{\"enabled\": " << (MSD_STATS ? "true" : "false");
+#if MSD_STATS
+    out << ", \"classes\": {";
+    for (int i = 0; i < stats_class_count; i++) {
+        out << (i ? ", " : "") << "\"" << stats_class_names[i] << "\": {\"live\": " << stats_counts[i].live
+            << ", \"total\": " << stats_counts[i].total << "}";
+    }
+    out << "}, \"live_bytes\": " << stats_live_bytes << ", \"peak_live_bytes\": " << stats_peak_bytes;
+    out << ", \"lookup_depths\": {";
+    bool first = true;
+    for (int i = 0; i <= STATS_MAX_DEPTH; i++) {
+        if (stats_lookup_depths[i] == 0) {
+            continue;
+        }
+        out << (first ? "" : ", ") << "\"" << i << (i == STATS_MAX_DEPTH ? "+" : "") << "\": " << stats_lookup_depths[i];
+        first = false;
+    }
+    out << "}";
+#endif
+    out << ", \"gc\": {\"collections\": " << gc_stats.collections << ", \"freed\": " << gc_stats.freed
+        << ", \"tracked\": " << gc_stats.tracked << "}";
+    out << "}\n";
+}
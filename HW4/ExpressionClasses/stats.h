@@ -0,0 +1,131 @@
+/**
+ * \file stats.h
+ * \brief Object and environment-lookup counters for the interpreter.
+ *
+ * Every Expr, Val and Env subclass also derives from Counted, which counts the
+ * objects of that class that are live and that were ever created, along with
+ * the live and peak bytes they take up (sizeof the object, not counting the
+ * shared_ptr control block). ExtendedEnv::lookup records how many frames each
+ * lookup walked. Each thread has its own counters.
+ *
+ * The counters exist only when built with -DMSD_STATS=1, as the msdscript
+ * target is. Otherwise MSD_STATS is 0, which the optimized targets and
+ * libmsdscript use, and every hook below is an empty inline function.
+ */
+
+#ifndef EXPRESSIONCLASSES_STATS_H
+#define EXPRESSIONCLASSES_STATS_H
+
+#include <cstddef>
+#include <iostream>
+#include "budget.h"
+
+#ifndef MSD_STATS
+# define MSD_STATS 0
+#endif
+
+typedef enum {
+    stats_num,
+    stats_var,
+    stats_add,
+    stats_mult,
+    stats_let,
+    stats_bool_expr,
+    stats_if,
+    stats_eq,
+    stats_fun,
+    stats_call,
+    stats_memo,
+    stats_letrec,
+    stats_sum,
+    stats_product,
+    stats_num_val,
+    stats_bool_val,
+    stats_fun_val,
+    stats_thunk_val,
+    stats_empty_env,
+    stats_extended_env,
+    stats_frame_env,
+    stats_class_count
+} stats_class_t;
+
+//Lookups that walk this many frames or more share the last histogram bucket
+const int STATS_MAX_DEPTH = 64;
+
+typedef struct {
+    unsigned long live;
+    unsigned long total;
+} stats_counts_t;
+
+extern thread_local stats_counts_t stats_counts[stats_class_count];
+extern const char *const stats_class_names[stats_class_count];
+extern thread_local size_t stats_live_bytes;
+extern thread_local size_t stats_peak_bytes;
+//stats_lookup_depths[d] is the number of lookups that walked d frames
+extern thread_local unsigned long stats_lookup_depths[STATS_MAX_DEPTH + 1];
+extern thread_local int stats_lookup_frames;
+
+inline void stats_created(stats_class_t c, size_t bytes) {
+#if MSD_STATS
+    stats_counts[c].live++;
+    stats_counts[c].total++;
+    stats_live_bytes += bytes;
+    if (stats_live_bytes > stats_peak_bytes) {
+        stats_peak_bytes = stats_live_bytes;
+    }
+#endif
+}
+
+inline void stats_destroyed(stats_class_t c, size_t bytes) {
+#if MSD_STATS
+    stats_counts[c].live--;
+    stats_live_bytes -= bytes;
+#endif
+}
+
+//Called for each frame a lookup examines
+inline void stats_lookup_step() {
+#if MSD_STATS
+    stats_lookup_frames++;
+#endif
+}
+
+//Called once a lookup has found its binding or run out of frames
+inline void stats_lookup_done() {
+#if MSD_STATS
+    stats_lookup_depths[stats_lookup_frames < STATS_MAX_DEPTH ? stats_lookup_frames : STATS_MAX_DEPTH]++;
+    stats_lookup_frames = 0;
+#endif
+}
+
+//Called when a lookup_at() misses; the lookup() that follows counts its own frames
+inline void stats_lookup_abandon() {
+#if MSD_STATS
+    stats_lookup_frames = 0;
+#endif
+}
+
+/**
+ * \brief Base class that counts the objects of class T, reported as c.
+ * It also charges each object to the running EvalBudget, if there is one.
+ */
+template <stats_class_t c, class T>
+class Counted {
+protected:
+    Counted() {
+        budget_charge(sizeof(T));
+        stats_created(c, sizeof(T));
+    }
+    Counted(const Counted &) {
+        budget_charge(sizeof(T));
+        stats_created(c, sizeof(T));
+    }
+    ~Counted() {
+        stats_destroyed(c, sizeof(T));
+    }
+};
+
+void stats_reset();
+void stats_report(std::ostream &out);
+
+#endif //EXPRESSIONCLASSES_STATS_H
@@ -43,18 +43,17 @@ int main (int argc, const char **argv){
     srand(static_cast<unsigned int>(time(0)));
 
     if (argc == 2) {
-        const char *const interp1_argv[] = {argv[1], "--interp"};
-        const char *const print1_argv[] = {argv[1], "--print"};
-        const char *const prettyprint1_argv[] = {argv[1], "--prettyprint"};
+        //One long-lived process per msdscript instead of one per input
+        CoProcess msdscript1(argv[1]);
 
         for (int i = 0; i < 100; i++) {
             string in = random_expr_string(0);
             cout << "Trying: \n" << in << "\n";
-            ExecResult interp1_result = exec_program(2, interp1_argv, in);
-            ExecResult print1_result = exec_program(2, print1_argv, in);
-            ExecResult prettyprint1_result = exec_program(2, prettyprint1_argv, in);
+            ExecResult interp1_result = msdscript1.run("--interp", in);
+            ExecResult print1_result = msdscript1.run("--print", in);
+            ExecResult prettyprint1_result = msdscript1.run("--prettyprint", in);
 
-            ExecResult interp_again = exec_program(2, interp1_argv, print1_result.out);
+            ExecResult interp_again = msdscript1.run("--interp", print1_result.out);
             if (interp_again.out != interp1_result.out) {
                 cout << "Different results for printed";
             }
@@ -63,21 +62,16 @@ int main (int argc, const char **argv){
     }
 
     else if (argc == 3){
-        const char * const interp1_argv[] = { argv[1], "--interp"};
-        const char * const print1_argv[] = {argv[1], "--print"};
-        const char * const prettyprint1_argv[] = {argv[1], "--prettyprint"};
-
-        const char * const interp2_argv[] = {argv[2], "--interp"};
-        const char * const print2_argv[] = {argv[2], "--print"};
-        const char * const prettyprint2_argv[] = {argv[2], "--prettyprint"};
+        CoProcess msdscript1(argv[1]);
+        CoProcess msdscript2(argv[2]);
 
         for (int i = 0; i < 100; i++){
             string in = random_expr_string(0);
             std::cout << "Trying: \n" << in << "\n";
 
             //Test interp!
-            ExecResult interp1_result = exec_program(2, interp1_argv, in);
-            ExecResult interp2_result = exec_program(2, interp2_argv, in);
+            ExecResult interp1_result = msdscript1.run("--interp", in);
+            ExecResult interp2_result = msdscript2.run("--interp", in);
             if (interp1_result.out != interp2_result.out){
                 cout << "Msdscript INTERP: " << interp1_result.out;
                 cout << "Tester INTERP: " << interp2_result.out << "\n";
@@ -85,16 +79,16 @@ int main (int argc, const char **argv){
             }
 
             //Test print!
-            ExecResult print1_result = exec_program(2, print1_argv, in);
-            ExecResult print2_result = exec_program(2, print2_argv, in);
+            ExecResult print1_result = msdscript1.run("--print", in);
+            ExecResult print2_result = msdscript2.run("--print", in);
             if (print1_result.out != print2_result.out){
                 cout << "Msdscript PRINT: " << print1_result.out;
                 cout << "Tester PRINT: " << print2_result.out;
                 throw std::runtime_error("Different results - PRINT!");
             }
 
-            ExecResult prettyprint1_result = exec_program(2, prettyprint1_argv, in);
-            ExecResult prettyprint2_result = exec_program(2, prettyprint2_argv, in);
+            ExecResult prettyprint1_result = msdscript1.run("--prettyprint", in);
+            ExecResult prettyprint2_result = msdscript2.run("--prettyprint", in);
             if (prettyprint1_result.out != prettyprint2_result.out){
                 cout << "Msdscript PRETTY PRINT: " << prettyprint1_result.out;
                 cout << "Tester PRETTY PRINT: " << prettyprint2_result.out;
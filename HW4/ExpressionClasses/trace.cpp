@@ -0,0 +1,209 @@
+/**
+ * \file trace.cpp
+ * \brief The ring buffer behind TraceScope, and writing it out as declared in trace.h.
+ */
+
+#include "trace.h"
+#include "Val.h"
+
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <csignal>
+#include <typeinfo>
+
+using namespace std;
+
+THREAD_STATE bool trace_enabled = false;
+static thread_local vector<trace_event_t> ring;
+static thread_local size_t ring_mask = 0;
+static thread_local unsigned long long recorded = 0;
+//TraceScopes alive right now
+static thread_local unsigned int depth = 0;
+
+//Set by the SIGUSR1 handler and acted on by the next TraceScope, outside the handler
+static volatile sig_atomic_t dump_requested = 0;
+static const char *signal_path = nullptr;
+static bool signal_binary = false;
+static const string *signal_source = nullptr;
+
+static const unsigned char TRACE_VERSION = 1;
+//Deeper events are indented no further in the text form; their depth is still shown
+static const unsigned short TRACE_INDENT = 32;
+
+/**
+ * \brief Allocates the ring and turns tracing on, dropping anything recorded before.
+ * \param events The least number of events to keep; rounded up to a power of two.
+ */
+void trace_start(size_t events) {
+    size_t size = 1;
+    while (size < events) {
+        size <<= 1;
+    }
+    ring.assign(size, trace_event_t());
+    ring_mask = size - 1;
+    recorded = 0;
+    depth = 0;
+    trace_enabled = true;
+}
+
+void trace_stop() {
+    trace_enabled = false;
+}
+
+unsigned long long trace_total() {
+    return recorded;
+}
+
+static void record(profile_node_t node, int offset, trace_kind_t kind) {
+    trace_event_t &e = ring[recorded & ring_mask];
+    e.offset = offset;
+    e.depth = (unsigned short) (depth < 65535 ? depth : 65535);
+    e.node = (unsigned char) node;
+    e.kind = (unsigned char) kind;
+    recorded++;
+}
+
+void TraceScope::enter(profile_node_t node, int offset) {
+    if (dump_requested) {
+        dump_requested = 0;
+        trace_write_file(signal_path, signal_binary, *signal_source);
+    }
+    this->node = node;
+    this->offset = offset;
+    this->kind = trace_threw;
+    record(node, offset, trace_enter);
+    depth++;
+}
+
+void TraceScope::leave() {
+    //A trace_start() inside this scope has already reset the depth
+    if (depth > 0) {
+        depth--;
+    }
+    record(node, offset, kind);
+}
+
+trace_kind_t TraceScope::kind_of(const Val *v) {
+    if (typeid(*v) == typeid(NumVal)) {
+        return trace_num;
+    }
+    if (typeid(*v) == typeid(BoolVal)) {
+        return trace_bool;
+    }
+    if (typeid(*v) == typeid(FunVal)) {
+        return trace_fun;
+    }
+    return trace_thunk;
+}
+
+//The events still in the ring, oldest first, as indexes into it
+static void kept(unsigned long long &first, size_t &count) {
+    count = recorded < ring.size() ? (size_t) recorded : ring.size();
+    first = recorded - count;
+}
+
+/**
+ * \brief Writes the ring as text, one line per event, indented by depth.
+ * \param out Where to write.
+ * \param source The program text, used to turn offsets into line:column; without it the byte offset is shown.
+ * A start reads "N D > Node @line:col" and an end "N D < Node @line:col kind", where N counts events from
+ * trace_start(), D is the depth and kind is num, bool, fun, thunk or threw.
+ */
+void trace_dump_text(ostream &out, const string &source) {
+    static const char *const kind_names[] = { "", "num", "bool", "fun", "thunk", "threw" };
+    vector<size_t> lines(1, 0);
+    for (size_t i = 0; i < source.size(); i++) {
+        if (source[i] == '\n') {
+            lines.push_back(i + 1);
+        }
+    }
+    unsigned long long first;
+    size_t count;
+    kept(first, count);
+    out << "# msdscript trace: last " << count << " of " << recorded << " events\n";
+    string line;
+    for (size_t i = 0; i < count; i++) {
+        const trace_event_t &e = ring[(first + i) & ring_mask];
+        line.clear();
+        line += std::to_string(first + i);
+        line += ' ';
+        line += std::to_string(e.depth);
+        line += ' ';
+        line.append(2 * (size_t) (e.depth < TRACE_INDENT ? e.depth : TRACE_INDENT), ' ');
+        line += e.kind == trace_enter ? "> " : "< ";
+        line += e.node < prof_node_count ? profile_node_names[e.node] : "?";
+        if (e.offset >= 0) {
+            line += " @";
+            if (source.empty()) {
+                line += "+" + std::to_string(e.offset);
+            } else {
+                size_t l = (size_t) (upper_bound(lines.begin(), lines.end(), (size_t) e.offset) - lines.begin());
+                line += std::to_string(l) + ":" + std::to_string(e.offset - lines[l - 1] + 1);
+            }
+        }
+        if (e.kind != trace_enter) {
+            line += ' ';
+            line += e.kind <= trace_threw ? kind_names[e.kind] : "?";
+        }
+        line += '\n';
+        out.write(line.data(), (streamsize) line.size());
+    }
+}
+
+//Appends the low bytes of n, least significant first
+static void put_le(string &out, unsigned long long n, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        out += (char) ((n >> (8 * i)) & 0xff);
+    }
+}
+
+/**
+ * \brief Writes the ring in the binary form described in trace.h.
+ * \param out Where to write; it should be opened in binary mode.
+ */
+void trace_dump_binary(ostream &out) {
+    unsigned long long first;
+    size_t count;
+    kept(first, count);
+    string bytes("MSDT");
+    bytes += (char) TRACE_VERSION;
+    put_le(bytes, count, 4);
+    put_le(bytes, first, 8);
+    bytes.reserve(bytes.size() + 8 * count);
+    for (size_t i = 0; i < count; i++) {
+        const trace_event_t &e = ring[(first + i) & ring_mask];
+        put_le(bytes, (unsigned int) e.offset, 4);
+        put_le(bytes, e.depth, 2);
+        bytes += (char) e.node;
+        bytes += (char) e.kind;
+    }
+    out.write(bytes.data(), (streamsize) bytes.size());
+}
+
+bool trace_write_file(const char *path, bool binary, const string &source) {
+    ofstream file(path, binary ? ios::out | ios::binary : ios::out);
+    if (binary) {
+        trace_dump_binary(file);
+    } else {
+        trace_dump_text(file, source);
+    }
+    return (bool) file;
+}
+
+static void request_dump(int) {
+    dump_requested = 1;
+}
+
+/**
+ * \brief Makes SIGUSR1 write the ring to a file while the program runs.
+ * \param path The file, rewritten on every signal.
+ * \param binary Whether to write the binary form instead of text.
+ * \param source The program text for line:column; it must outlive the tracing.
+ */
+void trace_on_signal(const char *path, bool binary, const string *source) {
+    signal_path = path;
+    signal_binary = binary;
+    signal_source = source;
+    signal(SIGUSR1, request_dump);
+}
@@ -0,0 +1,108 @@
+/**
+ * \file trace.h
+ * \brief Recording every interp() call into a fixed-size ring buffer.
+ *
+ * While tracing is on, each interp() writes one event when it starts and one
+ * when it finishes: the node type (as in profile.h), the node's source offset
+ * and, on the way out, what kind of value it returned or that it threw. Events
+ * are 8 bytes each and go into a ring allocated once by trace_start(), so a
+ * long run keeps only the most recent ones and never allocates while tracing.
+ * With tracing off the hooks only test trace_enabled.
+ *
+ * The ring can be written as text, one indented line per event, or in a
+ * compact binary form:
+ *
+ *     "MSDT", version byte, u32 event count, u64 sequence number of the first event,
+ *     then per event: i32 offset, u16 depth, u8 node, u8 kind
+ *
+ * with every number little-endian. trace_on_signal() makes SIGUSR1 write the
+ * ring to a file at the next interp() call, so a running program can be looked
+ * at without stopping it.
+ *
+ * Tracing is per thread: trace_start() turns it on, with its own ring, only for
+ * the thread that calls it. The SIGUSR1 request is shared, and the next traced
+ * interp() on any thread writes out that thread's ring.
+ */
+
+#ifndef EXPRESSIONCLASSES_TRACE_H
+#define EXPRESSIONCLASSES_TRACE_H
+
+#include <iostream>
+#include <string>
+#include <cstddef>
+#include "pointer.h"
+#include "profile.h"
+
+class Val;
+
+typedef enum {
+    trace_enter,        //the node started
+    trace_num,          //the node returned a NumVal
+    trace_bool,
+    trace_fun,
+    trace_thunk,
+    trace_threw         //the node was left by an exception
+} trace_kind_t;
+
+typedef struct {
+    int offset;             //span.start of the node, or -1
+    unsigned short depth;   //how many traced calls enclose this one, capped at 65535
+    unsigned char node;     //profile_node_t
+    unsigned char kind;     //trace_kind_t
+} trace_event_t;
+
+const size_t TRACE_DEFAULT_EVENTS = 1 << 16;
+
+extern THREAD_STATE bool trace_enabled;
+
+//Allocates a ring of at least events entries (rounded up to a power of two), clears it and turns tracing on
+void trace_start(size_t events = TRACE_DEFAULT_EVENTS);
+//Turns tracing off; what was recorded stays until the next trace_start()
+void trace_stop();
+//Events recorded since trace_start(), including ones the ring has since dropped
+unsigned long long trace_total();
+void trace_dump_text(std::ostream &out, const std::string &source = "");
+void trace_dump_binary(std::ostream &out);
+//Writes the ring to path (as text with source, or binary) whenever the process gets SIGUSR1
+void trace_on_signal(const char *path, bool binary, const std::string *source);
+//Writes the ring to path now; false if the file could not be written
+bool trace_write_file(const char *path, bool binary, const std::string &source);
+
+/**
+ * \brief Records the start and the end of one interp() call.
+ * Return through result() so the end event says what kind of value came back;
+ * a scope left any other way is recorded as having thrown.
+ */
+class TraceScope {
+public:
+    TraceScope(profile_node_t node, int offset) {
+        active = trace_enabled;
+        if (active) {
+            enter(node, offset);
+        }
+    }
+    ~TraceScope() {
+        if (active) {
+            leave();
+        }
+    }
+    //Notes the kind of v for the end event and hands v back
+    PTR(Val) result(PTR(Val) v) {
+        if (active) {
+            kind = kind_of(v.get());
+        }
+        return v;
+    }
+
+private:
+    bool active;
+    profile_node_t node;
+    int offset;
+    trace_kind_t kind;
+
+    void enter(profile_node_t node, int offset);
+    void leave();
+    static trace_kind_t kind_of(const Val *v);
+};
+
+#endif //EXPRESSIONCLASSES_TRACE_H
@@ -0,0 +1,301 @@
+/**
+ * \file typecheck.cpp
+ * \brief Unification, generalization and the entry points declared in typecheck.h.
+ */
+
+#include "typecheck.h"
+#include "Expr.h"
+
+#include <map>
+#include <climits>
+
+using namespace std;
+
+//Level of a generalized type variable; instantiation replaces these with fresh ones
+static const int GENERIC_LEVEL = INT_MAX;
+
+Type::Type(type_kind_t kind) {
+    this->kind = kind;
+    this->level = 0;
+    this->id = 0;
+}
+
+/**
+ * \brief Follows bound type variables to the type they stand for.
+ * \param t Any type.
+ * \return t itself unless it is a bound variable.
+ */
+PTR(Type) resolve(PTR(Type) t) {
+    while (t->kind == ty_var && t->link != nullptr) {
+        t = t->link;
+    }
+    return t;
+}
+
+static void type_to_string(PTR(Type) t, string &out, bool in_arrow) {
+    t = resolve(t);
+    switch (t->kind) {
+        case ty_num:
+            out += "int";
+            break;
+        case ty_bool:
+            out += "bool";
+            break;
+        case ty_var:
+            out += "'t" + std::to_string(t->id);
+            break;
+        case ty_args:
+            out += "(";
+            for (size_t i = 0; i < t->args.size(); i++) {
+                if (i > 0) {
+                    out += ", ";
+                }
+                type_to_string(t->args[i], out, false);
+            }
+            out += ")";
+            break;
+        case ty_fun:
+        default:
+            if (in_arrow) {
+                out += "(";
+            }
+            type_to_string(t->from, out, true);
+            out += " -> ";
+            type_to_string(t->to, out, false);
+            if (in_arrow) {
+                out += ")";
+            }
+            break;
+    }
+}
+
+/**
+ * \brief Writes a type the usual way, e.g. "(int -> bool) -> int" or "(int, int) -> int".
+ * \param t The type.
+ * \return Its text; unbound variables print as 't1, 't2, ...
+ */
+string type_to_string(PTR(Type) t) {
+    string out;
+    type_to_string(t, out, false);
+    return out;
+}
+
+TypeChecker::TypeChecker() {
+    level = 0;
+    next_id = 0;
+    num_type = NEW(Type)(ty_num);
+    bool_type = NEW(Type)(ty_bool);
+}
+
+PTR(Type) TypeChecker::num() {
+    return num_type;
+}
+
+PTR(Type) TypeChecker::boolean() {
+    return bool_type;
+}
+
+PTR(Type) TypeChecker::fresh() {
+    PTR(Type) t = NEW(Type)(ty_var);
+    t->level = level;
+    t->id = ++next_id;
+    return t;
+}
+
+PTR(Type) TypeChecker::fun(PTR(Type) from, PTR(Type) to) {
+    PTR(Type) t = NEW(Type)(ty_fun);
+    t->from = from;
+    t->to = to;
+    return t;
+}
+
+PTR(Type) TypeChecker::fun(const vector<PTR(Type)> &from, PTR(Type) to) {
+    if (from.size() == 1) {
+        return fun(from[0], to);
+    }
+    PTR(Type) args = NEW(Type)(ty_args);
+    args->args = from;
+    return fun(args, to);
+}
+
+//Whether var occurs in t; also lowers the levels in t so nothing escapes its _let
+static bool occurs(PTR(Type) var, PTR(Type) t) {
+    t = resolve(t);
+    if (t == var) {
+        return true;
+    }
+    if (t->kind == ty_var) {
+        if (t->level > var->level) {
+            t->level = var->level;
+        }
+        return false;
+    }
+    if (t->kind == ty_fun) {
+        return occurs(var, t->from) || occurs(var, t->to);
+    }
+    if (t->kind == ty_args) {
+        for (size_t i = 0; i < t->args.size(); i++) {
+            if (occurs(var, t->args[i])) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void arity_mismatch(Expr *where, size_t expected_count, size_t actual_count) {
+    throw TypeError("type error: " + where->to_string() + " passes " + std::to_string(actual_count)
+                    + " argument" + (actual_count == 1 ? "" : "s") + " to a function of "
+                    + std::to_string(expected_count));
+}
+
+/**
+ * \brief Makes two types equal by binding type variables, or throws TypeError.
+ * \param expected The type the context needs.
+ * \param actual The type the expression has.
+ * \param where The expression being checked, for the error message.
+ */
+void TypeChecker::unify(PTR(Type) expected, PTR(Type) actual, Expr *where) {
+    expected = resolve(expected);
+    actual = resolve(actual);
+    if (expected == actual) {
+        return;
+    }
+    if (expected->kind == ty_var || actual->kind == ty_var) {
+        PTR(Type) var = expected->kind == ty_var ? expected : actual;
+        PTR(Type) other = var == expected ? actual : expected;
+        //A variable in a parameter position stands for one parameter, never for a list of them
+        if (other->kind == ty_args) {
+            arity_mismatch(where, var == expected ? 1 : other->args.size(), var == actual ? 1 : other->args.size());
+        }
+        if (occurs(var, other)) {
+            throw TypeError("type error: " + where->to_string() + " needs a recursive type "
+                            + type_to_string(var) + " = " + type_to_string(other));
+        }
+        var->link = other;
+        return;
+    }
+    if (expected->kind == ty_fun && actual->kind == ty_fun) {
+        unify(expected->from, actual->from, where);
+        unify(expected->to, actual->to, where);
+        return;
+    }
+    if (expected->kind == ty_args && actual->kind == ty_args && expected->args.size() == actual->args.size()) {
+        for (size_t i = 0; i < expected->args.size(); i++) {
+            unify(expected->args[i], actual->args[i], where);
+        }
+        return;
+    }
+    if (expected->kind == ty_args || actual->kind == ty_args) {
+        size_t expected_count = expected->kind == ty_args ? expected->args.size() : 1;
+        size_t actual_count = actual->kind == ty_args ? actual->args.size() : 1;
+        if (expected_count != actual_count) {
+            arity_mismatch(where, expected_count, actual_count);
+        }
+    }
+    if (expected->kind != actual->kind) {
+        throw TypeError("type error: " + where->to_string() + " has type " + type_to_string(actual)
+                        + " but " + type_to_string(expected) + " was expected");
+    }
+}
+
+//A copy of t with its generalized variables replaced by fresh ones
+static PTR(Type) instantiate(TypeChecker &tc, PTR(Type) t, map<Type *, PTR(Type)> &fresh) {
+    t = resolve(t);
+    if (t->kind == ty_var && t->level == GENERIC_LEVEL) {
+        PTR(Type) &copy = fresh[t.get()];
+        if (copy == nullptr) {
+            copy = tc.fresh();
+        }
+        return copy;
+    }
+    if (t->kind == ty_fun) {
+        return tc.fun(instantiate(tc, t->from, fresh), instantiate(tc, t->to, fresh));
+    }
+    if (t->kind == ty_args) {
+        vector<PTR(Type)> args;
+        for (size_t i = 0; i < t->args.size(); i++) {
+            args.push_back(instantiate(tc, t->args[i], fresh));
+        }
+        PTR(Type) copy = NEW(Type)(ty_args);
+        copy->args = args;
+        return copy;
+    }
+    return t;
+}
+
+PTR(Type) TypeChecker::lookup(const string &name) {
+    for (size_t i = scope.size(); i > 0; i--) {
+        if (scope[i - 1].name == name) {
+            map<Type *, PTR(Type)> fresh;
+            return instantiate(*this, scope[i - 1].type, fresh);
+        }
+    }
+    throw TypeError("type error: free variable: " + name);
+}
+
+void TypeChecker::bind(const string &name, PTR(Type) t) {
+    binding_t b = { name, t };
+    scope.push_back(b);
+}
+
+void TypeChecker::unbind() {
+    scope.pop_back();
+}
+
+void TypeChecker::enter_let() {
+    level++;
+}
+
+static void generalize(PTR(Type) t, int level) {
+    t = resolve(t);
+    if (t->kind == ty_var && t->level > level) {
+        t->level = GENERIC_LEVEL;
+    } else if (t->kind == ty_fun) {
+        generalize(t->from, level);
+        generalize(t->to, level);
+    } else if (t->kind == ty_args) {
+        for (size_t i = 0; i < t->args.size(); i++) {
+            generalize(t->args[i], level);
+        }
+    }
+}
+
+void TypeChecker::leave_let(PTR(Type) t) {
+    level--;
+    generalize(t, level);
+}
+
+void TypeChecker::mark(Expr *node, PTR(Type) operand, type_kind_t kind) {
+    mark_t m = { node, operand, kind };
+    marks.push_back(m);
+}
+
+/**
+ * \brief Infers the type of a whole program.
+ * \param e The program.
+ * \return Its type.
+ * Throws TypeError if it has none.
+ */
+PTR(Type) infer_type(PTR(Expr) e) {
+    TypeChecker tc;
+    return e->infer(tc);
+}
+
+/**
+ * \brief Marks the nodes of a well-typed program for interp()'s unchecked fast paths.
+ * \param e The program, which must then be interpreted with an empty environment.
+ * \return True if the program is well typed and was marked.
+ */
+bool mark_typed(PTR(Expr) e) {
+    TypeChecker tc;
+    try {
+        e->infer(tc);
+    } catch (TypeError &) {
+        return false;
+    }
+    for (size_t i = 0; i < tc.marks.size(); i++) {
+        tc.marks[i].node->statically_typed = resolve(tc.marks[i].operand)->kind == tc.marks[i].kind;
+    }
+    return true;
+}
@@ -0,0 +1,114 @@
+/**
+ * \file typecheck.h
+ * \brief Hindley-Milner type inference for msdscript programs.
+ *
+ * Types are numbers, booleans and functions from one type, or from a fixed
+ * list of types for a function of several arguments, to another. Each
+ * Expr subclass infers its own type through infer(), unifying as it goes;
+ * _let generalizes its right-hand side, so a function bound by _let can be used
+ * at several types. Inference fails with a TypeError on a program that could
+ * go wrong at run time, and also on some that would not: self-application such
+ * as f(f) needs a recursive type, and _if on a non-boolean or == between
+ * different types are rejected although interp() allows them.
+ *
+ * mark_typed() runs inference and, when the whole program is well typed, sets
+ * statically_typed on the Add, Mult, IfExpr and EqExpr nodes whose operand
+ * types are then known, so their interp() can skip the run-time checks. A
+ * program that fails inference is left unmarked and runs fully checked.
+ */
+
+#ifndef EXPRESSIONCLASSES_TYPECHECK_H
+#define EXPRESSIONCLASSES_TYPECHECK_H
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include "pointer.h"
+
+class Expr;
+
+typedef enum {
+    ty_num,
+    ty_bool,
+    ty_fun,
+    ty_var,
+    ty_args
+} type_kind_t;
+
+/**
+ * \brief A type, or a type variable that unification may later bind.
+ */
+class Type {
+public:
+    type_kind_t kind;
+    PTR(Type) from;     //ty_fun
+    PTR(Type) to;       //ty_fun
+    PTR(Type) link;     //ty_var, once bound
+    std::vector<PTR(Type)> args;    //ty_args: the parameters of a function of several arguments
+    int level;          //ty_var: the _let depth it was made at, or GENERIC_LEVEL
+    int id;             //ty_var, for printing
+
+    explicit Type(type_kind_t kind);
+};
+
+/**
+ * \brief Thrown when a program has no type.
+ */
+class TypeError : public std::runtime_error {
+public:
+    explicit TypeError(const std::string &message) : std::runtime_error(message) {
+    }
+};
+
+/**
+ * \brief State of one inference run: the variables in scope and the _let depth.
+ */
+class TypeChecker {
+public:
+    TypeChecker();
+
+    PTR(Type) num();
+    PTR(Type) boolean();
+    PTR(Type) fresh();
+    PTR(Type) fun(PTR(Type) from, PTR(Type) to);
+    //A single argument makes the same type as fun(from, to); more make a ty_args parameter list
+    PTR(Type) fun(const std::vector<PTR(Type)> &from, PTR(Type) to);
+    void unify(PTR(Type) expected, PTR(Type) actual, Expr *where);
+
+    //The type of a variable in scope, with its generalized variables made fresh
+    PTR(Type) lookup(const std::string &name);
+    void bind(const std::string &name, PTR(Type) t);
+    void unbind();
+    void enter_let();
+    //Leaves a _let's right-hand side and generalizes its type
+    void leave_let(PTR(Type) t);
+
+    //Remembers a node whose fast path needs operand to turn out to be of kind
+    void mark(Expr *node, PTR(Type) operand, type_kind_t kind);
+
+    typedef struct {
+        Expr *node;
+        PTR(Type) operand;
+        type_kind_t kind;
+    } mark_t;
+    std::vector<mark_t> marks;
+
+private:
+    typedef struct {
+        std::string name;
+        PTR(Type) type;
+    } binding_t;
+
+    std::vector<binding_t> scope;
+    int level;
+    int next_id;
+    PTR(Type) num_type;
+    PTR(Type) bool_type;
+};
+
+PTR(Type) resolve(PTR(Type) t);
+std::string type_to_string(PTR(Type) t);
+PTR(Type) infer_type(PTR(Expr) e);
+bool mark_typed(PTR(Expr) e);
+
+#endif //EXPRESSIONCLASSES_TYPECHECK_H